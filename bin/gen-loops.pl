@@ -60,7 +60,11 @@ my $bGroup = 0x4;               # group path
 my $bSimd = 0x8;                # simd prefix
 my $bPrefetchL1 = 0x10;         # prefetch L1
 my $bPrefetchL2 = 0x20;         # prefetch L2
+my $bMorton = 0x40;             # morton path
+my $bHilbert = 0x80;            # hilbert path
+my $bBisect = 0x400;            # recursive bisection
 my $bPipe = 0x100;              # pipeline
+my $bRow = 0x200;               # whole row in one call
 
 ##########
 # Function to make names of variables based on dimension string(s).
@@ -78,6 +82,9 @@ sub stepVar {
 sub groupSizeVar {
     return join('_', 'group_size', @_);
 }
+sub leafSizeVar {
+    return join('_', 'leaf_size', @_);
+}
 
 # these are generated.
 sub numItersVar {
@@ -112,6 +119,32 @@ sub numLocalGroupItersVar {
 sub loopIndexVar {
     return join('_', 'loop_index', @_);
 }
+sub numItersPerDimVar {
+    return join('_', 'num_iters_per_dim', @_);
+}
+sub curveIndicesVar {
+    return join('_', 'indices_on_curve', @_);
+}
+sub numLeafItersVar {
+    return join('_', 'num_iters_in_leaf', @_);
+}
+sub numLeavesVar {
+    return join('_', 'num_leaves', @_);
+}
+sub leafFirstsVar {
+    return join('_', 'first_index_in_leaf', @_);
+}
+sub leafCountsVar {
+    return join('_', 'num_iters_in_this_leaf', @_);
+}
+
+# number of iterations of the collapsed loop.
+sub loopEndVar($$) {
+    my $loopDims = shift;       # ref to list of dimensions.
+    my $features = shift;       # bits for path types.
+    return ($features & $bBisect) ?
+        numLeavesVar(@$loopDims) : numItersVar(@$loopDims);
+}
 sub startVar {
     return join('_', 'start', @_);
 }
@@ -232,6 +265,16 @@ sub addIndexVars($$$) {
                     " // Number of *full* groups in $dim dimension.",
                     " const $itype $ntvar = $nvar / $ntivar;";
                 }
+
+                # For bisected loops.
+                if ($features & $bBisect) {
+                    my $lsvar = leafSizeVar($dim);
+                    my $nlvar = numLeafItersVar($dim);
+                    push @$code,
+                    " // Max number of iterations in one leaf in $dim dimension.".
+                    " This value is rounded up to a multiple of $svar.",
+                    " const $itype $nlvar = std::max<idx_t>(($lsvar + ($svar - 1)) / $svar, 1);";
+                }
             }
 
             # Pass 1: Product of sizes of this and remaining nested dimensions.
@@ -248,10 +291,75 @@ sub addIndexVars($$$) {
             }
         }
     }
+
+    # Number of leaves for bisected loops.
+    if ($features & $bBisect) {
+        my $ndims = scalar @$loopDims;
+        my $loopStr = dimStr(@$loopDims);
+        my $svar = numItersPerDimVar(@$loopDims);
+        my $sval = join(', ', map { numItersVar($_) } @$loopDims);
+        my $lvar = numLeafItersVar(@$loopDims);
+        my $lval = join(', ', map { numLeafItersVar($_) } @$loopDims);
+        my $nlvar = numLeavesVar(@$loopDims);
+        push @$code,
+        " // Number of iterations and max iterations per leaf in $loopStr for 'bisect' path.",
+        " const $itype ${svar}[] = { $sval };",
+        " const $itype ${lvar}[] = { $lval };",
+        " // Number of leaves from recursively bisecting $loopStr.",
+        " const $itype $nlvar = bisectNumLeaves($ndims, $svar, $lvar);";
+    }
+}
+
+# Add code to modify zero-based index '$divar' in dim '$dim' and index
+# '$prevDivar' in the enclosing dim for 'square_wave' and/or 'serpentine'
+# paths. '$nvar' and '$prevNvar' are the numbers of iterations in those
+# dims, and '$innerNvar' is the number in the inner dim.
+sub addPathMods($$$$$$$$$) {
+    my $code = shift;           # ref to list of code lines.
+    my $features = shift;       # bits for path types.
+    my $isInnerSquare = shift;  # true to apply square-wave.
+    my $dim = shift;
+    my $divar = shift;
+    my $nvar = shift;
+    my $prevDivar = shift;      # may be undef.
+    my $prevNvar = shift;       # may be undef.
+    my $innerNvar = shift;
+
+    # apply square-wave to inner 2 dimensions if requested.
+    if ($isInnerSquare) {
+
+        my $divar2 = "${divar}_x2";
+        my $avar = "${prevDivar}_lsb";
+        push @$code, 
+        " // Modify $prevDivar and $divar for 'square_wave' path.",
+        " if (($innerNvar > 1) && ($prevDivar/2 < $prevNvar/2)) {",
+        "  // Compute extended $dim index over 2 iterations of $prevDivar.",
+        "  idx_t $divar2 = $divar + ($nvar * ($prevDivar & 1));",
+        "  // Select $divar from 0,0,1,1,2,2,... sequence",
+        "  $divar = $divar2 / 2;",
+        "  // Select $prevDivar adjustment value from 0,1,1,0,0,1,1, ... sequence.",
+        "  idx_t $avar = ($divar2 & 1) ^ (($divar2 & 2) >> 1);",
+        "  // Adjust $prevDivar +/-1 by replacing bit 0.",
+        "  $prevDivar = ($prevDivar & (idx_t)-2) | $avar;",
+        " } // square-wave.";
+    }
+
+    # reverse order of every-other traversal if requested.
+    # for inner dim with square-wave, do every 2.
+    if (($features & $bSerp) && defined $prevDivar) {
+        if ($isInnerSquare) {
+            push @$code,
+            " // Reverse direction of $divar after every-other iteration of $prevDivar for 'square_wave serpentine' path.",
+            " if (($prevDivar & 2) == 2) $divar = $nvar - $divar - 1;";
+        } else {
+            push @$code,
+            " // Reverse direction of $divar after every iteration of $prevDivar for  'serpentine' path.",
+            " if (($prevDivar & 1) == 1) $divar = $nvar - $divar - 1;";
+        }
+    }
 }
 
 # Add index variables *inside* the loop.
-# TODO: add prefetch for grouping.
 sub addIndexVars2($$$$$) {
     my $code = shift;           # ref to list of code lines.
     my $loopDims = shift;       # ref to list of dimensions in loop.
@@ -265,16 +373,96 @@ sub addIndexVars2($$$$$) {
     my $outerDim = $loopDims->[0];            # outer dim of these loops.
     my $innerDim = $loopDims->[$#$loopDims];  # inner dim of these loops.
 
-    # Grouping.
-    if ($features & $bGroup) {
+    # Recursive bisection.
+    # Each iteration is one leaf, which may cover more than one
+    # step in each dim, so the start and stop vars are set here.
+    if ($features & $bBisect) {
+        
+        die "error: prefetching not compatible with bisect.\n"
+            if $isPrefetch;
+        die "error: bisect not compatible with other paths.\n"
+            if $features & ($bGroup | $bSerp | $bSquare | $bMorton | $bHilbert);
 
-        die "error: prefetching not compatible with grouping.\n"
+        my $ndims = scalar @$loopDims;
+        my $svar = numItersPerDimVar(@$loopDims);
+        my $lvar = numLeafItersVar(@$loopDims);
+        my $fvar = leafFirstsVar(@$loopDims);
+        my $cvar = leafCountsVar(@$loopDims);
+        push @$code,
+        " // Zero-based, unit-stride first indices and numbers of iterations".
+            " in ".dimStr(@$loopDims)." for this leaf of 'bisect' path.",
+        " $itype ${fvar}[$ndims], ${cvar}[$ndims];",
+        " bisectIndices($civar, $ndims, $svar, $lvar, $fvar, $cvar);";
+        for my $i (0 .. $ndims-1) {
+            my $dim = $loopDims->[$i];
+            my $divar = indexVar($dim);
+            my $stvar = startVar($dim);
+            my $spvar = stopVar($dim);
+            my $bvar = beginVar($dim);
+            my $evar = endVar($dim);
+            my $stepvar = stepVar($dim);
+            push @$code,
+            " $itype $divar = ${fvar}[$i];",
+            " // This leaf covers $dim from $stvar to $spvar-1.",
+            " const idx_t $stvar = $bvar + ($divar * $stepvar);",
+            " const idx_t $spvar = std::min($stvar + (${cvar}[$i] * $stepvar), $evar);";
+        }
+        return;
+    }
+
+    # Space-filling curve.
+    # The indices are found by a function because the path
+    # depends on the number of iterations in each dim.
+    if ($features & ($bMorton | $bHilbert)) {
+        my $path = ($features & $bMorton) ? 'morton' : 'hilbert';
+        
+        die "error: morton not compatible with hilbert.\n"
+            if ($features & $bMorton) && ($features & $bHilbert);
+        die "error: prefetching not compatible with $path.\n"
             if $isPrefetch;
-        die "error: serpentine not compatible with grouping.\n"
+        die "error: grouping not compatible with $path.\n"
+            if $features & $bGroup;
+        die "error: serpentine not compatible with $path.\n"
             if $features & $bSerp;
-        die "error: square-wave not compatible with grouping.\n"
+        die "error: square-wave not compatible with $path.\n"
             if $features & $bSquare;
 
+        my $ndims = scalar @$loopDims;
+        my $svar = numItersPerDimVar(@$loopDims);
+        my $sval = join(', ', map { numItersVar($_) } @$loopDims);
+        my $cvar = curveIndicesVar(@$loopDims);
+        my $fn = $path.'Indices';
+        push @$code,
+        " // Zero-based, unit-stride indices for ".dimStr(@$loopDims)." along '$path' path.",
+        " const $itype ${svar}[] = { $sval };",
+        " $itype ${cvar}[$ndims];",
+        " $fn($civar, $ndims, $svar, $cvar);";
+        for my $i (0 .. $ndims-1) {
+            my $dim = $loopDims->[$i];
+            my $divar = indexVar($dim);
+            push @$code,
+            " $itype $divar = ${cvar}[$i];";
+        }
+    }
+
+    # Grouping.
+    # Paths within each group are modified by serpentine and/or square-wave.
+    elsif ($features & $bGroup) {
+
+        # Vars that change for each iteration get a prefetch suffix when
+        # prefetching so they don't clash with those for the current one.
+        my $pf = sub { my $v = shift; return $isPrefetch ? $v."_pf$genericCache" : $v; };
+        my $ivar = $isPrefetch ? $pfcivar : $civar;
+
+        # prefetch is offset from main index.
+        # it is limited to the last iteration because the group sizes
+        # are not defined beyond it.
+        if ($isPrefetch) {
+            push @$code, " // Prefetch loop index var.",
+            " $itype $pfcivar = std::min($civar + PFD$genericCache, ".
+                numItersVar(@$loopDims)." - 1);";
+        }
+
         my $ndims = scalar @$loopDims;
 
         # declare local size vars.
@@ -283,21 +471,18 @@ sub addIndexVars2($$$$$) {
             " reduced if we are in a partial group.";
         for my $i (0 .. $ndims-1) {
             my $dim = $loopDims->[$i];
-            my $ltvar = numLocalGroupItersVar($dim);
+            my $ltvar = &$pf(numLocalGroupItersVar($dim));
             my $ltval = numFullGroupItersVar($dim);
             push @$code, " $itype $ltvar = $ltval;";
         }
 
         # calculate group indices and sizes and 1D offsets within groups.
-        my $prevOvar = $civar;  # previous offset.
+        my $prevOvar = $ivar;  # previous offset.
         for my $i (0 .. $ndims-1) {
 
             # dim at $i.
             my $dim = $loopDims->[$i];
 
-            # dims up to (outside of) $i (empty for outer dim)
-            my @outDims = @$loopDims[0 .. $i - 1];
-            
             # dims up to (outside of) and including $i.
             my @dims = @$loopDims[0 .. $i];
             
@@ -306,9 +491,9 @@ sub addIndexVars2($$$$$) {
             my $inStr = dimStr(@inDims);
 
             # Size of group set.
-            my $tgvar = numGroupSetItersVar(@inDims);
+            my $tgvar = &$pf(numGroupSetItersVar(@inDims));
             my $tgval = join(' * ', 
-                             (map { numLocalGroupItersVar($_) } @dims),
+                             (map { &$pf(numLocalGroupItersVar($_)) } @dims),
                              (map { numItersVar($_) } @inDims));
             my $tgStr = @inDims ?
                 "the set of groups across $inStr" : "this group";
@@ -317,21 +502,21 @@ sub addIndexVars2($$$$$) {
             " $itype $tgvar = $tgval;";
 
             # Index of this group in this dim.
-            my $tivar = groupIndexVar($dim);
+            my $tivar = &$pf(groupIndexVar($dim));
             my $tival = "$prevOvar / $tgvar";
             push @$code,
             " // Index of this group in $dim dimension.",
             " $itype $tivar = $tival;";
             
             # 1D offset within group set.
-            my $ovar = groupSetOffsetVar(@inDims);
+            my $ovar = &$pf(groupSetOffsetVar(@inDims));
             my $oval = "$prevOvar % $tgvar";
             push @$code,
             " // Linear offset within $tgStr.",
             " $itype $ovar = $oval;";
             
             # Size of this group in this dim.
-            my $ltvar = numLocalGroupItersVar($dim);
+            my $ltvar = &$pf(numLocalGroupItersVar($dim));
             my $ltval = numItersVar($dim).
                 " - (".numGroupsVar($dim)." * ".numFullGroupItersVar($dim).")";
             push @$code,
@@ -343,29 +528,31 @@ sub addIndexVars2($$$$$) {
             $prevOvar = $ovar;
         }
 
-        # Calculate nD indices within group and overall.
-        # TODO: allow different paths *within* group.
+        # Calculate nD offsets within group.
+        my ($prevDovar, $prevLtvar);
+        my $innerLtvar = &$pf(numLocalGroupItersVar($innerDim));
         for my $i (0 .. $ndims-1) {
             my $dim = $loopDims->[$i];
-            my $tivar = groupIndexVar($dim);
-            my $ovar = groupSetOffsetVar(); # last one calculated above.
+            my $ovar = &$pf(groupSetOffsetVar()); # last one calculated above.
+            my $ltvar = &$pf(numLocalGroupItersVar($dim));
+            my $isInner = ($i == $ndims-1);
 
             # dims after (inside of) $i (empty for inner dim)
             my @inDims = @$loopDims[$i + 1 .. $ndims - 1];
             
             # Determine offset within this group.
-            my $dovar = groupOffsetVar($dim);
+            my $dovar = &$pf(groupOffsetVar($dim));
             my $doval = $ovar;
 
             # divisor of index is product of sizes of remaining nested dimensions.
             if (@inDims) {
-                my $subVal = join(' * ', map { numLocalGroupItersVar($_) } @inDims);
+                my $subVal = join(' * ', map { &$pf(numLocalGroupItersVar($_)) } @inDims);
                 $doval .= " / ($subVal)";
             }
 
             # mod by size of this dimension (not needed for outer-most dim).
             if ($i > 0) {
-                $doval = "($doval) % ".numLocalGroupItersVar($dim);
+                $doval = "($doval) % $ltvar";
             }
 
             # output offset in this dim.
@@ -373,11 +560,24 @@ sub addIndexVars2($$$$$) {
             " // Offset within this group in $dim dimension.",
             " $itype $dovar = $doval;";
 
-            # final index in this dim.
-            my $divar = indexVar($dim);
+            # modify path within group.
+            my $isInnerSquare = $ndims >= 2 && $isInner && ($features & $bSquare);
+            addPathMods($code, $features, $isInnerSquare, $dim, $dovar, $ltvar,
+                        $prevDovar, $prevLtvar, $innerLtvar);
+
+            $prevDovar = $dovar;
+            $prevLtvar = $ltvar;
+        }
+
+        # Calculate final indices after all offsets are set.
+        for my $i (0 .. $ndims-1) {
+            my $dim = $loopDims->[$i];
+            my $tivar = &$pf(groupIndexVar($dim));
+            my $dovar = &$pf(groupOffsetVar($dim));
+            my $divar = $isPrefetch ? pfIndexVar($dim) : indexVar($dim);
             my $dival = numFullGroupItersVar($dim)." * $tivar + $dovar";
             push @$code,
-            " // Zero-based, unit-stride index for $dim.",
+            " // Zero-based, unit-stride ".($isPrefetch ? 'prefetch ' : '')."index for $dim.",
             " $itype $divar = $dival;";
         }
     }
@@ -436,39 +636,10 @@ sub addIndexVars2($$$$$) {
             " // Zero-based, unit-stride ".($isPrefetch ? 'prefetch ' : '')."index for $dim.",
             " idx_t $divar = $dival;";
 
-            # apply square-wave to inner 2 dimensions if requested.
+            # apply square-wave and/or serpentine if requested.
             my $isInnerSquare = @$loopDims >=2 && $isInner && ($features & $bSquare);
-            if ($isInnerSquare) {
-
-                my $divar2 = "${divar}_x2";
-                my $avar = "${prevDivar}_lsb";
-                push @$code, 
-                " // Modify $prevDivar and $divar for 'square_wave' path.",
-                " if (($innerNvar > 1) && ($prevDivar/2 < $prevNvar/2)) {",
-                "  // Compute extended $dim index over 2 iterations of $prevDivar.",
-                "  idx_t $divar2 = $divar + ($nvar * ($prevDivar & 1));",
-                "  // Select $divar from 0,0,1,1,2,2,... sequence",
-                "  $divar = $divar2 / 2;",
-                "  // Select $prevDivar adjustment value from 0,1,1,0,0,1,1, ... sequence.",
-                "  idx_t $avar = ($divar2 & 1) ^ (($divar2 & 2) >> 1);",
-                "  // Adjust $prevDivar +/-1 by replacing bit 0.",
-                "  $prevDivar = ($prevDivar & (idx_t)-2) | $avar;",
-                " } // square-wave.";
-            }
-
-            # reverse order of every-other traversal if requested.
-            # for inner dim with square-wave, do every 2.
-            if (($features & $bSerp) && defined $prevDivar) {
-                if ($isInnerSquare) {
-                    push @$code,
-                    " // Reverse direction of $divar after every-other iteration of $prevDivar for 'square_wave serpentine' path.",
-                    " if (($prevDivar & 2) == 2) $divar = $nvar - $divar - 1;";
-                } else {
-                    push @$code,
-                    " // Reverse direction of $divar after every iteration of $prevDivar for  'serpentine' path.",
-                    " if (($prevDivar & 1) == 1) $divar = $nvar - $divar - 1;";
-                }
-            }
+            addPathMods($code, $features, $isInnerSquare, $dim, $divar, $nvar,
+                        $prevDivar, $prevNvar, $innerNvar);
 
             $prevDim = $dim;
             $prevDivar = $divar;
@@ -476,6 +647,7 @@ sub addIndexVars2($$$$$) {
         }
     }
     
+
     # start and stop vars based on individual begin, end, step, and index vars.
     for my $dim (@$loopDims) {
         my $divar = $isPrefetch ? pfIndexVar($dim) : indexVar($dim);
@@ -501,7 +673,7 @@ sub beginLoop($$$$$$$) {
     my $features = shift;       # bits for path types.
     my $loopStack = shift;      # whole stack, including enclosing dims.
 
-    $endVal = numItersVar(@$loopDims) if !defined $endVal;
+    $endVal = loopEndVar($loopDims, $features) if !defined $endVal;
     my $itype = indexType(@$loopDims);
     my $ivar = loopIndexVar(@$loopDims);
     push @$code, @$prefix if defined $prefix;
@@ -609,7 +781,7 @@ sub getArgs($$) {
   return @args;
 }
 
-# Process the loop-code string.
+# Process the loop-code string for one variant and return the lines of code.
 # This is where most of the work is done.
 sub processCode($) {
     my $codeString = shift;
@@ -699,6 +871,11 @@ sub processCode($) {
             $features |= $bPipe;
         }
         
+        # calculate whole row of next loop in one call if possible.
+        elsif (lc $tok eq 'row') {
+            $features |= $bRow;
+        }
+        
         # use grouped path in next loop if possible.
         elsif (lc $tok eq 'grouped') {
             $features |= $bGroup;
@@ -714,6 +891,21 @@ sub processCode($) {
             $features |= $bSquare;
         }
         
+        # use Z-order path in next loop if possible.
+        elsif (lc $tok eq 'morton') {
+            $features |= $bMorton;
+        }
+        
+        # use Hilbert-curve path in next loop if possible.
+        elsif (lc $tok eq 'hilbert') {
+            $features |= $bHilbert;
+        }
+        
+        # use recursive bisection in next loop if possible.
+        elsif (lc $tok eq 'bisect') {
+            $features |= $bBisect;
+        }
+        
         # beginning of a loop.
         # also eats the args in parens and the following '{'.
         elsif (lc $tok eq 'loop') {
@@ -740,13 +932,37 @@ sub processCode($) {
             }
 
             # check for piping legality.
+            # a pipelined loop is calculated as one row.
             if ($features & $bPipe) {
-                if (@loopDims == 1) {
+                if (!defined $innerDim || @loopDims != 1) {
+                    warn "warning: pipeline requested, but it is not possible because following loop ".
+                        "is not a simple inner loop.\n";
+                    $features &= ~$bPipe;
+                } else {
                     warn "info: pipelining following loop.\n";
+                    if ($features & $bRow) {
+                        warn "info: row is implied by pipeline.\n";
+                        $features &= ~$bRow;
+                    }
+                    if ($features & ($bPrefetchL1 | $bPrefetchL2)) {
+                        warn "warning: prefetch is not generated in pipelined loop.\n";
+                        $features &= ~($bPrefetchL1 | $bPrefetchL2);
+                    }
+                }
+            }
+
+            # check for row legality.
+            if ($features & $bRow) {
+                if (!defined $innerDim || @loopDims != 1) {
+                    warn "warning: row requested, but it is not possible because following loop ".
+                        "is not a simple inner loop.\n";
+                    $features &= ~$bRow;
                 } else {
-                    warn "warning: pipeline requested, but it is not possible because there are ".
-                        scalar(@loopDims). " dimensions in following loop.\n";
-                    $features &= ~$bPipe;
+                    warn "info: calculating following loop as one row.\n";
+                    if ($features & ($bPrefetchL1 | $bPrefetchL2)) {
+                        warn "warning: prefetch is not generated in row loop.\n";
+                        $features &= ~($bPrefetchL1 | $bPrefetchL2);
+                    }
                 }
             }
 
@@ -820,6 +1036,12 @@ sub processCode($) {
                     $arg = $OPT{pipePrefix}.$arg.'_'.$innerDim;
                 }
 
+                # add row prefix and direction suffix to function name.
+                # e.g., row_fn_z.
+                if ($features & $bRow) {
+                    $arg = $OPT{rowPrefix}.$arg.'_'.$innerDim;
+                }
+
                 # code for calculations.
                 # e.g., calc_fn(...); calc_pipe_fn_z();
                 push @calcStmts, "  $OPT{calcPrefix}$arg(".
@@ -840,6 +1062,27 @@ sub processCode($) {
                 endLoop(\@code);
             }
 
+            # inner loop calculated by one call.
+            # the called function iterates over the whole row,
+            # software-pipelining the clusters if requested.
+            elsif ($features & ($bRow | $bPipe)) {
+                my $bVar = beginVar($innerDim);
+                my $eVar = endVar($innerDim);
+                push @code, " // Calculate $innerDim from $bVar to $eVar-1 in one call.",
+                    " {",
+                    " const idx_t ".startVar($innerDim)." = $bVar;",
+                    " const idx_t ".stopVar($innerDim)." = $eVar;",
+                    @calcStmts,
+                    " }";
+
+                # clear code buffers and other data for this loop.
+                undef @calcStmts;
+                undef $innerDim;
+                undef @loopDims;
+                undef @loopPrefix;
+                $features = 0;
+            }
+
             # inner loop.
             # for each part of loop, need to
             # - start it,
@@ -847,15 +1090,10 @@ sub processCode($) {
             # - end it.
             else {
                 
-                my $ucDir = uc($innerDim);
                 my $pfd = "PFD$genericCache";
                 my $nVar = numItersVar(@loopDims);
                 my $doSplitL2 = ($features & $bPrefetchL2) && $OPT{splitL2};
 
-                # declare pipeline vars.
-                push @code, " // Pipeline accumulators.", " MAKE_PIPE_$ucDir;"
-                    if ($features & $bPipe);
-
                 # check prefetch settings.
                 if (($features & $bPrefetchL1) && ($features & $bPrefetchL2)) {
                     push @code, " // Check prefetch settings.",
@@ -875,7 +1113,12 @@ sub processCode($) {
                         push @pfCode, " // Prime prefetch to $genericCache.";
                         
                         # prefetch loop.
-                        beginLoop(\@pfCode, \@loopDims, \@loopPrefix, 0, $pfd, $features, \@loopStack);
+                        # with grouping, it is limited to the number of
+                        # iterations because the group sizes are not
+                        # defined beyond it.
+                        my $pfEnd = ($features & $bGroup) ?
+                            "std::min<".indexType(@loopDims).">($pfd, $nVar)" : $pfd;
+                        beginLoop(\@pfCode, \@loopDims, \@loopPrefix, 0, $pfEnd, $features, \@loopStack);
                         push @pfCode, " // Prefetch to $genericCache.", @pfStmtsFullHere;
                         endLoop(\@pfCode);
                         
@@ -885,22 +1128,6 @@ sub processCode($) {
                     }
                 }           # PF.
 
-                # pipeline-priming loop.
-                if ($features & $bPipe) {
-
-                    # start the loop STENCIL_ORDER before 0.
-                    # TODO: make this more general.
-                    push @code, " // Prime the calculation pipeline.";
-                    beginLoop(\@code, \@loopDims, \@loopPrefix, "-STENCIL_ORDER", 0, $features, \@loopStack);
-
-                    # select only pipe instructions, change calc to prime prefix.
-                    my @primeStmts = grep(m=//|$OPT{pipePrefix}=, @calcStmts);
-                    map { s/$OPT{calcPrefix}/$OPT{primePrefix}/ } @primeStmts;
-                    push @code, @primeStmts;
-
-                    endLoop(\@code);
-                }
-
                 # midpoint calculation for L2 prefetch only.
                 if ($doSplitL2) {
                     my $ofs = ($features & $bPrefetchL1) ? "(PFDL2-PFDL1)" : "PFDL2";
@@ -922,7 +1149,7 @@ sub processCode($) {
 
                     my $name = "Computation";
                     my $endVal = ($loop == $lastLoop) ?
-                        numItersVar(@loopDims) : midVar(@loopDims);
+                        loopEndVar(\@loopDims, $features) : midVar(@loopDims);
                     my $beginVal = ($lastLoop > 0 && $loop == $lastLoop) ?
                         midVar(@loopDims) : 0;
 
@@ -998,6 +1225,34 @@ sub processCode($) {
     die "error: ".(scalar @loopStack)." loop(s) not closed.\n"
         if @loopStack;
 
+    return @code;
+}
+
+# Print the code for all the variants to the output file.
+sub printCode($$) {
+    my $codeString = shift;     # original pseudo-code.
+    my $variants = shift;       # ref to list of refs to code for each variant.
+
+    my @code;
+    if (@$variants == 1) {
+        @code = @{$variants->[0]};
+    }
+
+    # Select the variant at run-time.
+    # Variant 0 is also used for any unknown value, but the
+    # value should be checked before using this code.
+    else {
+        my $var = $OPT{variantVar};
+        push @code, " // Run the loop-code variant selected by '$var'.",
+        "switch ($var) {";
+        for my $i (0 .. $#$variants) {
+            push @code, " // Loop-code variant $i.";
+            push @code, "default:" if $i == 0;
+            push @code, "case $i: {", @{$variants->[$i]}, "} break;";
+        }
+        push @code, "} // switch ($var).";
+    }
+
     # indent program avail?
     my $indent = 'indent';
     if (system("which $indent &> /dev/null")) {
@@ -1047,13 +1302,14 @@ sub main() {
         [ "dims=s", "Comma-separated names of dimensions (in order passed via calls).", 'v,x,y,z'],
         [ "comArgs=s", "Common arguments to all calls (after L1/L2 for prefetch).", ''],
         [ "calcPrefix=s", "Prefix for calculation call.", 'calc_'],
-        [ "primePrefix=s", "Prefix for pipeline-priming call.", 'prime_'],
         [ "pipePrefix=s", "Additional prefix for pipeline call.", 'pipe_'],
+        [ "rowPrefix=s", "Additional prefix for row call.", 'row_'],
         [ "pfPrefix=s", "Prefix for prefetch call.", 'prefetch_'],
         [ "ompConstruct=s", "Pragma to use before 'omp' loop(s).", "omp parallel for"],
         [ "innerMod=s", "Code to insert before inner computation loops.",
           '_Pragma("nounroll_and_jam") _Pragma("nofusion")'],
         [ "splitL2!", "Split inner loops with L2 prefetching.", 0],
+        [ "variantVar=s", "Variable selecting among loop-code variants at run-time.", 'loop_variant'],
         [ "output=s", "Name of output file.", 'loops.h'],
         );
     my($command_line) = process_command_line(\%OPT, \@KNOBS);
@@ -1062,15 +1318,17 @@ sub main() {
     my $script = basename($0);
     if (!$command_line || $OPT{help} || @ARGV < 1) {
         print "Outputs C++ code for a loop block.\n",
-            "Usage: $script [options] <loop-code-string>\n",
+            "Usage: $script [options] <loop-code-string>[ | <loop-code-string>...]\n",
             "Examples:\n",
             "  $script -dims x,y 'loop(x,y) { calc(f); }'\n",
             "  $script -dims x,y,z 'omp loop(x,y) { loop(z) { calc(f); } }'\n",
             "  $script -dims x,y,z 'omp loop(x,y) { prefetch loop(z) { calc(f); } }'\n",
-            #"  $script -dims x,y,z 'omp loop(x,y) { pipeline loop(z) { calc(f); } }'\n",
+            "  $script -dims x,y,z 'omp loop(x,y) { pipeline loop(z) { calc(f); } }'\n",
             "  $script -dims x,y,z 'grouped omp loop(x,y,z) { calc(f); }'\n",
             "  $script -dims x,y,z 'omp loop(x) { serpentine loop(y,z) { calc(f); } }'\n",
+            "  $script -dims x,y,z 'omp hilbert loop(x,y,z) { calc(f); }'\n",
             "  $script -dims x,y,z 'omp loop(x) { crew loop(y) { loop(z) { calc(f); } } }'\n",
+            "  $script -dims x,y,z 'omp loop(x,y,z) { calc(f); } | omp morton loop(x,y,z) { calc(f); }'\n",
             "Inner loops should contain calc statements that generate calls to calculation functions.\n",
             "A loop statement with more than one argument will generate a single collapsed loop.\n",
             "Optional loop modifiers:\n",
@@ -1081,14 +1339,31 @@ sub main() {
             "  prefetch(L1):    generate calls to SW L1 prefetch functions in addition to calc functions.\n",
             "  prefetch(L2):    generate calls to SW L2 prefetch functions in addition to calc functions.\n",
             "  grouped:         generate grouped path within a collapsed loop.\n",
+            "                   Serpentine and square_wave paths are applied within each group.\n",
             "  serpentine:      generate reverse path when enclosing loop dimension is odd.\n",
             "  square_wave:     generate 2D square-wave path for two innermost dimensions of a collapsed loop.\n",
-            #"  pipeline:        generate calls to pipeline versions of calculation functions (deprecated).\n",
+            "  morton:          generate Z-order path through all dimensions of a collapsed loop.\n",
+            "  hilbert:         generate Hilbert-curve path through all dimensions of a collapsed loop.\n",
+            "                   Paths for morton and hilbert are found at run-time and need not be\n",
+            "                   powers of 2 in size.\n",
+            "  bisect:          generate one iteration for each leaf of a recursive bisection of a\n",
+            "                   collapsed loop, always splitting the dimension that is largest relative\n",
+            "                   to leaf_size_D, until each leaf has at most leaf_size_D values.\n",
+            "  row:             generate one call to a row version of each calculation function\n",
+            "                   instead of an inner loop, e.g., calc_row_f_z() for loop(z).\n",
+            "                   The called function must iterate from start_D to stop_D-1 by step_D.\n",
+            "  pipeline:        like row, but call a software-pipelined version of each calculation\n",
+            "                   function, e.g., calc_pipe_f_z() for loop(z), which prepares the inputs\n",
+            "                   of the next iteration while calculating the current one.\n",
             "For each dim D in dims, loops are generated from begin_D to end_D-1 by step_D;\n",
             "  if grouping is used, groups are of size group_size_D;\n",
+            "  if bisection is used, leaves are of size leaf_size_D;\n",
             "  these vars must be defined *outside* of the generated code.\n",
             "Each iteration will cover values from start_D to stop_D-1;\n",
             "  these vars will be defined in the generated code.\n",
+            "Multiple loop-code strings separated by '|' are generated as variants;\n",
+            "  the one to run is selected by the value of the variantVar var, which must\n",
+            "  be defined *outside* of the generated code and be less than the number of variants.\n",
             "Options:\n";
         print_options_help(\@KNOBS);
         exit 1;
@@ -1098,7 +1373,16 @@ sub main() {
     warn "info: generating ".scalar(@dims)."-D loop code...\n";
 
     my $codeString = join(' ', @ARGV);
-    processCode($codeString);
+    my @variants;
+    for my $variantString (split /\|/, $codeString) {
+        die "error: empty loop-code variant in '$codeString'.\n"
+            if $variantString !~ /\S/;
+        my @code = processCode($variantString);
+        push @variants, \@code;
+    }
+    warn "info: generated ".scalar(@variants)." loop-code variants.\n"
+        if @variants > 1;
+    printCode($codeString, \@variants);
 }
 
 main();
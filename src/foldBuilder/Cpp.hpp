@@ -95,6 +95,9 @@ public:
 // Output generic C++ vector code for YASK.
 class CppVecPrintHelper : public VecPrintHelper {
 
+protected:
+    map<GridPoint, string> _writeMasks; // mask vars for masked writes.
+
 public:
     CppVecPrintHelper(VecInfoVisitor& vv,
                       bool allowUnalignedLoads,
@@ -106,6 +109,11 @@ public:
         VecPrintHelper(vv, allowUnalignedLoads, cv,
                        varPrefix, varType, linePrefix, lineSuffix) { }
 
+    // Write only the elements selected by 'maskName' when writing 'gp'.
+    virtual void setWriteMask(const GridPoint& gp, const string& maskName) {
+        _writeMasks[gp] = maskName;
+    }
+
 protected:
 
     // A simple constant.
@@ -123,6 +131,12 @@ protected:
         string str = "(*_context->" + pp.getName() + ")(" + pp.makeValStr() + ")";
         return str;
     }
+
+    // Multiply-adds in realv.hpp.
+    // These use FMA intrinsics when the target has them.
+    virtual string getFmaFnName(bool negate) const {
+        return negate ? "real_vec_fnmadd" : "real_vec_fmadd";
+    }
     
     // Print a comment about a point.
     // This is a utility function used for both reads and writes.
@@ -161,6 +175,7 @@ protected:
         os << _linePrefix << getVarType() << " " << mvName << " = ";
         printPointCall(os, gp, "readVecNorm", "", "__LINE__", true);
         os << _lineSuffix;
+        _opCounts.alignedReads++;
         return mvName;
     }
 
@@ -178,6 +193,7 @@ protected:
         os << _linePrefix << mvName << ".loadUnalignedFrom((const " << getVarType() << "*)";
         printPointCall(os, gp, "getElemPtr", "", "true", false);
         os << ")" << _lineSuffix;
+        _opCounts.unalignedReads++;
         return mvName;
     }
 
@@ -187,7 +203,12 @@ protected:
         printPointComment(os, gp, "Write aligned vector block to");
 
         // Write temp var to memory.
-        printPointCall(os, gp, "writeVecNorm", val, "__LINE__", true);
+        auto mi = _writeMasks.find(gp);
+        if (mi != _writeMasks.end())
+            printPointCall(os, gp, "writeVecNorm_masked", val + ", " + mi->second,
+                           "__LINE__", true);
+        else
+            printPointCall(os, gp, "writeVecNorm", val, "__LINE__", true);
         return val;
     }
     
@@ -203,6 +224,7 @@ protected:
 
         // Contruct it.
         printUnalignedVecCtor(os, gp, pvName);
+        _opCounts.unalignedCtors++;
         return pvName;
     }
 
@@ -242,10 +264,21 @@ protected:
     // Override this in derived classes for more efficient implementations.
     virtual void printUnalignedVecCtor(ostream& os, const GridPoint& gp, const string& pvName) {
         printUnalignedVecSimple(os, gp, pvName, _linePrefix);
+        _opCounts.elemCopies += _vv._vblk2elemLists[gp].size();
     }
 
 public:
 
+    // Print aligned memory read into existing var.
+    virtual void printAlignedVecLoad(ostream& os, const GridPoint& gp,
+                                     const string& varName) {
+        printPointComment(os, gp, "Read aligned vector block from");
+        os << _linePrefix << varName << " = ";
+        printPointCall(os, gp, "readVecNorm", "", "__LINE__", true);
+        os << _lineSuffix;
+        _opCounts.alignedReads++;
+    }
+
     // print init of normalized indices.
     virtual void printNorm(ostream& os, const IntTuple& dims) {
         const IntTuple& vlen = getFold();
@@ -275,12 +308,36 @@ public:
         else
             pfPts = &_vv._alignedVecs;
 
-        for (auto gp : *pfPts) {
-            printPointComment(os, gp, "Aligned");
+        // Group the points by grid.
+        map<string, GridPointSet> gridPts;
+        for (auto gp : *pfPts)
+            gridPts[gp.getName()].insert(gp);
+
+        for (auto& i : gridPts) {
+
+            // Move the index in the direction from the one computed
+            // w/PFDL1 or PFDL2 to the one computed w/this grid's
+            // distances. No change unless USE_AUTO_PFD is set.
+            if (dir.size()) {
+                auto& dname = *dir.getDirName();
+                string sfx = i.first + "_" + dname;
+                string ucDim = dname;
+                transform(ucDim.begin(), ucDim.end(), ucDim.begin(), ::toupper);
+                os << " {" << endl <<
+                    " const idx_t " << dname << "v = " << dname << "v_pf + "
+                    "PFD_SHIFT(level, pfd_l1_" << sfx << ", pfd_l2_" << sfx << ") * "
+                    "CLEN_" << ucDim << ";" << endl;
+            }
+
+            for (auto gp : i.second) {
+                printPointComment(os, gp, "Aligned");
             
-            // Prefetch memory.
-            printPointCall(os, gp, "prefetchVecNorm<level>", "", "__LINE__", true);
-            os << ";" << endl;
+                // Prefetch memory.
+                printPointCall(os, gp, "prefetchVecNorm<level>", "", "__LINE__", true);
+                os << ";" << endl;
+            }
+            if (dir.size())
+                os << " }" << endl;
         }
     }
 };
@@ -291,6 +348,10 @@ struct YASKCppSettings {
     int _haloSize = 0;
     int _stepAlloc = 2; 
     int _maxExprSize = 50, _minExprSize = 0;
+    bool _doFuse = false;
+    string _fuseTargets;        // e.g., "vel=vel,str=stress".
+    int _numVecRegs = 32;       // vector registers in target ISA.
+    bool _doRegOrder = false;   // reorder operands to need fewer registers.
 };
 
 // Print out a stencil in C++ form for YASK.
@@ -303,6 +364,20 @@ protected:
     IntTuple _yask_dims;        // spatial dims in yask.
     string _yask_step;          // step dim in yask.
 
+    // Vars holding the invariant exprs of the current eq-group.
+    map<Expr*, string> _invariantVars;
+    vector<Expr*> _invariantExprs; // one expr for each var.
+
+    // Most live vectors estimated in any eq-group printed so far.
+    int _maxLiveVecs = 0;
+
+    // Sets of grids to be interleaved in one allocation.
+    vector<Grids> _fusedGrids;
+    map<Grid*, size_t> _fusedGridIdx; // index into _fusedGrids.
+
+    // Set _fusedGrids based on settings.
+    virtual void findFusedGrids();
+
     // Print an expression as a one-line C++ comment.
     void addComment(ostream& os, EqGroup& eq) {
         
@@ -351,7 +426,30 @@ public:
     virtual void printCode(ostream& os);
     virtual void printShim(ostream& os, const string& fname,
                            bool use_template = false,
-                           const string& dim = "");
+                           const string& dim = "",
+                           bool use_stop = false);
+    virtual void printRowCluster(ostream& os, EqGroup& ceq,
+                                 VecInfoVisitor& vv, CounterVisitor& cv,
+                                 bool pipelined);
+    virtual void printInvariants(ostream& os, const string& egsName);
+
+    // Prepare 'ceq' for vector code: find its vectors in 'vv', reorder its
+    // exprs, count them in 'cv', and find the exprs that are the same in
+    // every cluster. Return the estimated most live vectors.
+    // This is used both to print the code and to estimate it beforehand,
+    // so the estimates are for the code that is printed.
+    static int prepVecCode(EqGroup& ceq, VecInfoVisitor& vv, CounterVisitor& cv,
+                           bool doRegOrder, bool allowUnalignedLoads,
+                           map<Expr*, string>& invariantVars,
+                           vector<Expr*>& invariantExprs);
+
+    // Get the most live vectors estimated in any eq-group by printCode().
+    virtual int getMaxLiveVecs() const {
+        return _maxLiveVecs;
+    }
+    virtual void printMaskedCluster(ostream& os, EqGroup& ceq, const string& egsName,
+                                    VecInfoVisitor& vv, CounterVisitor& cv);
+    virtual void printPrefetchDistances(ostream& os, VecInfoVisitor& vv);
 };
 
 #endif
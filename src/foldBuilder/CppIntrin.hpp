@@ -208,6 +208,8 @@ protected:
                             os << ")" << _lineSuffix;
                         }
 
+                        _opCounts.aligns++;
+
                         // Done w/the found elems.
                         for (auto fei = foundElems.begin(); fei != foundElems.end(); fei++) {
                             size_t fe = *fei;
@@ -303,6 +305,7 @@ protected:
                 if (needMask)
                     printMask(os, mask);
                 os << ")" << _lineSuffix;
+                _opCounts.perms++;
 
                 // Done w/the found elems.
                 for (auto fei = foundElems.begin(); fei != foundElems.end(); fei++) {
@@ -414,6 +417,7 @@ protected:
                     // Permute command.
                     os << _linePrefix << "real_vec_permute2(" << pvName << ", ctrl_" << nameStr << ", " <<
                         mv1Name << ", " << mv2Name << ")" << _lineSuffix;
+                    _opCounts.perm2s++;
 
                     // Done w/the found elems.
                     for (auto fei = foundElems.begin(); fei != foundElems.end(); fei++) {
@@ -473,6 +477,7 @@ public:
                 " out of " << nelems <<
                 " elements for unaligned vector with intrinsics." << endl;
             printUnalignedVecSimple(os, gp, pvName, _linePrefix, &doneElems);
+            _opCounts.elemCopies += nelems - ndone;
         }
     }
 };
@@ -558,6 +563,106 @@ public:
                              varPrefix, varType, linePrefix, lineSuffix) { }
 };
 
+// Specialization for GCC/Clang vector extensions.
+// Each unaligned vector is made from compile-time shuffles of two
+// vectors, which the compiler maps to the best instructions for the ISA.
+class CppGnuPrintHelper : public CppIntrinPrintHelper {
+protected:
+
+    // Try to use a shuffle of two aligned vectors to construct
+    // nelemsTarget elements. If some elements are already done,
+    // shuffle them w/one more aligned vector instead.
+    virtual void tryShuffle(ostream& os,
+                            const string& pvName,
+                            size_t nelemsTarget,
+                            const VecElemList& elems,
+                            set<size_t>& doneElems,
+                            const GridPointSet& alignedVecs) {
+        size_t nelems = elems.size();
+
+        // Try all possible combinations of 2 aligned vectors, including
+        // each vector paired w/itself.
+        for (auto mi = alignedVecs.begin(); mi != alignedVecs.end(); mi++) {
+            auto& mv1 = *mi;
+            for (auto mj = alignedVecs.begin();
+                 doneElems.size() < nelems && mj != alignedVecs.end(); mj++) {
+                auto& mv2 = *mj;
+
+                // When merging, the 1st input is the partial result.
+                bool merge = doneElems.size() > 0;
+                if (merge && mv1 != mv2)
+                    continue;
+
+                // Find index of each needed element in the concatenation
+                // of the two inputs. Elements not needed keep their
+                // current position in the 1st input.
+                ostringstream idxSS;
+                set<size_t> foundElems;
+                for (size_t i = 0; i < nelems; i++) {
+                    auto ve = elems[i];
+                    size_t idx = i;
+                    if (doneElems.count(i) == 0) {
+                        if (!merge && ve._vec == mv1) {
+                            idx = ve._offset;
+                            foundElems.insert(i);
+                        }
+                        else if (ve._vec == mv2) {
+                            idx = nelems + ve._offset;
+                            foundElems.insert(i);
+                        }
+                    }
+                    if (i > 0)
+                        idxSS << ", ";
+                    idxSS << idx;
+                }
+
+                // Have we found the target number of elements?
+                if (foundElems.size() == nelemsTarget) {
+
+                    // Look up existing input vars.
+                    // All should be ready before this function is called.
+                    assert(_readyPoints.count(mv1));
+                    assert(_readyPoints.count(mv2));
+                    string in1 = merge ? pvName : _readyPoints[mv1];
+                    string in2 = _readyPoints[mv2];
+
+                    os << " // Get " << foundElems.size() << " element(s) from " << in1;
+                    if (in2 != in1)
+                        os << " and " << in2;
+                    os << "." << endl;
+                    os << _linePrefix << "real_vec_shuffle2<" << idxSS.str() << ">(" <<
+                        pvName << ", " << in1 << ", " << in2 << ")" << _lineSuffix;
+                    _opCounts.perm2s++;
+
+                    // Done w/the found elems.
+                    doneElems.insert(foundElems.begin(), foundElems.end());
+                }
+            }
+        }
+    }
+
+    // Try all applicable strategies.
+    virtual void tryStrategies(ostream& os,
+                               const string& pvName,
+                               size_t nelemsTarget, 
+                               const VecElemList& elems, 
+                               set<size_t>& doneElems,
+                               const GridPointSet& alignedVecs) {
+        tryShuffle(os, pvName, nelemsTarget, elems, doneElems, alignedVecs);
+    }
+    
+public:
+    CppGnuPrintHelper(VecInfoVisitor& vv,
+                      bool allowUnalignedLoads,
+                      const CounterVisitor* cv,
+                      const string& varPrefix,
+                      const string& varType,
+                      const string& linePrefix,
+                      const string& lineSuffix) :
+        CppIntrinPrintHelper(vv, allowUnalignedLoads, cv,
+                             varPrefix, varType, linePrefix, lineSuffix) { }
+};
+
 // Print KNC intrinsic code.
 class YASKKncPrinter : public YASKCppPrinter {
 protected:
@@ -615,4 +720,23 @@ public:
                        dims, settings) { }
 };
 
+// Print code using GCC/Clang vector extensions.
+class YASKGnuPrinter : public YASKCppPrinter {
+protected:
+    virtual CppVecPrintHelper* newPrintHelper(VecInfoVisitor& vv,
+                                              CounterVisitor& cv) {
+        return new CppGnuPrintHelper(vv, _settings._allowUnalignedLoads, &cv,
+                                     "temp_vec", "real_vec_t", " ", ";\n");
+    }
+
+public:
+    YASKGnuPrinter(StencilBase& stencil,
+                   EqGroups& eqGroups,
+                   EqGroups& clusterEqGroups,
+                   Dimensions& dims,
+                   YASKCppSettings& settings) :
+        YASKCppPrinter(stencil, eqGroups, clusterEqGroups,
+                       dims, settings) { }
+};
+
 #endif
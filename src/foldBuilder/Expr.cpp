@@ -294,6 +294,9 @@ bool EqualsExpr::isSame(const Expr* other) const {
             _lhs->isSame(p->_lhs.get()) &&
             _rhs->isSame(p->_rhs.get());
     }
+size_t EqualsExpr::makeHash(ExprHashMap* memo) const {
+    return combineHash(UnaryNumExpr::makeHash(memo), _lhs->getHash(memo));
+}
 
 // IfExpr methods.
 bool IfExpr::isSame(const Expr* other) const {
@@ -302,6 +305,10 @@ bool IfExpr::isSame(const Expr* other) const {
         areExprsSame(_expr, p->_expr) &&
         areExprsSame(_rhs, p->_rhs);
 }
+size_t IfExpr::makeHash(ExprHashMap* memo) const {
+    size_t h = _expr ? _expr->getHash(memo) : 0;
+    return combineHash(h, _rhs ? _rhs->getHash(memo) : 0);
+}
 
 // Commutative methods.
 bool CommutativeExpr::isSame(const Expr* other) const {
@@ -338,6 +345,14 @@ bool CommutativeExpr::isSame(const Expr* other) const {
     return matches.size() == _ops.size();
 }
 
+// Operands are summed so that their order doesn't matter.
+size_t CommutativeExpr::makeHash(ExprHashMap* memo) const {
+    size_t h = 0;
+    for (auto& op : _ops)
+        h += op->getHash(memo);
+    return combineHash(hash<string>()(_opStr), h);
+}
+
 // GridPoint methods.
 const string& GridPoint::getName() const {
     return _grid->getName();
@@ -345,6 +360,9 @@ const string& GridPoint::getName() const {
 bool GridPoint::isParam() const {
     return _grid->isParam();
 }
+size_t GridPoint::makeHash(ExprHashMap* memo) const {
+    return hash<GridPoint>()(*this);
+}
 bool GridPoint::operator==(const GridPoint& rhs) const {
     return (_grid == rhs._grid) &&
         IntTuple::operator==(rhs);
@@ -647,6 +665,36 @@ bool EqDeps::_analyze(EqualsExprPtr a, SeenSet* seen)
     return false;
 }
 
+// Find two different eqs in the same grid with the same condition
+// that update the same point.
+bool Grids::findSamePtUpdates(IntTuple& pts,
+                              EqualsExprPtr& eq1,
+                              EqualsExprPtr& eq2,
+                              BoolExprPtr& cond) {
+    PointVisitor pt_vis(pts);
+    visitEqs(&pt_vis);
+    auto& outPts = pt_vis.getOutputPts();
+
+    for (auto* g : *this) {
+        auto& eqs = g->getEqs();
+        for (size_t i = 0; i < eqs.size(); i++) {
+            auto cond1 = g->getCond(eqs[i]);
+            for (size_t j = i + 1; j < eqs.size(); j++) {
+                auto cond2 = g->getCond(eqs[j]);
+                if (areExprsSame(cond1, cond2) &&
+                    pt_vis.do_sets_intersect(outPts.at(eqs[i].get()),
+                                             outPts.at(eqs[j].get()))) {
+                    eq1 = eqs[i];
+                    eq2 = eqs[j];
+                    cond = cond1;
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
 // Find dependencies based on all eqs in all grids.
 // If 'eq_deps' is set, save dependencies between eqs.
 // TODO: replace dependency algorithms with integration of a polyhedral
@@ -670,6 +718,18 @@ void Grids::findDeps(IntTuple& pts,
         }
     }
     cout << "  Scanned " << pt_vis.getNumEqs() << " equation(s).\n";
+
+    // If two different eqs have the same condition, they
+    // cannot update the exact same point.
+    EqualsExprPtr sameEq1, sameEq2;
+    BoolExprPtr sameCond;
+    if (findSamePtUpdates(pts, sameEq1, sameEq2, sameCond)) {
+        cerr << "Error: two equations with condition " <<
+            sameCond->makeQuotedStr() << " update the same point: " <<
+            sameEq1->makeQuotedStr() << " and " <<
+            sameEq2->makeQuotedStr() << endl;
+        exit(1);
+    }
     auto& outGrids = pt_vis.getOutputGrids();
     auto& inGrids = pt_vis.getInputGrids();
     auto& outPts = pt_vis.getOutputPts();
@@ -739,31 +799,18 @@ void Grids::findDeps(IntTuple& pts,
 
             // Find other eqs that depend on eq1.
             for (auto g2 : *this) {
-                bool same_grid = g1 == g2;
 
                 // All eqs in grid g2.
                 for (auto eq2 : g2->getEqs()) {
                     auto* eq2p = eq2.get();
                     //auto& og2 = outGrids.at(eq2p);
                     auto& ig2 = inGrids.at(eq2p);
-                    auto& op2 = outPts.at(eq2p);
                     auto& ip2 = inPts.at(eq2p);
                     auto cond2 = g2->getCond(eq2p);
 
                     bool same_eq = eq1 == eq2;
                     bool same_cond = areExprsSame(cond1, cond2);
 
-                    // If two different eqs have the same condition, they
-                    // cannot update the exact same point.
-                    if (!same_eq && same_cond && same_grid &&
-                        pt_vis.do_sets_intersect(op1, op2)) {
-                        cerr << "Error: two equations with condition " <<
-                            cond1->makeQuotedStr() << " update the same point: " <<
-                            eq1->makeQuotedStr() << " and " <<
-                            eq2->makeQuotedStr() << endl;
-                        exit(1);
-                    }
-
                     // eq2 dep on eq1 => some output of eq1 is an input to eq2.
                     // If the two eqs have the same condition, detect certain
                     // dependencies by looking for exact matches.
@@ -1010,6 +1057,15 @@ void EqGroup::replicateEqsInCluster(Dimensions& dims)
     assert(_eqs.size() == eqs.size() * dims._clusterMults.product());
 }
 
+// Replace each equation with a copy.
+void EqGroup::cloneEqs()
+{
+    EqList eqs(_eqs);
+    _eqs.clear();
+    for (auto eq : eqs)
+        _eqs.insert(eq->cloneEquals());
+}
+
 // Reorder groups based on dependencies.
 void EqGroups::sort()
 {
@@ -1227,6 +1283,148 @@ void EqGroups::findEqGroups(Grids& allGrids,
     sort();
 }
 
+// Get the base name of the eq-group(s) that findEqGroups() would put the
+// equations of grid 'gp' into: the key of the first target whose value
+// appears in the grid name, or the default.
+string EqGroups::getBaseName(const string& targets, const Grid* gp) const
+{
+    string baseName = _basename_default;
+    bool found = false;
+    ArgParser ap;
+    ap.parseKeyValuePairs
+        (targets, [&](const string& key, const string& value) {
+            if (!found && gp->getName().find(value) != string::npos) {
+                baseName = key;
+                found = true;
+            }
+        });
+    return baseName;
+}
+
+// A visitor to replace every read of one grid point with a copy of an
+// expression.
+class GridContractor : public ExprVisitor {
+protected:
+    const GridPoint& _pt;       // point to replace.
+    NumExprPtr _val;            // value to replace it with.
+    int _numChanges = 0;
+
+    // Replace 'ep' if it is '_pt'; otherwise, look for it in 'ep'.
+    virtual void replace(NumExprPtr& ep) {
+        auto* gp = dynamic_cast<GridPoint*>(ep.get());
+        if (gp && *gp == _pt) {
+            ep = _val->clone();
+            _numChanges++;
+        }
+        else
+            ep->accept(this);
+    }
+
+public:
+    GridContractor(const GridPoint& pt, NumExprPtr val) :
+        _pt(pt), _val(val) {}
+    virtual ~GridContractor() {}
+
+    int getNumChanges() const { return _numChanges; }
+
+    virtual void visit(UnaryNumExpr* ue) {
+        replace(ue->getRhs());
+    }
+    virtual void visit(BinaryNumExpr* be) {
+        replace(be->getLhs());
+        replace(be->getRhs());
+    }
+    virtual void visit(CommutativeExpr* ce) {
+        for (auto& ep : ce->getOps())
+            replace(ep);
+    }
+    virtual void visit(EqualsExpr* ee) {
+
+        // Only process RHS.
+        replace(ee->getRhs());
+    }
+};
+
+// Contract grids that are only intermediate values.
+// Returns the names of the grids contracted.
+vector<string> EqGroups::contractGrids(Grids& grids,
+                                       const string& targets,
+                                       IntTuple& pts)
+{
+    vector<string> contracted;
+
+    // Contracting one grid changes the eqs that read it, so
+    // rescan after each one.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        // Find dependencies and the exact points read by each eq.
+        EqDepMap eq_deps;
+        grids.findDeps(pts, _dims->_stepDim, &eq_deps);
+        PointVisitor pv;
+        for (auto* g : grids)
+            for (auto& eq : g->getEqs())
+                eq->accept(&pv);
+        auto& inGrids = pv.getInputGrids();
+        auto& inPts = pv.getInputPts();
+
+        for (auto* g1 : grids) {
+
+            // Need exactly one unconditional eq.
+            if (g1->getNumEqs() != 1)
+                continue;
+            auto eq1 = g1->getEqs().at(0);
+            if (g1->getCond(eq1))
+                continue;
+            auto& lhs1 = *eq1->getLhs();
+            string baseName = getBaseName(targets, g1);
+
+            // Check every eq that reads g1.
+            EqList readers;
+            bool ok = true;
+            for (auto* g2 : grids) {
+                for (auto& eq2 : g2->getEqs()) {
+                    auto* eq2p = eq2.get();
+                    if (inGrids.at(eq2p).count(g1) == 0)
+                        continue;
+
+                    // Reader must certainly depend on eq1, be in the same
+                    // eq-group, use the same dims, and read g1 only at
+                    // the point written by eq1.
+                    ok = eq_deps[certain_dep].is_dep_on(eq2, eq1) &&
+                        getBaseName(targets, g2) == baseName &&
+                        g2->areDimsSame(*g1);
+                    for (auto* ip : inPts.at(eq2p))
+                        if (ip->getGrid() == g1 && !(*ip == lhs1))
+                            ok = false;
+                    if (!ok)
+                        break;
+                    readers.insert(eq2);
+                }
+                if (!ok)
+                    break;
+            }
+            if (!ok || readers.size() == 0)
+                continue;
+
+            // Substitute the value of g1 into the readers and
+            // remove g1.
+            cout << " Contracting grid '" << g1->getName() <<
+                "' into " << readers.size() << " equation(s).\n";
+            GridContractor gc(lhs1, eq1->getRhs());
+            for (auto& eq2 : readers)
+                eq2->accept(&gc);
+            g1->clearTemp();
+            grids.erase(g1);
+            contracted.push_back(g1->getName());
+            changed = true;
+            break;
+        }
+    }
+    return contracted;
+}
+
 // Print stats from eqGroups.
 void EqGroups::printStats(ostream& os, const string& msg) {
     CounterVisitor cv;
@@ -58,6 +58,9 @@ class IntTupleExpr;
 typedef shared_ptr<IntTupleExpr> IntTupleExprPtr;
 typedef vector<NumExprPtr> NumExprPtrVec;
 
+// Memo of expression hashes.
+typedef unordered_map<const Expr*, size_t> ExprHashMap;
+
 // Forward-declare expression visitor.
 class ExprVisitor;
 
@@ -151,6 +154,27 @@ public:
     // constants.
     virtual bool isSame(const Expr* other) const =0;
 
+    // Get a hash of the structure of this expr. Exprs for which
+    // isSame() is true have the same hash. If 'memo' is given, the hashes
+    // of this node and all the nodes below it are looked up in and saved
+    // to it, so it must not be used after any of those nodes are changed.
+    size_t getHash(ExprHashMap* memo = 0) const {
+        if (memo) {
+            auto i = memo->find(this);
+            if (i != memo->end())
+                return i->second;
+        }
+        size_t h = makeHash(memo);
+        if (memo)
+            (*memo)[this] = h;
+        return h;
+    }
+
+    // Combine hash 'v' into hash 'h'.
+    static size_t combineHash(size_t h, size_t v) {
+        return h ^ (v + 0x9e3779b9 + (h << 6) + (h >> 2));
+    }
+
     // Return a simple string expr.
     virtual string makeStr() const;
     virtual string makeQuotedStr(string quote = "'") const {
@@ -176,6 +200,11 @@ public:
         oss << "\"" << this << "\"";
         return oss.str();
     }
+
+protected:
+
+    // Calculate the hash returned by getHash().
+    virtual size_t makeHash(ExprHashMap* memo) const =0;
 };
 
 // Convert pointer to the given ptr type or die w/an error.
@@ -271,6 +300,9 @@ public:
         auto p = dynamic_cast<const ConstExpr*>(other);
         return p && _f == p->_f;
     }
+    virtual size_t makeHash(ExprHashMap* memo) const {
+        return hash<double>()(_f);
+    }
    
     // Create a deep copy of this expression.
     virtual NumExprPtr clone() const { return make_shared<ConstExpr>(*this); }
@@ -315,6 +347,9 @@ public:
         auto p = dynamic_cast<const IndexExpr*>(other);
         return p && _dirName == p->_dirName && _type == p->_type;
     }
+    virtual size_t makeHash(ExprHashMap* memo) const {
+        return combineHash(hash<string>()(_dirName), size_t(_type));
+    }
    
     // Create a deep copy of this expression.
     virtual NumExprPtr clone() const { return make_shared<IndexExpr>(*this); }
@@ -344,6 +379,9 @@ public:
         auto p = dynamic_cast<const CodeExpr*>(other);
         return p && _code == p->_code;
     }
+    virtual size_t makeHash(ExprHashMap* memo) const {
+        return hash<string>()(_code);
+    }
 
     // Create a deep copy of this expression.
     virtual NumExprPtr clone() const { return make_shared<CodeExpr>(*this); }
@@ -377,6 +415,9 @@ public:
         return p && _opStr == p->_opStr &&
             _rhs->isSame(p->_rhs.get());
     }
+    virtual size_t makeHash(ExprHashMap* memo) const {
+        return Expr::combineHash(hash<string>()(_opStr), _rhs->getHash(memo));
+    }
 };
 
 // Various types of unary operators depending on input and output types.
@@ -446,6 +487,11 @@ public:
             _lhs->isSame(p->_lhs.get()) &&
             BaseT::_rhs->isSame(p->_rhs.get());
     }
+    virtual size_t makeHash(ExprHashMap* memo) const {
+        size_t h = Expr::combineHash(hash<string>()(BaseT::_opStr),
+                                     _lhs->getHash(memo));
+        return Expr::combineHash(h, BaseT::_rhs->getHash(memo));
+    }
 };
 
 // Various types of binary operators depending on input and output types.
@@ -583,6 +629,7 @@ public:
 
     // Check for equivalency.
     virtual bool isSame(const Expr* other) const;
+    virtual size_t makeHash(ExprHashMap* memo) const;
 };
 
 // Commutative operators.
@@ -652,6 +699,9 @@ public:
         // Only compare dimensions, not values.
         return p && areDimsSame(*p);
     }
+    virtual size_t makeHash(ExprHashMap* memo) const {
+        return hash<string>()(makeDimStr());
+    }
     
     // Create a deep copy of this expression.
     virtual NumExprPtr clone() const { return make_shared<IntTupleExpr>(*this); }
@@ -709,6 +759,7 @@ public:
         auto p = dynamic_cast<const GridPoint*>(other);
         return p && *this == *p;
     }
+    virtual size_t makeHash(ExprHashMap* memo) const;
     
     // Return a description based on this position.
     // TODO: check whether this overload is actually needed.
@@ -755,6 +806,7 @@ public:
 
     // Check for equivalency.
     virtual bool isSame(const Expr* other) const;
+    virtual size_t makeHash(ExprHashMap* memo) const;
 
     // Create a deep copy of this expression.
     virtual NumExprPtr clone() const { return make_shared<EqualsExpr>(*this); }
@@ -785,6 +837,7 @@ public:
 
     // Check for equivalency.
     virtual bool isSame(const Expr* other) const;
+    virtual size_t makeHash(ExprHashMap* memo) const;
 
     // Create a deep copy of this expression.
     virtual BoolExprPtr clone() const { return make_shared<IfExpr>(*this); }
@@ -826,7 +879,8 @@ public:
         if (_posn.count(val) > 0) {
             size_t op = _posn.at(val);
             vector<T>::erase(vector<T>::begin() + op);
-            for (auto pi : _posn) {
+            _posn.erase(val);
+            for (auto& pi : _posn) {
                 auto& p = pi.second;
                 if (p > op)
                     p--;
@@ -1127,6 +1181,14 @@ public:
                           const string& stepDim,
                           EqDepMap* eq_deps);
 
+    // Find two different eqs in the same grid with the same condition
+    // that update the same point when evaluated over 'pts'. If any are
+    // found, set 'eq1', 'eq2', and 'cond' and return true.
+    virtual bool findSamePtUpdates(IntTuple& pts,
+                                   EqualsExprPtr& eq1,
+                                   EqualsExprPtr& eq2,
+                                   BoolExprPtr& cond);
+
     // Check for illegal dependencies in all equations.
     // Exit with error if any found.
     virtual void checkDeps(IntTuple& pts,
@@ -1279,6 +1341,10 @@ public:
     // Replicate each equation at the non-zero offsets for
     // each vector in a cluster.
     virtual void replicateEqsInCluster(Dimensions& dims);
+
+    // Replace each equation with a copy, so that optimizing this
+    // eq-group doesn't change the one it was copied from.
+    virtual void cloneEqs();
         
     // Print stats for the equation(s) in this group.
     virtual void printStats(ostream& os, const string& msg);
@@ -1337,6 +1403,22 @@ public:
         return _outGrids;
     }
 
+    // Get the base name of the eq-group(s) that findEqGroups() would
+    // put the equations of grid 'gp' into given the 'targets' string.
+    virtual string getBaseName(const string& targets, const Grid* gp) const;
+
+    // Contract grids that are only intermediate values. A grid is
+    // contracted when it is updated by one unconditional equation and is
+    // read only at the point written by that equation, and only by
+    // equations that will be put in the same eq-group. Its value is then
+    // substituted into the reading equations, where it becomes a
+    // temporary, and the grid is removed from 'grids', so it is neither
+    // allocated nor written. Must be called before findEqGroups().
+    // Returns the names of the grids contracted.
+    virtual vector<string> contractGrids(Grids& grids,
+                                         const string& targets,
+                                         IntTuple& pts);
+
     // Visit all the equations in all eqGroups.
     // This will not visit the conditions.
     virtual void visitEqs(ExprVisitor* ev) {
@@ -1351,6 +1433,12 @@ public:
             eg.replicateEqsInCluster(dims);
     }
 
+    // Replace each equation with a copy.
+    virtual void cloneEqs() {
+        for (auto& eg : *this)
+            eg.cloneEqs();
+    }
+
     // Reorder groups based on dependencies.
     virtual void sort();
     
@@ -67,6 +67,302 @@ void CombineVisitor::visit(CommutativeExpr* ce) {
 }
 
 
+// Simplify 'ep' and its operands, changing 'ep' if needed.
+void SimplifyVisitor::simplify(NumExprPtr& ep) {
+
+    // Already done? Use the same replacement if there was one.
+    if (_seen.count(ep.get())) {
+        auto ri = _replaced.find(ep.get());
+        if (ri != _replaced.end())
+            ep = ri->second;
+        return;
+    }
+    auto* oep = ep.get();
+    _seen.insert(oep);
+
+    // Operands first (depth-first).
+    ep->accept(this);
+
+    // Then this node.
+    auto sep = simplest(ep);
+    if (sep != ep) {
+#if DEBUG_SIMPLIFY >= 1
+        cout << " - simplified '" << ep->makeStr() << "' to '" <<
+            sep->makeStr() << "'" << endl;
+#endif
+        ep = sep;
+        _replaced[oep] = sep;
+        _numChanges++;
+    }
+}
+
+// Return whether 'ep' is made only of constants and parameters.
+bool SimplifyVisitor::isInvariant(NumExprPtr ep) const {
+    return InvariantVisitor::isInvariant(ep.get());
+}
+
+// Return whether 'a / c' may be replaced w/'a * (1 / c)'.
+// W/o fast math, this is only done when 1 / c is exact, i.e., when 'c'
+// is a power of 2, so the results don't change.
+bool SimplifyVisitor::canUseRecip(double c) const {
+    if (c == 0.0)
+        return false;
+    int e;
+    return _fastMath || fabs(frexp(c, &e)) == 0.5;
+}
+
+// Return a simpler version of 'ep' or null if none found.
+NumExprPtr SimplifyVisitor::getSimpler(NumExprPtr ep) {
+    auto ce = dynamic_pointer_cast<ConstExpr>(ep);
+    if (ce)
+        return nullptr;
+
+    // -c => const; --a => a.
+    auto ne = dynamic_pointer_cast<NegExpr>(ep);
+    if (ne) {
+        auto& rhs = ne->getRhs();
+        if (dynamic_pointer_cast<ConstExpr>(rhs))
+            return constNum(-rhs->getNumVal());
+        auto rne = dynamic_pointer_cast<NegExpr>(rhs);
+        if (rne)
+            return rne->getRhs();
+        return nullptr;
+    }
+
+    // a - b.
+    auto se = dynamic_pointer_cast<SubExpr>(ep);
+    if (se) {
+        auto& lhs = se->getLhs();
+        auto& rhs = se->getRhs();
+        auto lce = dynamic_pointer_cast<ConstExpr>(lhs);
+        auto rce = dynamic_pointer_cast<ConstExpr>(rhs);
+        if (lce && rce)
+            return constNum(lce->getNumVal() - rce->getNumVal());
+        if (rce && rce->getNumVal() == 0.0)
+            return lhs;
+        if (lce && lce->getNumVal() == 0.0)
+            return make_shared<NegExpr>(rhs);
+        auto rne = dynamic_pointer_cast<NegExpr>(rhs);
+        if (rne) {
+            auto ae = make_shared<AddExpr>();
+            ae->getOps().push_back(lhs);
+            ae->getOps().push_back(rne->getRhs());
+            return ae;
+        }
+        return nullptr;
+    }
+
+    // a / b.
+    auto de = dynamic_pointer_cast<DivExpr>(ep);
+    if (de) {
+        auto& lhs = de->getLhs();
+        auto& rhs = de->getRhs();
+        auto lce = dynamic_pointer_cast<ConstExpr>(lhs);
+        auto rce = dynamic_pointer_cast<ConstExpr>(rhs);
+
+        // Don't fold or remove a division by zero.
+        if (rce && rce->getNumVal() == 0.0)
+            return nullptr;
+        if (lce && rce)
+            return constNum(lce->getNumVal() / rce->getNumVal());
+        if (lce && lce->getNumVal() == 0.0)
+            return constNum(0.0);
+
+        // a / c => a * (1/c).
+        if (rce && canUseRecip(rce->getNumVal())) {
+            auto me = make_shared<MultExpr>();
+            me->getOps().push_back(lhs);
+            me->getOps().push_back(constNum(1.0 / rce->getNumVal()));
+            return simplest(me);
+        }
+
+        // a / (c * b) => (a * (1/c)) / b.
+        auto rme = dynamic_pointer_cast<MultExpr>(rhs);
+        if (rme && rme->getOps().size() > 1) {
+            auto& rops = rme->getOps();
+            for (size_t i = 0; i < rops.size(); i++) {
+                auto rce2 = dynamic_pointer_cast<ConstExpr>(rops[i]);
+                if (rce2 && canUseRecip(rce2->getNumVal())) {
+                    auto me = make_shared<MultExpr>();
+                    me->getOps().push_back(lhs);
+                    me->getOps().push_back(constNum(1.0 / rce2->getNumVal()));
+                    auto rme2 = make_shared<MultExpr>();
+                    for (size_t j = 0; j < rops.size(); j++)
+                        if (j != i)
+                            rme2->getOps().push_back(rops[j]);
+                    return make_shared<DivExpr>(simplest(me), simplest(rme2));
+                }
+            }
+        }
+
+        // a / p => a * (1/p) if 'p' is invariant, so that
+        // the reciprocal can be calculated once.
+        if (_fastMath && !lce && isInvariant(rhs) && !isInvariant(lhs)) {
+            auto me = make_shared<MultExpr>();
+            me->getOps().push_back(lhs);
+            me->getOps().push_back(make_shared<DivExpr>(constNum(1.0), rhs));
+            return me;
+        }
+        return nullptr;
+    }
+
+    // Commutative exprs.
+    auto ae = dynamic_pointer_cast<AddExpr>(ep);
+    if (ae)
+        return getSimplerSum(ae);
+    auto me = dynamic_pointer_cast<MultExpr>(ep);
+    if (me)
+        return getSimplerProduct(me);
+    return nullptr;
+}
+
+// Return a simpler version of sum 'ce' or null if none found.
+NumExprPtr SimplifyVisitor::getSimplerSum(shared_ptr<CommutativeExpr> ce) {
+    auto& ops = ce->getOps();
+    if (ops.size() == 1)
+        return ops[0];
+
+    // Fold constants.
+    NumExprPtrVec newOps;
+    int nconsts = 0;
+    double sum = 0.0;
+    for (auto& ep : ops) {
+        auto oce = dynamic_pointer_cast<ConstExpr>(ep);
+        if (oce) {
+            sum += oce->getNumVal();
+            nconsts++;
+        }
+        else
+            newOps.push_back(ep);
+    }
+    if (nconsts > 1 || (nconsts == 1 && sum == 0.0)) {
+        if (sum != 0.0 || newOps.size() == 0)
+            newOps.insert(newOps.begin(), constNum(sum));
+        auto ae = make_shared<AddExpr>();
+        ae->getOps() = newOps;
+        return ae;
+    }
+
+    // Factor out the most common factor of products:
+    // c * a + c * b + d => c * (a + b) + d.
+    size_t bestCount = 1;
+    NumExprPtr bestFactor;
+    for (size_t i = 0; _fastMath && i < ops.size(); i++) {
+        auto mi = dynamic_pointer_cast<MultExpr>(ops[i]);
+        if (!mi)
+            continue;
+        for (auto& fi : mi->getOps()) {
+            size_t count = 1;
+            for (size_t j = i + 1; j < ops.size(); j++) {
+                auto mj = dynamic_pointer_cast<MultExpr>(ops[j]);
+                if (!mj)
+                    continue;
+                for (auto& fj : mj->getOps()) {
+                    if (fi->isSame(fj.get())) {
+                        count++;
+                        break;
+                    }
+                }
+            }
+            if (count > bestCount) {
+                bestCount = count;
+                bestFactor = fi;
+            }
+        }
+    }
+    if (bestFactor) {
+        auto rest = make_shared<AddExpr>();
+        NumExprPtrVec otherOps;
+        for (auto& ep : ops) {
+            auto mi = dynamic_pointer_cast<MultExpr>(ep);
+            bool found = false;
+            if (mi) {
+                auto ri = make_shared<MultExpr>();
+                for (auto& fi : mi->getOps()) {
+                    if (!found && fi->isSame(bestFactor.get()))
+                        found = true;
+                    else
+                        ri->getOps().push_back(fi);
+                }
+                if (found)
+                    rest->getOps().push_back(simplest(ri));
+            }
+            if (!found)
+                otherOps.push_back(ep);
+        }
+        auto fe = make_shared<MultExpr>();
+        fe->getOps().push_back(bestFactor);
+        fe->getOps().push_back(simplest(rest));
+        otherOps.push_back(simplest(fe));
+        auto ae = make_shared<AddExpr>();
+        ae->getOps() = otherOps;
+        return ae;
+    }
+    
+    // Use subtraction for negated terms:
+    // a + -b + c + -d => (a + c) - (b + d); -a + -b => -(a + b).
+    auto pos = make_shared<AddExpr>();
+    auto neg = make_shared<AddExpr>();
+    for (auto& ep : ops) {
+        auto ne = dynamic_pointer_cast<NegExpr>(ep);
+        if (ne)
+            neg->getOps().push_back(ne->getRhs());
+        else
+            pos->getOps().push_back(ep);
+    }
+    if (neg->getOps().size() && pos->getOps().size())
+        return make_shared<SubExpr>(simplest(pos), simplest(neg));
+    if (neg->getOps().size() > 1)
+        return make_shared<NegExpr>(neg);
+    return nullptr;
+}
+
+// Return a simpler version of product 'ce' or null if none found.
+NumExprPtr SimplifyVisitor::getSimplerProduct(shared_ptr<CommutativeExpr> ce) {
+    auto& ops = ce->getOps();
+    if (ops.size() == 1)
+        return ops[0];
+
+    // Fold constants and negations.
+    NumExprPtrVec newOps;
+    int nconsts = 0, nnegs = 0;
+    double prod = 1.0;
+    for (auto& ep : ops) {
+        auto oce = dynamic_pointer_cast<ConstExpr>(ep);
+        auto one = dynamic_pointer_cast<NegExpr>(ep);
+        if (oce) {
+            prod *= oce->getNumVal();
+            nconsts++;
+        }
+        else if (one) {
+            newOps.push_back(one->getRhs());
+            nnegs++;
+        }
+        else
+            newOps.push_back(ep);
+    }
+    if (nconsts && prod == 0.0)
+        return constNum(0.0);
+
+    // Only change if it removes ops.
+    if (nconsts > 1 || (nconsts == 1 && prod == 1.0) ||
+        (nnegs && nconsts) || nnegs > 1) {
+        bool isNeg = (nnegs % 2) == 1;
+        if (isNeg && nconsts) {
+            prod = -prod;
+            isNeg = false;
+        }
+        if (prod != 1.0 || newOps.size() == 0)
+            newOps.insert(newOps.begin(), constNum(prod));
+        auto me = make_shared<MultExpr>();
+        me->getOps() = newOps;
+        if (isNeg)
+            return make_shared<NegExpr>(simplest(me));
+        return me;
+    }
+    return nullptr;
+}
+
 // If 'ep' has already been seen, just return true.
 // Else if 'ep' has a match, change pointer to that match, return true.
 // Else, return false.
@@ -76,15 +372,18 @@ bool CseVisitor::findMatchTo(NumExprPtr& ep) {
 #endif
         
     // Already visited this node?
-    if (_seen.count(ep)) {
+    if (_seen.count(ep.get())) {
 #if DEBUG_CSE >= 2
         cout << " - already seen '" << ep->makeStr() << "'@" << ep << endl;
 #endif
         return true;
     }
         
-    // Loop through nodes already seen.
-    for (auto& oep : _seen) {
+    // Loop through nodes already seen with the same hash.
+    size_t h = ep->getHash(&_hashes);
+    auto range = _seenByHash.equal_range(h);
+    for (auto i = range.first; i != range.second; i++) {
+        auto& oep = i->second;
 #if DEBUG_CSE >= 3
         cout << " - comparing '" << ep->makeStr() << "'@" << ep <<
             " to '" << oep->makeStr() << "'@" << oep << endl;
@@ -108,6 +407,221 @@ bool CseVisitor::findMatchTo(NumExprPtr& ep) {
 #if DEBUG_CSE >= 2
     cout << " - no match to " << ep->makeStr() << endl;
 #endif
-    _seen.insert(ep);
+    _seen.insert(ep.get());
+    _seenByHash.emplace(h, ep);
     return false;
 }
+
+// Remember 'ep' if it is a commutative expr, and visit it if
+// it hasn't already been visited.
+void CommonSubsetVisitor::addExpr(NumExprPtr& ep) {
+    if (_seen.count(ep.get()))
+        return;
+    _seen.insert(ep.get());
+    auto ce = dynamic_pointer_cast<CommutativeExpr>(ep);
+    if (ce)
+        _exprs.push_back(ce);
+    ep->accept(this);
+}
+
+// Repeatedly find the largest subset of operands shared by two
+// commutative exprs with the same operator, make one expr from
+// that subset, and use it in every expr that contains the subset.
+void CommonSubsetVisitor::endGroup() {
+
+    // Operands compared by address.
+    typedef vector<NumExpr*> OpList;
+    auto getSortedOps = [](const CommutativeExpr& ce) {
+        OpList ops;
+        for (auto& ep : ce.getOps())
+            ops.push_back(ep.get());
+        sort(ops.begin(), ops.end());
+        return ops;
+    };
+
+    while (true) {
+        vector<OpList> sortedOps;
+        for (auto& ce : _exprs)
+            sortedOps.push_back(getSortedOps(*ce));
+
+        // Find largest common subset.
+        OpList best;
+        size_t besti = 0;
+        for (size_t i = 0; i < _exprs.size(); i++) {
+            if (sortedOps[i].size() <= best.size())
+                continue;
+            for (size_t j = i + 1; j < _exprs.size(); j++) {
+                if (_exprs[i]->getOpStr() != _exprs[j]->getOpStr())
+                    continue;
+                OpList common;
+                set_intersection(sortedOps[i].begin(), sortedOps[i].end(),
+                                 sortedOps[j].begin(), sortedOps[j].end(),
+                                 back_inserter(common));
+                if (common.size() >= 2 && common.size() > best.size()) {
+                    best = common;
+                    besti = i;
+                }
+            }
+        }
+        if (best.size() < 2)
+            break;
+        auto& opStr = _exprs[besti]->getOpStr();
+
+        // Use an existing expr with exactly the common operands if there
+        // is one. Otherwise, make a new one, keeping the original order.
+        shared_ptr<CommutativeExpr> sub;
+        for (size_t i = 0; i < _exprs.size() && !sub; i++)
+            if (_exprs[i]->getOpStr() == opStr && sortedOps[i] == best)
+                sub = _exprs[i];
+        bool isNew = !sub;
+        if (isNew) {
+            if (opStr == AddExpr::opStr())
+                sub = make_shared<AddExpr>();
+            else
+                sub = make_shared<MultExpr>();
+            OpList rem(best);
+            for (auto& ep : _exprs[besti]->getOps()) {
+                auto ri = find(rem.begin(), rem.end(), ep.get());
+                if (ri != rem.end()) {
+                    sub->getOps().push_back(ep);
+                    rem.erase(ri);
+                }
+            }
+        }
+#if DEBUG_CSE >= 1
+        cout << " - factoring '" << sub->makeStr() << "'" << endl;
+#endif
+
+        // Replace the common operands with 'sub' in all exprs containing them.
+        int numUses = 0;
+        for (size_t i = 0; i < _exprs.size(); i++) {
+            if (_exprs[i] == sub || _exprs[i]->getOpStr() != opStr ||
+                !includes(sortedOps[i].begin(), sortedOps[i].end(),
+                          best.begin(), best.end()))
+                continue;
+            auto& ops = _exprs[i]->getOps();
+            NumExprPtrVec newOps;
+            OpList rem(best);
+            for (auto& ep : ops) {
+                auto ri = find(rem.begin(), rem.end(), ep.get());
+                if (ri != rem.end())
+                    rem.erase(ri);
+                else
+                    newOps.push_back(ep);
+            }
+            newOps.push_back(sub);
+            ops.swap(newOps);
+            numUses++;
+        }
+
+        // Each use saves all but one op in the subset, and a new
+        // expr costs the same.
+        int subOps = int(best.size()) - 1;
+        _numOpsSaved += numUses * subOps - (isNew ? subOps : 0);
+        _numChanges++;
+        if (isNew)
+            _exprs.push_back(sub);
+    }
+    _exprs.clear();
+    _seen.clear();
+}
+
+// Return the sum of terms[b] through terms[e-1] as a balanced tree.
+static NumExprPtr sumOfTerms(const NumExprPtrVec& terms, size_t b, size_t e) {
+    if (e - b == 1)
+        return terms[b];
+    size_t m = (b + e) / 2;
+    auto ae = make_shared<AddExpr>();
+    ae->getOps().push_back(sumOfTerms(terms, b, m));
+    ae->getOps().push_back(sumOfTerms(terms, m, e));
+    return ae;
+}
+
+// Reshape a sum w/more than _maxChain products into a balanced sum of
+// chains, each containing a run of at most _maxChain products.
+void FmaVisitor::visit(CommutativeExpr* ce) {
+    if (_seen.count(ce))
+        return;
+    _seen.insert(ce);
+
+    // Reshape operands first.
+    auto& ops = ce->getOps();
+    for (auto& ep : ops)
+        ep->accept(this);
+    if (_maxChain < 1 || ce->getOpStr() != AddExpr::opStr())
+        return;
+
+    // Separate products from other addends.
+    NumExprPtrVec prods, others;
+    for (auto& ep : ops) {
+        auto me = dynamic_pointer_cast<MultExpr>(ep);
+        if (me && me->getOps().size() > 1)
+            prods.push_back(ep);
+        else
+            others.push_back(ep);
+    }
+    size_t nprods = prods.size();
+    if (nprods <= size_t(_maxChain))
+        return;
+
+    // Give each chain a contiguous run of products, keeping the
+    // original order, and start each one w/an other addend if available.
+    size_t nchains = (nprods + _maxChain - 1) / _maxChain;
+    vector<NumExprPtrVec> chains(nchains);
+    for (size_t i = 0; i < others.size(); i++)
+        chains[i % nchains].push_back(others[i]);
+    for (size_t i = 0; i < nprods; i++)
+        chains[i * nchains / nprods].push_back(prods[i]);
+    NumExprPtrVec terms;
+    for (auto& chain : chains) {
+        if (chain.size() == 1)
+            terms.push_back(chain[0]);
+        else {
+            auto ae = make_shared<AddExpr>();
+            ae->getOps() = chain;
+            terms.push_back(ae);
+        }
+    }
+
+    // Add the chains in a balanced tree.
+    size_t m = nchains / 2;
+    NumExprPtrVec newOps;
+    newOps.push_back(sumOfTerms(terms, 0, m));
+    newOps.push_back(sumOfTerms(terms, m, nchains));
+    ops.swap(newOps);
+    _numChanges++;
+}
+
+// Return whether 'ep' is made only of constants and parameters.
+// If 'needParam', also require at least one parameter.
+bool InvariantVisitor::isInvariant(Expr* ep, bool needParam) {
+
+    // Looks for anything that could vary between points.
+    class VariantFinder : public ExprVisitor {
+    public:
+        bool _found = false;
+        bool _foundParam = false;
+        virtual void visit(CodeExpr* ce) { _found = true; }
+        virtual void visit(IndexExpr* ie) { _found = true; }
+        virtual void visit(GridPoint* gp) {
+            if (gp->isParam())
+                _foundParam = true;
+            else
+                _found = true;
+        }
+    };
+    VariantFinder vf;
+    ep->accept(&vf);
+    return !vf._found && (vf._foundParam || !needParam);
+}
+
+// If 'ep' is invariant, save it and return true.
+bool InvariantVisitor::tryAdd(Expr* ep) {
+    if (!isInvariant(ep, true))
+        return false;
+    if (!_seen.count(ep)) {
+        _seen.insert(ep);
+        _invariants.push_back(ep);
+    }
+    return true;
+}
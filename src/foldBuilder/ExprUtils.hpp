@@ -53,11 +53,13 @@ public:
     virtual const string& getName() const {
         return _name;
     }
+
+    // Called after all the eqs in an eq-group have been visited.
+    virtual void endGroup() { }
 };
 
 // A visitor that combines commutative exprs.
 // Example: (a + b) + c => a + b + c;
-// TODO: simplify exprs like a + -b.
 class CombineVisitor : public OptVisitor {
 public:
     CombineVisitor()  :
@@ -72,12 +74,82 @@ public:
 };
 
 
+// A visitor that simplifies exprs algebraically.
+// Examples: 2 * a * 3 => 6 * a; a * 1 => a; a * 0 => 0;
+// a + -b => a - b; a / 4 => a * 0.25; a / (4 * b) => (a * 0.25) / b.
+// If 'fastMath' is set, rewrites that can change the results more are
+// also done: a / 3 => a * (1 / 3); a / p => a * (1 / p) when p is
+// invariant, i.e., made only of constants and parameters;
+// c * a + c * b => c * (a + b).
+class SimplifyVisitor : public OptVisitor {
+protected:
+    bool _fastMath;                    // allow rewrites that change results.
+    set<Expr*> _seen;                  // nodes already simplified.
+    map<Expr*, NumExprPtr> _replaced;   // nodes already replaced.
+
+    // Simplify 'ep' and its operands, changing 'ep' if needed.
+    virtual void simplify(NumExprPtr& ep);
+
+    // Return a simpler version of 'ep' or null if none found.
+    // Assumes operands of 'ep' are already simplified.
+    virtual NumExprPtr getSimpler(NumExprPtr ep);
+    virtual NumExprPtr getSimplerSum(shared_ptr<CommutativeExpr> ce);
+    virtual NumExprPtr getSimplerProduct(shared_ptr<CommutativeExpr> ce);
+
+    // Return 'ep' or a simpler version of it.
+    virtual NumExprPtr simplest(NumExprPtr ep) {
+        while (auto sp = getSimpler(ep))
+            ep = sp;
+        return ep;
+    }
+
+    // Return whether 'ep' is made only of constants and parameters.
+    virtual bool isInvariant(NumExprPtr ep) const;
+
+    // Return whether 'a / c' may be replaced w/'a * (1 / c)'.
+    virtual bool canUseRecip(double c) const;
+    
+public:
+    SimplifyVisitor(bool fastMath = false)  :
+        OptVisitor("algebraic simplification"),
+        _fastMath(fastMath) {}
+    virtual ~SimplifyVisitor() {}
+
+    virtual void visit(UnaryNumExpr* ue) {
+        simplify(ue->getRhs());
+    }
+    virtual void visit(BinaryNumExpr* be) {
+        simplify(be->getLhs());
+        simplify(be->getRhs());
+    }
+    virtual void visit(CommutativeExpr* ce) {
+        for (auto& ep : ce->getOps())
+            simplify(ep);
+    }
+    virtual void visit(IfExpr* ie) {
+
+        // Only process RHS of expression.
+        auto& ee = ie->getExpr();
+        visit(ee.get());        // compile-time binding ok for expr.
+    }
+    virtual void visit(EqualsExpr* ee) {
+
+        // Only process RHS.
+        simplify(ee->getRhs());
+    }
+};
+
 // A visitor that eliminates common numerical subexprs.
-// TODO: find matches to subsets of commutative operations;
-// example: a+b+c * b+d+a => c+(a+b) * d+(a+b) w/expr a+b combined.
+// Matches to subsets of commutative operations are found
+// by CommonSubsetVisitor.
 class CseVisitor : public OptVisitor {
 protected:
-    set<NumExprPtr> _seen;
+    unordered_set<Expr*> _seen;                          // nodes already visited.
+    unordered_multimap<size_t, NumExprPtr> _seenByHash; // same nodes by hash.
+
+    // Memo of node hashes. This stays valid for the whole pass because
+    // nodes are only redirected to structurally-identical ones.
+    ExprHashMap _hashes;
     
     // If 'ep' has already been seen, just return true.
     // Else if 'ep' has a match, change pointer to that match, return true.
@@ -130,6 +202,89 @@ public:
     }
 };
 
+// A visitor that eliminates common subsets of operands of commutative
+// exprs across all the eqs in an eq-group.
+// Example: a+b+c+d * a+b+c+e => (a+b+c)+d * (a+b+c)+e w/expr a+b+c combined.
+// Operands are matched by address, so CseVisitor should be applied first.
+class CommonSubsetVisitor : public OptVisitor {
+protected:
+    vector<shared_ptr<CommutativeExpr>> _exprs; // commutative exprs in group.
+    set<Expr*> _seen;                           // nodes already visited.
+    int _numOpsSaved;
+
+    // Remember 'ep' if it is a commutative expr, and visit it if
+    // it hasn't already been visited.
+    virtual void addExpr(NumExprPtr& ep);
+    
+public:
+    CommonSubsetVisitor() :
+        OptVisitor("commutative subset elimination"),
+        _numOpsSaved(0) {}
+    virtual ~CommonSubsetVisitor() {}
+
+    // Get number of FP ops removed from all eq-groups.
+    virtual int getNumOpsSaved() const {
+        return _numOpsSaved;
+    }
+
+    // Find the commutative exprs.
+    virtual void visit(UnaryNumExpr* ue) {
+        addExpr(ue->getRhs());
+    }
+    virtual void visit(BinaryNumExpr* be) {
+        addExpr(be->getLhs());
+        addExpr(be->getRhs());
+    }
+    virtual void visit(CommutativeExpr* ce) {
+        for (auto& ep : ce->getOps())
+            addExpr(ep);
+    }
+    virtual void visit(IfExpr* ie) {
+
+        // Only process RHS of expression.
+        auto& ee = ie->getExpr();
+        visit(ee.get());        // compile-time binding ok for expr.
+    }
+    virtual void visit(EqualsExpr* ee) {
+
+        // Only process RHS.
+        addExpr(ee->getRhs());
+    }
+
+    // Factor the common subsets in the exprs found.
+    virtual void endGroup();
+};
+
+// A visitor that splits sums with many products into balanced chains of
+// multiply-adds, so each chain can be printed as a sequence of FMAs
+// without one long serial dependency through the whole sum.
+// Example w/maxChain=2: a + b*c + d*e + f*g + h*i =>
+// (a + b*c + d*e) + (f*g + h*i).
+class FmaVisitor : public OptVisitor {
+protected:
+    int _maxChain;              // max products in one chain.
+    set<Expr*> _seen;           // nodes already visited.
+
+public:
+    FmaVisitor(int maxChain) :
+        OptVisitor("FMA-chain reshaping"),
+        _maxChain(maxChain) {}
+    virtual ~FmaVisitor() {}
+
+    virtual void visit(CommutativeExpr* ce);
+    virtual void visit(IfExpr* ie) {
+
+        // Only process RHS of expression.
+        auto& ee = ie->getExpr();
+        visit(ee.get());        // compile-time binding ok for expr.
+    }
+    virtual void visit(EqualsExpr* ee) {
+
+        // Only process RHS.
+        ee->getRhs()->accept(this);
+    }
+};
+
 // A visitor that can keep track of what's been visted.
 class TrackingVisitor : public ExprVisitor {
 protected:
@@ -185,6 +340,7 @@ public:
 class CounterVisitor : public TrackingVisitor {
 protected:
     int _numOps, _numNodes, _numReads, _numWrites, _numParamReads;
+    map<string, int> _opCounts; // number of ops by operator.
 
 public:
     CounterVisitor() :
@@ -198,6 +354,8 @@ public:
         _numReads += rhs._numReads;
         _numWrites += rhs._numWrites;
         _numParamReads += rhs._numParamReads;
+        for (auto i : rhs._opCounts)
+            _opCounts[i.first] += i.second;
         return *this;
     }
     
@@ -207,7 +365,13 @@ public:
             "  " << getNumReads() << " grid read(s)." << endl <<
             "  " << getNumWrites() << " grid write(s)." << endl <<
             "  " << getNumParamReads() << " parameter read(s)." << endl <<
-            "  " << getNumOps() << " FP math operation(s)." << endl;
+            "  " << getNumOps() << " FP math operation(s)";
+        string sep = ": ";
+        for (auto i : _opCounts) {
+            os << sep << i.second << " '" << i.first << "'";
+            sep = ", ";
+        }
+        os << "." << endl;
     }
     
     int getNumNodes() const { return _numNodes; }
@@ -215,6 +379,7 @@ public:
     int getNumWrites() const { return _numWrites; }
     int getNumParamReads() const { return _numParamReads; }
     int getNumOps() const { return _numOps; }
+    const map<string, int>& getOpCounts() const { return _opCounts; }
 
     // Leaf nodes.
     virtual void visit(ConstExpr* ce) {
@@ -239,6 +404,7 @@ public:
         if (alreadyVisited(ue)) return;
         _numNodes++;
         _numOps++;
+        _opCounts["unary " + ue->getOpStr()]++;
         ue->getRhs()->accept(this);
     }
     virtual void visit(UnaryBoolExpr* ue) {
@@ -257,6 +423,7 @@ public:
         if (alreadyVisited(be)) return;
         _numNodes++;
         _numOps++;
+        _opCounts[be->getOpStr()]++;
         be->getLhs()->accept(this);
         be->getRhs()->accept(this);
     }
@@ -280,6 +447,8 @@ public:
         auto& ops = ce->getOps();
         //cout << "counting ce " << ce << ":"; for (auto& ep : ops) cout << ' ' << ep; cout << endl;
         _numOps += ops.size() - 1;
+        if (ops.size() > 1)
+            _opCounts[ce->getOpStr()] += ops.size() - 1;
         for (auto& ep : ops) {
             ep->accept(this);
         }
@@ -301,4 +470,50 @@ public:
     }
 };
 
+// A visitor that finds the largest sub-exprs that are made only of
+// constants and parameters and that read at least one parameter.
+// These have the same value at every point, so they can be
+// evaluated once instead of in every cluster.
+class InvariantVisitor : public ExprVisitor {
+protected:
+    set<Expr*> _seen;           // nodes already checked.
+    vector<Expr*> _invariants;  // invariant exprs in the order found.
+
+    // If 'ep' is invariant, save it and return true.
+    virtual bool tryAdd(Expr* ep);
+    
+public:
+    virtual ~InvariantVisitor() {}
+
+    // Return whether 'ep' is made only of constants and parameters.
+    // If 'needParam', also require at least one parameter.
+    static bool isInvariant(Expr* ep, bool needParam = false);
+
+    // Get invariant exprs found.
+    virtual const vector<Expr*>& getInvariants() const {
+        return _invariants;
+    }
+
+    virtual void visit(GridPoint* gp) {
+        tryAdd(gp);
+    }
+    virtual void visit(UnaryNumExpr* ue) {
+        if (!tryAdd(ue))
+            ExprVisitor::visit(ue);
+    }
+    virtual void visit(BinaryNumExpr* be) {
+        if (!tryAdd(be))
+            ExprVisitor::visit(be);
+    }
+    virtual void visit(CommutativeExpr* ce) {
+        if (!tryAdd(ce))
+            ExprVisitor::visit(ce);
+    }
+
+    // Conditions are not evaluated in clusters.
+    virtual void visit(IfExpr* ie) {
+        ie->getExpr()->accept(this);
+    }
+};
+
 #endif
@@ -27,14 +27,130 @@ IN THE SOFTWARE.
 
 #include "Print.hpp"
 #include "CppIntrin.hpp"
+#include "Parse.hpp"
 
 ////////////// Print visitors ///////////////
 
+// Return 'ep' as a MultExpr if it is a product of 2+ operands.
+// Products of parameters are not returned because they may be
+// evaluated separately, and the scalar and vector code must round the
+// same way.
+static shared_ptr<MultExpr> getProduct(const NumExprPtr& ep) {
+    auto me = dynamic_pointer_cast<MultExpr>(ep);
+    if (me && me->getOps().size() > 1 &&
+        !InvariantVisitor::isInvariant(me.get(), true))
+        return me;
+    return nullptr;
+}
+
 /////// Top-down
 
+// Print 'ep' and return the result w/o changing _exprStr.
+string PrintVisitorTopDown::getExprStrOf(Expr* ep) {
+    string saved = getExprStrAndClear();
+    ep->accept(this);
+    string res = getExprStrAndClear();
+    _exprStr = saved;
+    return res;
+}
+
+// Print the var holding 'ep' if there is one.
+bool PrintVisitorTopDown::tryKnownPrint(Expr* ep) {
+    string varName = _ph.getKnownExpr(ep);
+    if (!varName.length())
+        return false;
+    _exprStr += varName;
+    return true;
+}
+
+// Print a sum containing products as a nest of FMAs.
+// Example: 'a + b*c + d*e' => 'fma(d, e, fma(b, c, a))'.
+bool PrintVisitorTopDown::tryFmaPrint(CommutativeExpr* ce) {
+    string fn = _ph.getFmaFnName(false);
+    if (!fn.length() || ce->getOpStr() != AddExpr::opStr())
+        return false;
+
+    // Separate products from other addends.
+    vector<shared_ptr<MultExpr>> prods;
+    NumExprPtrVec others;
+    for (auto& ep : ce->getOps()) {
+        auto me = getProduct(ep);
+        if (me)
+            prods.push_back(me);
+        else
+            others.push_back(ep);
+    }
+    if (prods.empty())
+        return false;
+
+    // Start w/the sum of the other addends or w/the first product.
+    string acc;
+    if (others.empty()) {
+        acc = getExprStrOf(prods[0].get());
+        prods.erase(prods.begin());
+    }
+    else {
+        for (size_t i = 0; i < others.size(); i++) {
+            if (i > 0)
+                acc += " " + ce->getOpStr() + " ";
+            acc += getExprStrOf(others[i].get());
+        }
+        if (others.size() > 1)
+            acc = "(" + acc + ")";
+    }
+
+    // Accumulate the remaining products.
+    for (auto& me : prods) {
+        auto& fops = me->getOps();
+        string a;
+        for (size_t i = 0; i + 1 < fops.size(); i++) {
+            if (i > 0)
+                a += " " + me->getOpStr() + " ";
+            a += getExprStrOf(fops[i].get());
+        }
+        if (fops.size() > 2)
+            a = "(" + a + ")";
+        string b = getExprStrOf(fops.back().get());
+        acc = fn + "(" + a + ", " + b + ", " + acc + ")";
+        _numCommon += _ph.getNumCommon(me.get());
+    }
+    _exprStr += acc;
+    _numCommon += _ph.getNumCommon(ce);
+    return true;
+}
+
+// Print a difference w/a product as a negated FMA.
+// Example: 'a - b*c' => 'fnma(b, c, a)'.
+bool PrintVisitorTopDown::tryFmaPrint(BinaryNumExpr* be) {
+    string fn = _ph.getFmaFnName(true);
+    if (!fn.length() || be->getOpStr() != SubExpr::opStr())
+        return false;
+    auto me = getProduct(be->getRhs());
+    if (!me)
+        return false;
+
+    auto& fops = me->getOps();
+    string a;
+    for (size_t i = 0; i + 1 < fops.size(); i++) {
+        if (i > 0)
+            a += " " + me->getOpStr() + " ";
+        a += getExprStrOf(fops[i].get());
+    }
+    if (fops.size() > 2)
+        a = "(" + a + ")";
+    string b = getExprStrOf(fops.back().get());
+    string c = getExprStrOf(be->getLhs().get());
+    _exprStr += fn + "(" + a + ", " + b + ", " + c + ")";
+    _numCommon += _ph.getNumCommon(me.get());
+    _numCommon += _ph.getNumCommon(be);
+    return true;
+}
+
 // A grid or parameter read.
 // Uses the PrintHelper to format.
 void PrintVisitorTopDown::visit(GridPoint* gp) {
+    if (tryKnownPrint(gp))
+        return;
     if (gp->isParam())
         _exprStr += _ph.readFromParam(_os, *gp);
     else
@@ -76,6 +192,8 @@ void PrintVisitorTopDown::visit(CodeExpr* ce) {
 // Generic unary operators.
 // Assumes unary operators have highest precedence, so no ()'s added.
 void PrintVisitorTopDown::visit(UnaryNumExpr* ue) {
+    if (tryKnownPrint(ue))
+        return;
     _exprStr += ue->getOpStr();
     ue->getRhs()->accept(this);
     _numCommon += _ph.getNumCommon(ue);
@@ -93,6 +211,10 @@ void PrintVisitorTopDown::visit(UnaryNum2BoolExpr* ue) {
 
 // Generic binary operators.
 void PrintVisitorTopDown::visit(BinaryNumExpr* be) {
+    if (tryKnownPrint(be))
+        return;
+    if (tryFmaPrint(be))
+        return;
     _exprStr += "(";
     be->getLhs()->accept(this); // adds LHS to _exprStr.
     _exprStr += " " + be->getOpStr() + " ";
@@ -119,6 +241,10 @@ void PrintVisitorTopDown::visit(BinaryNum2BoolExpr* be) {
 
 // A commutative operator.
 void PrintVisitorTopDown::visit(CommutativeExpr* ce) {
+    if (tryKnownPrint(ce))
+        return;
+    if (tryFmaPrint(ce))
+        return;
     _exprStr += "(";
     auto& ops = ce->getOps();
     int opNum = 0;
@@ -208,6 +334,12 @@ bool PrintVisitorBottomUp::trySimplePrint(Expr* ex, bool force) {
         _exprStr = p->second;
         exprDone = true;
     }
+
+    // Determine whether a var outside this code holds its result.
+    else if (_ph.getKnownExpr(ex).length()) {
+        _exprStr = _ph.getKnownExpr(ex);
+        exprDone = true;
+    }
         
     // Consider top down if forcing or expr <= maxExprSize.
     else if (force || !tooBig) {
@@ -247,6 +379,112 @@ bool PrintVisitorBottomUp::trySimplePrint(Expr* ex, bool force) {
     return exprDone;
 }
 
+// Print a sum containing products as a sequence of FMAs.
+// Example: 'a + b*c + d*e' might output the following:
+// temp1 = fma(b, c, a);
+// temp2 = fma(d, e, temp1);
+// with 'temp2' left in _exprStr.
+bool PrintVisitorBottomUp::tryFmaPrint(CommutativeExpr* ce) {
+    string fn = _ph.getFmaFnName(false);
+    if (!fn.length() || ce->getOpStr() != AddExpr::opStr())
+        return false;
+
+    // Separate products from other addends.
+    // A product already in a temp var is still fused so that the
+    // rounding doesn't depend on which nodes are shared.
+    vector<shared_ptr<MultExpr>> prods;
+    NumExprPtrVec others;
+    for (auto& ep : ce->getOps()) {
+        auto me = getProduct(ep);
+        if (me)
+            prods.push_back(me);
+        else
+            others.push_back(ep);
+    }
+    if (prods.empty())
+        return false;
+
+    // Start w/the sum of the other addends or w/the first product.
+    string acc, exStr;
+    if (others.empty()) {
+        prods[0]->accept(this); // sets _exprStr.
+        acc = getExprStrAndClear();
+        exStr = prods[0]->makeStr();
+        prods.erase(prods.begin());
+    }
+    else {
+        for (size_t i = 0; i < others.size(); i++) {
+            others[i]->accept(this); // sets _exprStr.
+            string opStr = getExprStrAndClear();
+            if (i == 0) {
+                acc = opStr;
+                exStr = others[i]->makeStr();
+            }
+            else {
+                exStr += ' ' + ce->getOpStr() + ' ' + others[i]->makeStr();
+                makeNextTempVar(NULL, exStr) << acc << ' ' << ce->getOpStr() << ' ' <<
+                    opStr << _ph.getLineSuffix();
+                acc = getExprStr();
+            }
+        }
+    }
+
+    // Accumulate the remaining products.
+    for (size_t j = 0; j < prods.size(); j++) {
+        auto& me = prods[j];
+        auto& fops = me->getOps();
+        string a;
+        for (size_t i = 0; i + 1 < fops.size(); i++) {
+            fops[i]->accept(this); // sets _exprStr.
+            if (i > 0)
+                a += " " + me->getOpStr() + " ";
+            a += getExprStrAndClear();
+        }
+        if (fops.size() > 2)
+            a = "(" + a + ")";
+        fops.back()->accept(this); // sets _exprStr.
+        string b = getExprStrAndClear();
+
+        // Use whole expression only for the last step.
+        Expr* ex = (j + 1 == prods.size()) ? ce : NULL;
+        exStr += ' ' + ce->getOpStr() + ' ' + me->makeStr();
+        makeNextTempVar(ex, exStr) << fn << "(" << a << ", " << b << ", " <<
+            acc << ")" << _ph.getLineSuffix();
+        acc = getExprStr();
+    }
+
+    // note: _exprStr contains result of last FMA.
+    return true;
+}
+
+// Print a difference w/a product as a negated FMA.
+bool PrintVisitorBottomUp::tryFmaPrint(BinaryNumExpr* be) {
+    string fn = _ph.getFmaFnName(true);
+    if (!fn.length() || be->getOpStr() != SubExpr::opStr())
+        return false;
+    auto me = getProduct(be->getRhs());
+    if (!me)
+        return false;
+
+    be->getLhs()->accept(this); // sets _exprStr.
+    string c = getExprStrAndClear();
+    auto& fops = me->getOps();
+    string a;
+    for (size_t i = 0; i + 1 < fops.size(); i++) {
+        fops[i]->accept(this); // sets _exprStr.
+        if (i > 0)
+            a += " " + me->getOpStr() + " ";
+        a += getExprStrAndClear();
+    }
+    if (fops.size() > 2)
+        a = "(" + a + ")";
+    fops.back()->accept(this); // sets _exprStr.
+    string b = getExprStrAndClear();
+    makeNextTempVar(be) << fn << "(" << a << ", " << b << ", " << c << ")" <<
+        _ph.getLineSuffix();
+    return true;
+}
+
 // A grid or param point: just set expr.
 void PrintVisitorBottomUp::visit(GridPoint* gp) {
     trySimplePrint(gp, true);
@@ -295,6 +533,10 @@ void PrintVisitorBottomUp::visit(BinaryNumExpr* be) {
     if (trySimplePrint(be, false))
         return;
 
+    // Try FMA for a difference w/a product.
+    if (tryFmaPrint(be))
+        return;
+
     // Expand both sides, then apply operator to result.
     // Example: '(a * b) / (c * d)' might output the following:
     // temp1 = a * b;
@@ -331,6 +573,10 @@ void PrintVisitorBottomUp::visit(CommutativeExpr* ce) {
     if (trySimplePrint(ce, false))
         return;
 
+    // Try FMAs for a sum w/products.
+    if (tryFmaPrint(ce))
+        return;
+
     // Make separate assignment for N-1 operands.
     // Example: 'a + b + c + d' might output the following:
     // temp1 = a + b;
@@ -621,14 +867,188 @@ void POVRayPrinter::print(ostream& os) {
     }
 }
 
+///// Analysis report.
+
+// Collects the points of each grid read or written.
+class GridPointCollector : public ExprVisitor {
+public:
+    map<Grid*, vector<GridPoint*>> _pts;
+
+    virtual void visit(GridPoint* gp) {
+        if (!gp->isParam())
+            _pts[gp->getGrid()].push_back(gp);
+    }
+};
+
+// Number of points in the union of blocks of size _blockSize starting at
+// each of the 'offsets'. Splits the space into cells at every block
+// boundary and adds the size of each cell covered by any block.
+long long ReportPrinter::countBlockUnion(const vector<IntTuple>& offsets) const {
+    auto& bdims = _blockSize.getDims();
+    vector<vector<int>> bounds(bdims.size());
+    for (size_t d = 0; d < bdims.size(); d++) {
+        for (auto& ofs : offsets) {
+            int o = ofs.getVal(bdims[d]);
+            bounds[d].push_back(o);
+            bounds[d].push_back(o + _blockSize.getVal(bdims[d]));
+        }
+        sort(bounds[d].begin(), bounds[d].end());
+        bounds[d].erase(unique(bounds[d].begin(), bounds[d].end()), bounds[d].end());
+    }
+
+    // Recurse through dims, keeping only the blocks that cover the cell.
+    function<long long(size_t, const vector<const IntTuple*>&)> count =
+        [&](size_t d, const vector<const IntTuple*>& blocks) -> long long {
+        if (d == bdims.size())
+            return blocks.size() ? 1 : 0;
+        long long n = 0;
+        int bsize = _blockSize.getVal(bdims[d]);
+        for (size_t i = 0; i + 1 < bounds[d].size(); i++) {
+            int lo = bounds[d][i];
+            vector<const IntTuple*> cblocks;
+            for (auto* ofs : blocks) {
+                int o = ofs->getVal(bdims[d]);
+                if (o <= lo && lo < o + bsize)
+                    cblocks.push_back(ofs);
+            }
+            if (cblocks.size())
+                n += (long long)(bounds[d][i+1] - lo) * count(d + 1, cblocks);
+        }
+        return n;
+    };
+    vector<const IntTuple*> blocks;
+    for (auto& ofs : offsets)
+        blocks.push_back(&ofs);
+    return count(0, blocks);
+}
+
+// Print the report.
+// FP ops and memory footprint are from the scalar eq-groups;
+// vector counts are from the cluster eq-groups.
+void ReportPrinter::print(ostream& os) {
+    int numClusterPts = _dims._clusterPts.product();
+    long long blockPts = _blockSize.product();
+
+    os << "{\n"
+        "  \"stencil\": \"" << _stencil.getName() << "\",\n"
+        "  \"fold\": {" << _dims._fold.makeDimValStr(", ", "\": ", "\"") << "},\n"
+        "  \"cluster\": {" << _dims._clusterMults.makeDimValStr(", ", "\": ", "\"") << "},\n"
+        "  \"real_bytes\": " << _realBytes << ",\n"
+        "  \"block\": {" << _blockSize.makeDimValStr(", ", "\": ", "\"") << "},\n"
+        "  \"eq_groups\": [";
+
+    double totalOps = 0.0, totalBytes = 0.0;
+    for (size_t ei = 0; ei < _eqGroups.size(); ei++) {
+        auto& eq = _eqGroups.at(ei);
+        auto& ceq = _clusterEqGroups.at(ei);
+
+        // FP ops and accesses per point.
+        CounterVisitor cv;
+        eq.visitEqs(&cv);
+
+        // Unique elements of each grid for a block of points.  Points in
+        // different step and misc indices are in different memory, so
+        // they are grouped by those indices.
+        GridPointCollector gpc;
+        eq.visitEqs(&gpc);
+        long long numElems = 0;
+        for (auto& i : gpc._pts) {
+            map<IntTuple, vector<IntTuple>> groups;
+            for (auto* gp : i.second) {
+                IntTuple key, ofs;
+                for (auto* dim : gp->getDims()) {
+                    if (_blockSize.lookup(dim))
+                        ofs.addDimBack(dim, gp->getVal(dim));
+                    else
+                        key.addDimBack(dim, gp->getVal(dim));
+                }
+
+                // Dims not used by this grid.
+                for (auto* dim : _blockSize.getDims())
+                    if (!ofs.lookup(dim))
+                        ofs.addDimBack(dim, 0);
+                groups[key].push_back(ofs);
+            }
+            for (auto& g : groups)
+                numElems += countBlockUnion(g.second);
+        }
+        double elemsPerPt = double(numElems) / blockPts;
+        double bytesPerPt = elemsPerPt * _realBytes;
+        totalOps += cv.getNumOps();
+        totalBytes += bytesPerPt;
+
+        // Vector blocks per cluster.
+        VecInfoVisitor vv(_dims);
+        ceq.visitEqs(&vv);
+        size_t numConstructed = 0;
+        for (auto& i : vv._vblk2elemLists)
+            if (!vv._alignedVecs.count(i.first))
+                numConstructed++;
+
+        os << (ei ? "," : "") << "\n"
+            "    {\n"
+            "      \"name\": \"" << eq.getName() << "\",\n"
+            "      \"num_eqs\": " << eq.getNumEqs() << ",\n"
+            "      \"flops_per_point\": " << cv.getNumOps() << ",\n"
+            "      \"reads_per_point\": " << cv.getNumReads() << ",\n"
+            "      \"writes_per_point\": " << cv.getNumWrites() << ",\n"
+            "      \"unique_elements_per_point\": " << elemsPerPt << ",\n"
+            "      \"unique_bytes_per_point\": " << bytesPerPt << ",\n"
+            "      \"arithmetic_intensity\": " <<
+            (bytesPerPt > 0.0 ? cv.getNumOps() / bytesPerPt : 0.0) << ",\n"
+            "      \"vector_blocks_per_cluster\": " << vv.getNumPoints() << ",\n"
+            "      \"aligned_vectors_per_cluster\": " << vv.getNumAlignedVecs() << ",\n"
+            "      \"constructed_vectors_per_cluster\": " << numConstructed << ",\n"
+            "      \"aligned_vectors_per_point\": " <<
+            (double(vv.getNumAlignedVecs()) / numClusterPts) << ",\n"
+            "      \"halos\": {";
+
+        // Halos of all grids accessed.
+        Grids grids;
+        for (auto* gp : eq.getInputGrids())
+            grids.insert(gp);
+        for (auto* gp : eq.getOutputGrids())
+            grids.insert(gp);
+        string gsep;
+        for (auto* gp : grids) {
+            if (gp->isParam())
+                continue;
+            os << gsep << "\n        \"" << gp->getName() << "\": {";
+            string dsep;
+            for (auto* dim : gp->getDims()) {
+                if (*dim == _dims._stepDim)
+                    continue;
+                os << dsep << "\"" << *dim << "\": " << gp->getHaloSize(*dim);
+                dsep = ", ";
+            }
+            os << "}";
+            gsep = ",";
+        }
+        os << (gsep.size() ? "\n      " : "") << "}\n"
+            "    }";
+    }
+    os << "\n  ],\n"
+        "  \"flops_per_point\": " << totalOps << ",\n"
+        "  \"unique_bytes_per_point\": " << totalBytes << ",\n"
+        "  \"arithmetic_intensity\": " <<
+        (totalBytes > 0.0 ? totalOps / totalBytes : 0.0) << "\n"
+        "}" << endl;
+}
+
 ///// YASK.
 
 // Print a shim function to map hard-coded YASK vars to actual dims.
+// If 'use_stop', the stop var in 'dim' is also passed.
 void YASKCppPrinter::printShim(ostream& os, const string& fname,
                                bool use_template,
-                               const string& dim) {
+                               const string& dim,
+                               bool use_stop) {
     
-    os << "\n // Simple shim function to map sub-block start vars to simple vars (ignoring stop vars).\n";
+    if (use_stop)
+        os << "\n // Simple shim function to map sub-block start vars to simple vars"
+            " (ignoring stop vars except in '" << dim << "').\n";
+    else
+        os << "\n // Simple shim function to map sub-block start vars to simple vars (ignoring stop vars).\n";
     if (use_template)
         os << " template <int level>";
     os << " inline void " << fname;
@@ -649,10 +1069,532 @@ void YASKCppPrinter::printShim(ostream& os, const string& fname,
         os << "_" << dim;
     if (use_template)
         os << "<level>";
-    os << "(" << _dims._allDims.makeDimStr(", ", "", "v") << ");\n"
+    os << "(" << _dims._allDims.makeDimStr(", ", "", "v");
+    if (use_stop)
+        os << ", stop_sb" << dim << "v";
+    os << ");\n"
         "} // " << fname << " shim.\n";
 }
 
+// Print a function that calculates a row of clusters along the inner-most
+// YASK dim, keeping a rotating window of aligned vectors in vars so that
+// only the leading edge is read from memory for each cluster.
+// If 'pipelined', the leading edge and the unaligned vectors that can be
+// made from the window are prepared for the next cluster while the
+// current one is calculated.
+void YASKCppPrinter::printRowCluster(ostream& os, EqGroup& ceq,
+                                     VecInfoVisitor& vv, CounterVisitor& cv,
+                                     bool pipelined) {
+    string fname = pipelined ? "calc_pipe_cluster" : "calc_row_cluster";
+    auto* rdim = _yask_dims.getDims().back();
+    string ucDim = allCaps(*rdim);
+
+    // There are no rows if the stencil doesn't use the inner dim, so
+    // 'row' and 'pipeline' loops in gen-loops.pl can't be used with it.
+    if (!_dims._allDims.lookup(rdim))
+        return;
+
+    // Distance between clusters in elements and vectors.
+    const int* pp = _dims._clusterPts.lookup(rdim);
+    int rpts = pp ? *pp : 1;
+    const int* pm = _dims._clusterMults.lookup(rdim);
+    int rmult = pm ? *pm : 1;
+
+    // Aligned vectors to keep in the window.
+    // Vectors that may be written by this eq-group are not kept because
+    // their values may change between clusters. This is any vector
+    // in a written grid at the same step index as a written point.
+    // Vectors without the inner dim are not kept because they
+    // don't move with the cluster.
+    auto& sdim = _dims._stepDim;
+    set<pair<string, int>> outSteps;
+    for (auto& eq : ceq.getEqs()) {
+        auto& lhs = eq->getLhs();
+        const int* p = lhs->lookup(sdim);
+        outSteps.insert(make_pair(lhs->getName(), p ? *p : 0));
+    }
+    vector<GridPoint> winVecs;
+    for (auto& gp : vv._alignedVecs) {
+        const int* p = gp.lookup(sdim);
+        if (gp.lookup(rdim) && !outSteps.count(make_pair(gp.getName(), p ? *p : 0)))
+            winVecs.push_back(gp);
+    }
+
+    // Sort by offset in inner dim so that each var is copied
+    // from before it is overwritten when rotating.
+    stable_sort(winVecs.begin(), winVecs.end(),
+                [&](const GridPoint& a, const GridPoint& b) {
+                    return a.getVal(rdim) < b.getVal(rdim);
+                });
+    map<GridPoint, string> winVars;
+    for (size_t i = 0; i < winVecs.size(); i++)
+        winVars[winVecs[i]] = "win_vec" + to_string(i);
+
+    // Vectors to read for each cluster: the leading edge plus any vector
+    // whose value can't be copied from the window, e.g., after a gap.
+    GridPointSet edge;
+    IntTuple dir;
+    dir.addDimBack(rdim, rmult);
+    vv.getLeadingEdge(edge, dir);
+    map<GridPoint, GridPoint> nextVecs; // vector to copy from after each cluster.
+    for (auto& gp : winVecs) {
+        GridPoint next(gp);
+        *next.lookup(rdim) += rpts;
+        if (!edge.count(gp) && winVars.count(next))
+            nextVecs.emplace(gp, next);
+    }
+
+    // Unaligned vectors that can be made from the window alone, i.e.,
+    // from vars that are ready before the cluster is calculated.
+    // These are made one cluster ahead when pipelining.
+    vector<GridPoint> pipeVecs;
+    if (pipelined && !_settings._allowUnalignedLoads) {
+        for (auto& i : vv._vblk2elemLists) {
+            auto& gp = i.first;
+            if (vv._alignedVecs.count(gp))
+                continue;
+            bool inWin = true;
+            for (auto& avb : vv._vblk2avblks[gp])
+                if (!winVars.count(avb))
+                    inWin = false;
+            if (inWin)
+                pipeVecs.push_back(gp);
+        }
+    }
+    map<GridPoint, string> edgeVars, curVars, nextVars;
+    for (auto& gp : winVecs)
+        if (pipelined && !nextVecs.count(gp)) {
+            string var = "pipe_vec" + to_string(edgeVars.size());
+            edgeVars[gp] = var;
+        }
+    for (size_t i = 0; i < pipeVecs.size(); i++) {
+        curVars[pipeVecs[i]] = "cur_uvec" + to_string(i);
+        nextVars[pipeVecs[i]] = "pipe_uvec" + to_string(i);
+    }
+
+    // Function header.
+    os << endl << " // Calculate clusters from " << *rdim << "v to stop_" << *rdim <<
+        "v-1 relative to indices " << _dims._allDims.makeDimStr(", ") << ".\n"
+        " // Keeps " << winVecs.size() << " aligned vector-block(s) in a rotating window;"
+        " reads " << (winVecs.size() - nextVecs.size()) << " of them for each cluster.\n";
+    if (pipelined)
+        os << " // Software-pipelined: reads the leading edge and constructs " <<
+            pipeVecs.size() << " unaligned vector-block(s) for the next cluster\n"
+            " // before calculating the current one.\n";
+    os << " // Indices must be normalized, i.e., already divided by VLEN_*.\n"
+        " inline void " << fname << "_" << *rdim << "(" <<
+        _dims._allDims.makeDimStr(", ", "idx_t ", "v") <<
+        ", idx_t stop_" << *rdim << "v) {" << endl;
+
+    // Element indices outside the row.
+    os << endl << " // Element (un-normalized) indices." << endl;
+    for (auto* dim : _dims._allDims.getDims()) {
+        if (dim == rdim)
+            continue;
+        auto p = _dims._fold.lookup(dim);
+        os << " idx_t " << *dim << " = " << *dim << "v";
+        if (p) os << " * VLEN_" << allCaps(*dim);
+        os << ";" << endl;
+    }
+
+    // Fresh print helper for each part so that vars aren't reused.
+    CppVecPrintHelper* vp = newPrintHelper(vv, cv);
+    vp->setKnownExprs(_invariantVars);
+
+    // Window vars and priming reads.
+    os << endl << " // Window of aligned vector-blocks.\n";
+    for (auto& gp : winVecs)
+        os << " " << vp->getVarType() << " " << winVars[gp] << ";\n";
+    if (pipelined) {
+        os << endl << " // Pipeline vars for the next cluster.\n";
+        for (auto& gp : winVecs)
+            if (edgeVars.count(gp))
+                os << " " << vp->getVarType() << " " << edgeVars[gp] << ";\n";
+        for (auto& gp : pipeVecs)
+            os << " " << vp->getVarType() << " " << curVars[gp] << ", " <<
+                nextVars[gp] << ";\n";
+
+        // The last cluster prepares itself again instead of reading
+        // past the end of the row.
+        os << endl << " if (" << *rdim << "v >= stop_" << *rdim << "v)\n"
+            "  return;\n"
+            " const idx_t last_" << *rdim << "v = " << *rdim << "v + ((stop_" << *rdim <<
+            "v - " << *rdim << "v - 1) / CLEN_" << ucDim << ") * CLEN_" << ucDim << ";\n";
+    }
+    os << endl << " // Prime window for first cluster.\n";
+    for (auto& gp : winVecs)
+        if (pipelined || nextVecs.count(gp))
+            vp->printAlignedVecLoad(os, gp, winVars[gp]);
+    if (pipeVecs.size()) {
+        CppVecPrintHelper* pvp = newPrintHelper(vv, cv);
+        for (auto& gp : winVecs)
+            pvp->setReadyPoint(gp, winVars[gp]);
+        os << " {\n";
+        for (auto& gp : pipeVecs) {
+            string var = pvp->readFromPoint(os, gp);
+            os << " " << curVars[gp] << " = " << var << ";\n";
+        }
+        os << " }\n";
+        delete pvp;
+    }
+
+    // Loop over clusters.
+    os << endl << " // Loop over clusters.\n"
+        " for (; " << *rdim << "v < stop_" << *rdim << "v; " <<
+        *rdim << "v += CLEN_" << ucDim << ") {\n"
+        " idx_t " << *rdim << " = " << *rdim << "v";
+    if (_dims._fold.lookup(rdim))
+        os << " * VLEN_" << ucDim;
+    os << ";" << endl;
+
+    // Prepare next cluster: read its leading edge into the pipeline
+    // vars and make its unaligned vectors from the window as it will
+    // be after rotation.
+    if (pipelined && (edgeVars.size() || pipeVecs.size())) {
+        os << endl << " // Prepare next cluster while this one is calculated.\n"
+            " const idx_t next_" << *rdim << "v = std::min(" << *rdim << "v + CLEN_" <<
+            ucDim << ", last_" << *rdim << "v);\n"
+            " {\n"
+            " const idx_t " << *rdim << "v = next_" << *rdim << "v;\n";
+        CppVecPrintHelper* nvp = newPrintHelper(vv, cv);
+        for (auto& gp : winVecs)
+            if (edgeVars.count(gp)) {
+                nvp->printAlignedVecLoad(os, gp, edgeVars[gp]);
+                nvp->setReadyPoint(gp, edgeVars[gp]);
+            }
+        for (auto& i : nextVecs)
+            nvp->setReadyPoint(i.first, winVars[i.second]);
+        for (auto& gp : pipeVecs) {
+            string var = nvp->readFromPoint(os, gp);
+            os << " " << nextVars[gp] << " = " << var << ";\n";
+        }
+        os << " }\n";
+        delete nvp;
+    }
+
+    // Read leading edge.
+    else if (!pipelined) {
+        os << endl << " // Read leading edge of window.\n";
+        for (auto& gp : winVecs)
+            if (!nextVecs.count(gp))
+                vp->printAlignedVecLoad(os, gp, winVars[gp]);
+    }
+
+    // Calculate the cluster, using the window vars.
+    for (auto& gp : winVecs)
+        vp->setReadyPoint(gp, winVars[gp]);
+    for (auto& i : curVars)
+        vp->setReadyPoint(i.first, i.second);
+    PrintVisitorBottomUp pcv(os, *vp, _maxExprSize, _minExprSize);
+    ceq.visitEqs(&pcv);
+
+    // Rotate window.
+    if (nextVecs.size() || edgeVars.size() || pipeVecs.size())
+        os << endl << " // Rotate window for next cluster.\n";
+    for (auto& gp : winVecs)
+        if (nextVecs.count(gp))
+            os << " " << winVars[gp] << " = " << winVars[nextVecs.at(gp)] << ";\n";
+    for (auto& gp : winVecs)
+        if (edgeVars.count(gp))
+            os << " " << winVars[gp] << " = " << edgeVars[gp] << ";\n";
+    for (auto& gp : pipeVecs)
+        os << " " << curVars[gp] << " = " << nextVars[gp] << ";\n";
+    os << " } // clusters.\n"
+        "} // " << fname << "_" << *rdim << "." << endl;
+    delete vp;
+
+    // Insert shim function.
+    printShim(os, fname, false, *rdim, true);
+}
+
+// Prepare 'ceq' for vector code and estimate the registers it needs.
+int YASKCppPrinter::prepVecCode(EqGroup& ceq, VecInfoVisitor& vv, CounterVisitor& cv,
+                                bool doRegOrder, bool allowUnalignedLoads,
+                                map<Expr*, string>& invariantVars,
+                                vector<Expr*>& invariantExprs) {
+
+    // Create vector info for this eqGroup.
+    // The visitor is accepted at all nodes in the cluster AST;
+    // for each grid access node in the AST, the vectors
+    // needed are determined and saved in the visitor.
+    ceq.visitEqs(&vv);
+
+    // Reorder based on vector info.
+    ExprReorderVisitor erv(vv);
+    ceq.visitEqs(&erv);
+
+    // Reorder to reduce the number of registers needed.
+    if (doRegOrder) {
+        RegOrderVisitor rov;
+        ceq.visitEqs(&rov);
+    }
+    ceq.visitEqs(&cv);
+
+    // Exprs that are the same in every cluster, with one var for each
+    // unique expr.
+    invariantVars.clear();
+    invariantExprs.clear();
+    InvariantVisitor iv;
+    ceq.visitEqs(&iv);
+    map<string, string> varNames; // expr string to var name.
+    for (auto* ep : iv.getInvariants()) {
+        string estr = ep->makeStr();
+        if (!varNames.count(estr)) {
+            varNames[estr] = "_inv_vecs[" + to_string(invariantExprs.size()) + "]";
+            invariantExprs.push_back(ep);
+        }
+        invariantVars[ep] = varNames[estr];
+    }
+
+    // Estimate registers needed.
+    RegPressureVisitor rpv(vv, cv, allowUnalignedLoads, &invariantVars);
+    ceq.visitEqs(&rpv);
+    return rpv.getPeak();
+}
+
+// Print code to evaluate the invariant exprs found by prepVecCode(), e.g.,
+// products of parameters, once per run instead of in each cluster.
+void YASKCppPrinter::printInvariants(ostream& os, const string& egsName) {
+    auto& exprs = _invariantExprs;
+    if (exprs.empty())
+        return;
+
+    // Storage is allocated separately because the eq-group objects
+    // may not be aligned for real_vec_t.
+    os << endl << " // Values of " << exprs.size() <<
+        " expression(s) that are the same in every cluster, set by init_invariants().\n"
+        " protected:\n"
+        " real_vec_t* _inv_vecs = 0;\n"
+        " public:\n"
+        " virtual ~" << egsName << "() { free(_inv_vecs); }\n";
+
+    // Scalar evaluation of each expr, broadcast into its vector.
+    os << endl << " // Evaluate the expressions that don't depend on indices.\n"
+        " virtual void init_invariants() {\n"
+        " if (!_inv_vecs && posix_memalign((void**)&_inv_vecs, CACHELINE_BYTES, " <<
+        exprs.size() << " * sizeof(real_vec_t))) {\n"
+        "  std::cerr << \"error: cannot allocate invariant values.\" << std::endl;\n"
+        "  exit_yask(1);\n"
+        " }\n";
+    CppPrintHelper sp(NULL, "temp", "real_t", " ", ";\n");
+    for (auto* ep : exprs) {
+        PrintVisitorTopDown pv(os, sp);
+        ep->accept(&pv);
+        os << " " << _invariantVars[ep] << " = " << pv.getExprStr() <<
+            "; // " << ep->makeStr() << ".\n";
+    }
+    os << " } // init_invariants." << endl;
+}
+
+// Print the footprint of one cluster step in each direction and the
+// prefetch distances derived from it. The footprint is the leading edge,
+// i.e., the aligned vectors not already read by the previous step, so
+// lines that are still resident aren't counted. Each grid on the edge
+// gets its own distances, based on its own bytes per step.
+void YASKCppPrinter::printPrefetchDistances(ostream& os, VecInfoVisitor& vv) {
+    os << endl << " // Aligned vector-block(s) of each grid first read in each cluster step;"
+        " the prefetch distances are the steps needed to cover the"
+        " PF_L1_LATENCY and PF_L2_LATENCY cycles at the grid's bytes per step." << endl;
+    for (auto* dim : _dims._allDims.getDims()) {
+        if (*dim == _dims._stepDim)
+            continue;
+        const int* p = _dims._clusterMults.lookup(dim);
+        IntTuple dir;
+        dir.addDimBack(dim, p ? *p : 1);
+        GridPointSet edge;
+        vv.getLeadingEdge(edge, dir);
+
+        // Count per grid.
+        map<string, int> gridVecs;
+        for (auto& gp : edge)
+            gridVecs[gp.getName()]++;
+
+        os << " // '+" << *dim << "': " << edge.size() << " vector-block(s)." << endl;
+        for (auto& i : gridVecs) {
+            string sfx = i.first + "_" + *dim;
+            os << " // '" << i.first << "': " << i.second <<
+                " * VLEN * REAL_BYTES byte(s) per step." << endl <<
+                " static constexpr idx_t pfd_l1_" << sfx << " = AUTO_PFDL1(" << i.second << ");" << endl <<
+                " static constexpr idx_t pfd_l2_" << sfx << " = AUTO_PFDL2(" << i.second << ");" << endl;
+        }
+    }
+}
+
+// Print functions that calculate whole clusters but only write the
+// elements that are in a given range and in the valid domain of the
+// eq-group. These are used for sub-blocks that aren't 'simple', e.g.,
+// when the eq-group has a condition.
+void YASKCppPrinter::printMaskedCluster(ostream& os, EqGroup& ceq, const string& egsName,
+                                        VecInfoVisitor& vv, CounterVisitor& cv) {
+    auto sdims = _dims._allDims.removeDimInDim(_dims._stepDim);
+    string rangeArgs = sdims.makeDimStr(", ", "begin_") + ", " +
+        sdims.makeDimStr(", ", "end_");
+
+    // Mask function.
+    {
+        os << endl << " // Get a mask of the elements in the vector at indices " <<
+            _dims._allDims.makeDimStr(", ") << "\n"
+            " // that are in [begin_*, end_*) and in the valid domain.\n"
+            " inline unsigned int get_vec_mask(" <<
+            _dims._allDims.makeDimStr(", ", "idx_t ") << ", " <<
+            sdims.makeDimStr(", ", "idx_t begin_") << ", " <<
+            sdims.makeDimStr(", ", "idx_t end_") << ") {\n"
+            " unsigned int mask = 0;\n";
+        for (auto* dim : sdims.getDims())
+            os << " for (idx_t i_" << *dim << " = 0; i_" << *dim << " < VLEN_" <<
+                allCaps(*dim) << "; i_" << *dim << "++)\n";
+        os << " if (";
+        for (auto* dim : sdims.getDims())
+            os << *dim << " + i_" << *dim << " >= begin_" << *dim << " && " <<
+                *dim << " + i_" << *dim << " < end_" << *dim << " &&\n  ";
+
+        // Call the condition w/o a virtual lookup.
+        os << egsName << "::is_in_valid_domain(";
+        int n = 0;
+        for (auto* dim : _dims._allDims.getDims()) {
+            if (n++) os << ", ";
+            os << *dim;
+            if (sdims.lookup(dim))
+                os << " + i_" << *dim;
+        }
+        os << "))\n"
+            "  mask |= 1u << real_vec_t::get_elem_index(";
+        n = 0;
+        for (auto* dim : _yask_dims.getDims()) {
+            if (n++) os << ", ";
+            if (sdims.lookup(dim))
+                os << "i_" << *dim;
+            else
+                os << "0";
+        }
+        os << ");\n"
+            " return mask;\n"
+            " }" << endl;
+    }
+
+    // Cluster function.
+    {
+        os << endl << " // Calculate the cluster at indices " << _dims._allDims.makeDimStr(", ") <<
+            " like calc_cluster(),\n"
+            " // but only write the elements in [begin_*, end_*) that are in the valid domain.\n"
+            " // Cluster indices must be normalized; begin and end indices must not be.\n"
+            " inline void calc_masked_cluster(" <<
+            _dims._allDims.makeDimStr(", ", "idx_t ", "v") << ", " <<
+            sdims.makeDimStr(", ", "idx_t begin_") << ", " <<
+            sdims.makeDimStr(", ", "idx_t end_") << ") {" << endl;
+
+        // Element indices.
+        os << endl << " // Element (un-normalized) indices." << endl;
+        for (auto* dim : _dims._allDims.getDims()) {
+            auto p = _dims._fold.lookup(dim);
+            os << " idx_t " << *dim << " = " << *dim << "v";
+            if (p) os << " * VLEN_" << allCaps(*dim);
+            os << ";" << endl;
+        }
+
+        // One mask for each written vector in the cluster.
+        CppVecPrintHelper* vp = newPrintHelper(vv, cv);
+        vp->setKnownExprs(_invariantVars);
+        map<string, string> maskNames; // mask args to mask var.
+        os << endl << " // Masks for written vectors." << endl;
+        for (auto& eq : ceq.getEqs()) {
+            auto& lhs = eq->getLhs();
+            string args;
+            for (auto* dim : _dims._allDims.getDims()) {
+                args += *dim;
+                const int* p = sdims.lookup(dim) ? lhs->lookup(dim) : 0;
+                if (p && *p > 0)
+                    args += " + " + to_string(*p);
+                else if (p && *p < 0)
+                    args += " - " + to_string(-*p);
+                args += ", ";
+            }
+            if (!maskNames.count(args)) {
+                string mname = "mask_" + to_string(maskNames.size());
+                maskNames[args] = mname;
+                os << " unsigned int " << mname << " = get_vec_mask(" <<
+                    args << rangeArgs << ");" << endl;
+            }
+            vp->setWriteMask(*lhs, maskNames[args]);
+        }
+
+        PrintVisitorBottomUp pcv(os, *vp, _maxExprSize, _minExprSize);
+        ceq.visitEqs(&pcv);
+        os << "} // calc_masked_cluster." << endl;
+        delete vp;
+    }
+
+    // Sub-block function.
+    {
+        os << endl << " // Calculate a sub-block from begin_sb* to end_sb*-1 in each spatial dim\n"
+            " // using masked clusters, writing only elements in the valid domain.\n"
+            " // Indices must not be normalized.\n"
+            " virtual void calc_sub_block_of_masked_clusters(idx_t sbt, " <<
+            sdims.makeDimStr(", ", "idx_t begin_sb") << ", " <<
+            sdims.makeDimStr(", ", "idx_t end_sb") << ") {\n"
+            "\n"
+            " // Whole clusters covering the sub-block.\n";
+        for (auto* dim : sdims.getDims()) {
+            string ucDim = allCaps(*dim);
+            os << " const idx_t begin_sb" << *dim << "v = idiv_flr<idx_t>(begin_sb" << *dim <<
+                ", CPTS_" << ucDim << ") * CLEN_" << ucDim << ";\n"
+                " const idx_t end_sb" << *dim << "v = idiv_flr<idx_t>(end_sb" << *dim <<
+                " + CPTS_" << ucDim << " - 1, CPTS_" << ucDim << ") * CLEN_" << ucDim << ";\n";
+        }
+        for (auto* dim : sdims.getDims())
+            os << " for (idx_t " << *dim << "v = begin_sb" << *dim << "v; " <<
+                *dim << "v < end_sb" << *dim << "v; " <<
+                *dim << "v += CLEN_" << allCaps(*dim) << ")\n";
+        os << "  calc_masked_cluster(";
+        for (auto* dim : _dims._allDims.getDims())
+            os << (sdims.lookup(dim) ? *dim + "v" : string("sbt")) << ", ";
+        os << sdims.makeDimStr(", ", "begin_sb") << ", " <<
+            sdims.makeDimStr(", ", "end_sb") << ");\n"
+            "} // calc_sub_block_of_masked_clusters" << endl;
+    }
+}
+
+// Find sets of grids to be interleaved in one allocation.  Only grids
+// with the same dims are fused. If fusion targets are given, grids are
+// fused with others matching the same target; otherwise, all grids with
+// the same dims are fused.
+void YASKCppPrinter::findFusedGrids() {
+    _fusedGrids.clear();
+    _fusedGridIdx.clear();
+    if (!_settings._doFuse)
+        return;
+
+    // Collect grids by target and dims.
+    map<string, Grids> sets;
+    for (auto gp : _grids) {
+        string target;
+        bool found = false;
+        if (_settings._fuseTargets.length()) {
+            ArgParser ap;
+            ap.parseKeyValuePairs
+                (_settings._fuseTargets, [&](const string& key, const string& value) {
+                    if (!found && gp->getName().find(value) != string::npos) {
+                        target = key;
+                        found = true;
+                    }
+                });
+            if (!found)
+                continue;
+        }
+        sets[target + ":" + gp->makeDimStr(",")].insert(gp);
+    }
+
+    // Keep sets with more than one grid.
+    for (auto& si : sets) {
+        auto& fgrids = si.second;
+        if (fgrids.size() < 2)
+            continue;
+        for (auto gp : fgrids)
+            _fusedGridIdx[gp] = _fusedGrids.size();
+        _fusedGrids.push_back(fgrids);
+    }
+}
+
 // Print YASK code in new stencil context class.
 // TODO: split this into smaller methods.
 void YASKCppPrinter::printCode(ostream& os) {
@@ -676,12 +1618,21 @@ void YASKCppPrinter::printCode(ostream& os) {
             "struct " << _context_base << " : public StencilContext {" << endl;
 
         // Grids.
+        findFusedGrids();
         string ctorCode, ctorList;
         os << "\n ///// Grid(s)." << endl;
         for (auto gp : _grids) {
             assert (!gp->isParam());
             string grid = gp->getName();
 
+            // Fused grids must have the same allocation, so sizes are
+            // taken from all the grids fused with this one.
+            Grids sgrids;
+            if (_fusedGridIdx.count(gp))
+                sgrids = _fusedGrids.at(_fusedGridIdx.at(gp));
+            else
+                sgrids.insert(gp);
+
             os << "\n // The " << gp->getNumDims() <<
                 "D '" << grid << "' grid, which is ";
             if (_eqGroups.getOutputGrids().count(gp))
@@ -691,8 +1642,10 @@ void YASKCppPrinter::printCode(ostream& os) {
             
             // Type name.
             // Name in kernel is 'Grid_' followed by dimensions.
-            string typeName = "Grid_";
-            string templStr;
+            // Fused grids use 'FusedGrid_', whose last template arg is
+            // the number of grids interleaved.
+            string typeName = sgrids.size() > 1 ? "FusedGrid_" : "Grid_";
+            vector<string> templArgs;
             for (auto* dim : gp->getDims()) {
 
                 // Add dim suffix.
@@ -702,14 +1655,29 @@ void YASKCppPrinter::printCode(ostream& os) {
                 // step dimension.
                 if (*dim == _dims._stepDim) {
                     string sdvar = grid + "_alloc_" + *dim;
-                    int sdval = _settings._stepAlloc > 0 ?
-                        _settings._stepAlloc : gp->getStepDimSize();
+                    int sdval = _settings._stepAlloc;
+                    if (sdval <= 0)
+                        for (auto sgp : sgrids)
+                            sdval = max(sdval, sgp->getStepDimSize());
                     os << " static const idx_t " << sdvar << " = " << sdval <<
                         "; // total allocation required in '" << *dim << "' dimension.\n";
-                    templStr = "<" + sdvar + ">";
+                    templArgs.push_back(sdvar);
+                }
+            }
+            if (sgrids.size() > 1) {
+                string fvar = grid + "_fused";
+                os << " static const idx_t " << fvar << " = " << sgrids.size() <<
+                    "; // number of grids interleaved in its allocation.\n";
+                templArgs.push_back(fvar);
+            }
+            if (templArgs.size()) {
+                string sep = "<";
+                for (auto& arg : templArgs) {
+                    typeName += sep + arg;
+                    sep = ", ";
                 }
+                typeName += ">";
             }
-            typeName += templStr;
 
             // Actual grid declaration.
             os << " " << typeName << "* " << grid << ";\n";
@@ -732,8 +1700,10 @@ void YASKCppPrinter::printCode(ostream& os) {
 
                     // Halo for this dimension.
                     string hvar = grid + "_halo_" + *dim;
-                    int hval = _settings._haloSize > 0 ?
-                        _settings._haloSize : gp->getHaloSize(*dim);
+                    int hval = _settings._haloSize;
+                    if (hval <= 0)
+                        for (auto sgp : sgrids)
+                            hval = max(hval, sgp->getHaloSize(*dim));
                     os << " const idx_t " << hvar << " = " << hval <<
                         "; // halo allocation required in '" << *dim << "' dimension.\n";
                     ctorCode += " " + grid + "->set_halo_" + *dim +
@@ -749,6 +1719,17 @@ void YASKCppPrinter::printCode(ostream& os) {
             }
         }
 
+        // Fused grids.
+        for (auto& fgrids : _fusedGrids) {
+            ctorCode += "\n  // Interleave grids";
+            for (auto gp : fgrids)
+                ctorCode += " '" + gp->getName() + "'";
+            ctorCode += " in one allocation.\n"
+                " fusedGridPtrs.push_back(GridPtrs());\n";
+            for (auto gp : fgrids)
+                ctorCode += " fusedGridPtrs.back().push_back(" + gp->getName() + ");\n";
+        }
+
         // Max halos.
         os << endl << " // Max halos across all grids." << endl;
         for (auto dim : maxHalos.getDims())
@@ -900,6 +1881,42 @@ void YASKCppPrinter::printCode(ostream& os) {
             delete sp;
         }
 
+        // Reference code by rows.
+        // This is kept separate from the optimized code and uses the same
+        // scalar eqs as calc_scalar(), i.e., the copy made before any
+        // optimizations that change the FP results, but without virtual
+        // calls and in a row that the C++ compiler can vectorize. There
+        // are no dependencies between equations in an eq-group, so it is
+        // safe to evaluate the points in a row in any order. Only used
+        // when the kernel's 'ref_rows' option is set.
+        {
+            auto sdims = _dims._allDims.removeDimInDim(_dims._stepDim);
+            auto& idim = *sdims.getDims().back(); // inner dim.
+            auto odims = sdims.removeDimInDim(idim);
+            CounterVisitor cv;
+            eq.visitEqs(&cv);
+            CppPrintHelper* sp = new CppPrintHelper(&cv, "temp", "real_t", " ", ";\n");
+
+            os << endl << " // Calculate scalar results relative to indices " <<
+                _dims._allDims.makeDimStr(", ") << "\n"
+                " // for " << idim << " from begin_" << idim << " to end_" << idim <<
+                "-1 where valid. Used only for validation w/'ref_rows'.\n"
+                " virtual void calc_ref_row(idx_t " << _dims._stepDim << ", " <<
+                odims.makeDimStr(", ", "idx_t ") << ", idx_t begin_" << idim <<
+                ", idx_t end_" << idim << ") {\n"
+                "#pragma omp simd\n"
+                " for (idx_t " << idim << " = begin_" << idim << "; " <<
+                idim << " < end_" << idim << "; " << idim << "++) {\n"
+                " if (!" << egsName << "::is_in_valid_domain(" <<
+                _dims._allDims.makeDimStr(", ") << ")) continue;" << endl;
+            PrintVisitorBottomUp pcv(os, *sp, _maxExprSize, _minExprSize);
+            eq.visitEqs(&pcv);
+            os << " }\n"
+                "} // calc_ref_row." << endl;
+
+            delete sp;
+        }
+
         // Cluster/Vector code.
         {
             // Cluster eqGroup at same index.
@@ -908,21 +1925,22 @@ void YASKCppPrinter::printCode(ostream& os) {
             auto& ceq = _clusterEqGroups.at(ei);
             assert(egDesc == ceq.getDescription());
 
-            // Create vector info for this eqGroup.
-            // The visitor is accepted at all nodes in the cluster AST;
-            // for each grid access node in the AST, the vectors
-            // needed are determined and saved in the visitor.
+            // Create vector info for this eqGroup, reorder its exprs,
+            // and estimate the registers needed.
             VecInfoVisitor vv(_dims);
-            ceq.visitEqs(&vv);
+            CounterVisitor cv;
+            int peak = prepVecCode(ceq, vv, cv, _settings._doRegOrder,
+                                   _settings._allowUnalignedLoads,
+                                   _invariantVars, _invariantExprs);
+            int numSpills = max(peak - _settings._numVecRegs, 0);
+            _maxLiveVecs = max(_maxLiveVecs, peak);
 
-            // Reorder based on vector info.
-            ExprReorderVisitor erv(vv);
-            ceq.visitEqs(&erv);
-            
             // C++ vector print assistant.
-            CounterVisitor cv;
-            ceq.visitEqs(&cv);
             CppVecPrintHelper* vp = newPrintHelper(vv, cv);
+
+            // Exprs that are the same in every cluster.
+            printInvariants(os, egsName);
+            vp->setKnownExprs(_invariantVars);
             
             // Stencil-calculation code.
             // Function header.
@@ -938,6 +1956,9 @@ void YASKCppPrinter::printCode(ostream& os) {
                 " aligned vector-block(s)." << endl;
             os << " // There are approximately " << (stats.getNumOps() * numResults) <<
                 " FP operation(s) per invocation." << endl;
+            os << " // Up to approximately " << peak <<
+                " vector(s) are live at once; with " << _settings._numVecRegs <<
+                " vector register(s), " << numSpills << " spill(s) are predicted." << endl;
             os << " inline void calc_cluster(" <<
                 _dims._allDims.makeDimStr(", ", "idx_t ", "v") << ") {" << endl;
 
@@ -965,6 +1986,12 @@ void YASKCppPrinter::printCode(ostream& os) {
 
             // Insert shim function.
             printShim(os, "calc_cluster");
+
+            // Masked cluster code for non-simple sub-blocks.
+            printMaskedCluster(os, ceq, egsName, vv, cv);
+            
+            // Distances for directional prefetches.
+            printPrefetchDistances(os, vv);
             
             // Generate prefetch code for no specific direction and then each
             // orthogonal direction.
@@ -1005,8 +2032,15 @@ void YASKCppPrinter::printCode(ostream& os) {
                 string fname2 = fname1;
                 if (dir.size())
                     fname2 += "_" + *dir.getDirName();
-                os << " template<int level> inline void " << fname2 << "(" <<
-                    _dims._allDims.makeDimStr(", ", "idx_t ", "v") << ") {" << endl;
+                os << " template<int level> inline void " << fname2 << "(";
+                string sep;
+                for (auto* dim : _dims._allDims.getDims()) {
+                    os << sep << "idx_t " << *dim << "v";
+                    if (dir.size() && *dim == *dir.getDirName())
+                        os << "_pf";
+                    sep = ", ";
+                }
+                os << ") {" << endl;
 
                 // C++ prefetch code.
                 vp->printPrefetches(os, dir);
@@ -1019,6 +2053,10 @@ void YASKCppPrinter::printCode(ostream& os) {
 
             } // direction.
 
+            // Calculation of a row of clusters, plain and software-pipelined.
+            printRowCluster(os, ceq, vv, cv, false);
+            printRowCluster(os, ceq, vv, cv, true);
+
             delete vp;
 
             // Sub-block.
@@ -1043,7 +2081,9 @@ void YASKCppPrinter::printCode(ostream& os) {
                         " const idx_t step_sb" << *dim << "v = CLEN_" << ucDim << ";\n"
                         " const idx_t group_size_sb" << *dim << "v = CLEN_" << ucDim << ";\n";
             }
-            os << " #if !defined(DEBUG) && defined(__INTEL_COMPILER)\n"
+            os << "\n // Variant of the generated sub-block loops to run.\n"
+                " const int loop_variant = _generic_context->get_settings().sub_block_loop_variant;\n"
+                " #if !defined(DEBUG) && defined(__INTEL_COMPILER)\n"
                 " #pragma forceinline recursive\n"
                 " #endif\n"
                 " {\n"
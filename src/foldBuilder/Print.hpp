@@ -44,6 +44,7 @@ protected:
     string _varType;            // type, if any, of var.
     string _linePrefix;         // prefix for each line.
     string _lineSuffix;         // suffix for each line.
+    map<Expr*, string> _knownExprs; // exprs whose values are already in vars.
 
 public:
     PrintHelper(const CounterVisitor* cv,
@@ -78,6 +79,26 @@ public:
         return (c <= 1) ? 0 : c-1;
     }
     
+    // Return number of vars made so far.
+    virtual int getNumVars() const {
+        return _varNum - 1;
+    }
+    
+    // Use 'varName' wherever 'ep' would be printed.
+    virtual void setKnownExpr(Expr* ep, const string& varName) {
+        _knownExprs[ep] = varName;
+    }
+    virtual void setKnownExprs(const map<Expr*, string>& knownExprs) {
+        for (auto& i : knownExprs)
+            setKnownExpr(i.first, i.second);
+    }
+
+    // Return name of var holding value of 'ep' or empty string if none.
+    virtual string getKnownExpr(Expr* ep) const {
+        auto i = _knownExprs.find(ep);
+        return (i == _knownExprs.end()) ? "" : i->second;
+    }
+    
     // Make and return next var name.
     virtual string makeVarName() {
         ostringstream oss;
@@ -122,6 +143,13 @@ public:
     virtual string writeToPoint(ostream& os, const GridPoint& gp, const string& val) {
         return gp.makeStr() + " EQUALS " + val;
     }
+
+    // Return name of a function that takes (a, b, c) and returns
+    // 'c + a * b', or 'c - a * b' if 'negate' is set.
+    // Return an empty string to print multiplies and adds separately.
+    virtual string getFmaFnName(bool negate) const {
+        return "";
+    }
 };
 
 // Base class for a print visitor.
@@ -169,6 +197,18 @@ public:
     // Get the number of shared nodes found after this visitor
     // has been accepted.
     int getNumCommon() const { return _numCommon; }
+
+    // Print 'ep' and return the result w/o changing _exprStr.
+    virtual string getExprStrOf(Expr* ep);
+
+    // Print the var holding 'ep' if there is one.
+    // Return true if printing is done.
+    virtual bool tryKnownPrint(Expr* ep);
+
+    // Try to print a sum of products or a difference w/a product
+    // as FMA(s). Return true if printing is done.
+    virtual bool tryFmaPrint(CommutativeExpr* ce);
+    virtual bool tryFmaPrint(BinaryNumExpr* be);
     
     // A grid or parameter read.
     virtual void visit(GridPoint* gp);
@@ -246,6 +286,11 @@ public:
     // Return false if more complex method should be used.
     virtual bool trySimplePrint(Expr* ex, bool force);
 
+    // Try to print a sum of products or a difference w/a product
+    // as FMA(s), one per temp var. Return true if printing is done.
+    virtual bool tryFmaPrint(CommutativeExpr* ce);
+    virtual bool tryFmaPrint(BinaryNumExpr* be);
+
     // A grid or param point.
     virtual void visit(GridPoint* gp);
 
@@ -477,4 +522,30 @@ public:
     virtual void print(ostream& os);
 };
 
+// Print out an analysis of each eq-group in JSON form, e.g., as input to
+// a roofline model.
+class ReportPrinter : public PrinterBase {
+protected:
+    EqGroups& _clusterEqGroups;
+    const Dimensions& _dims;
+    IntTuple _blockSize;        // block size in points for footprint.
+    int _realBytes;             // size of one FP element.
+
+    // Number of points in the union of blocks at the given offsets.
+    virtual long long countBlockUnion(const vector<IntTuple>& offsets) const;
+    
+public:
+    ReportPrinter(StencilBase& stencil, EqGroups& eqGroups,
+                  EqGroups& clusterEqGroups, const Dimensions& dims,
+                  const IntTuple& blockSize, int realBytes) :
+        PrinterBase(stencil, eqGroups, 0, 0),
+        _clusterEqGroups(clusterEqGroups),
+        _dims(dims),
+        _blockSize(blockSize),
+        _realBytes(realBytes) { }
+    virtual ~ReportPrinter() { }
+
+    virtual void print(ostream& os);
+};
+
 #endif
@@ -306,6 +306,18 @@ public:
     }                   // end of visit() method.
 };
 
+// Counts of vector operations printed by a VecPrintHelper.
+// Used to compare the costs of different folds.
+struct VecOpCounts {
+    int alignedReads = 0;       // aligned vector reads from memory.
+    int unalignedReads = 0;     // unaligned vector reads from memory.
+    int unalignedCtors = 0;     // unaligned vectors constructed from aligned ones.
+    int aligns = 0;             // align (shift) operations.
+    int perms = 0;              // 1-input permute operations.
+    int perm2s = 0;             // 2-input permute operations.
+    int elemCopies = 0;         // single-element copies.
+};
+
 // Define methods for printing a vectorized version of the stencil.
 class VecPrintHelper : public PrintHelper {
 protected:
@@ -314,6 +326,7 @@ protected:
     bool _reuseVars; // if true, load to a local var; else, reload on every access.
     bool _definedNA;           // NA var defined.
     map<GridPoint, string> _readyPoints; // points that are already constructed.
+    VecOpCounts _opCounts;     // ops printed so far.
 
     // Print access to an aligned vector block.
     // Return var name.
@@ -355,6 +368,16 @@ public:
         return _vv.getFold();
     }
 
+    // get counts of ops printed so far.
+    virtual const VecOpCounts& getOpCounts() const {
+        return _opCounts;
+    }
+
+    // Use existing var 'varName' for 'gp' instead of reading it.
+    virtual void setReadyPoint(const GridPoint& gp, const string& varName) {
+        _readyPoints[gp] = varName;
+    }
+
     // Add a N/A var, just for readability.
     virtual void makeNA(ostream& os) {
         if (!_definedNA) {
@@ -505,4 +528,261 @@ public:
     }
 };
 
+// A visitor that orders the operands of commutative exprs so that the
+// ones needing the most registers are evaluated first, as in
+// Sethi-Ullman numbering. This lowers the number of registers needed
+// because the partial result is held while each later operand is
+// evaluated. Operands needing the same number of registers keep their
+// current order, e.g., from ExprReorderVisitor.
+class RegOrderVisitor : public ExprVisitor {
+protected:
+    map<Expr*, int> _labels;    // registers needed for each node.
+
+    // Set label for 'ep' and return true if it was already set.
+    virtual bool alreadyLabeled(Expr* ep, int label) {
+        if (_labels.count(ep))
+            return true;
+        _labels[ep] = label;
+        return false;
+    }
+
+public:
+    virtual ~RegOrderVisitor() {}
+
+    // Get the number of registers needed to evaluate 'ep' alone.
+    // Pre-requisite: visitor has been accepted.
+    virtual int getLabel(Expr* ep) const {
+        auto i = _labels.find(ep);
+        return (i == _labels.end()) ? 1 : i->second;
+    }
+
+    // Leaf nodes need one register.
+    virtual void visit(ConstExpr* ce) { alreadyLabeled(ce, 1); }
+    virtual void visit(CodeExpr* ce) { alreadyLabeled(ce, 1); }
+    virtual void visit(IndexExpr* ie) { alreadyLabeled(ie, 1); }
+    virtual void visit(IntTupleExpr* ite) { alreadyLabeled(ite, 1); }
+    virtual void visit(GridPoint* gp) { alreadyLabeled(gp, 1); }
+
+    // Unary: same as operand.
+    virtual void visit(UnaryNumExpr* ue) {
+        if (_labels.count(ue))
+            return;
+        ue->getRhs()->accept(this);
+        _labels[ue] = getLabel(ue->getRhs().get());
+    }
+
+    // Binary: one more than operands if they need the same number.
+    virtual void visit(BinaryNumExpr* be) {
+        if (_labels.count(be))
+            return;
+        be->getLhs()->accept(this);
+        be->getRhs()->accept(this);
+        int l = getLabel(be->getLhs().get());
+        int r = getLabel(be->getRhs().get());
+        _labels[be] = (l == r) ? l + 1 : max(l, r);
+    }
+
+    // Commutative: sort operands, then the partial result of the first
+    // operand(s) is held while evaluating each of the others.
+    virtual void visit(CommutativeExpr* ce) {
+        if (_labels.count(ce))
+            return;
+        auto& ops = ce->getOps();
+        for (auto& ep : ops)
+            ep->accept(this);
+        stable_sort(ops.begin(), ops.end(),
+                    [&](const NumExprPtr& a, const NumExprPtr& b) {
+                        return getLabel(a.get()) > getLabel(b.get());
+                    });
+        int label = 1;
+        for (size_t i = 0; i < ops.size(); i++)
+            label = max(label, getLabel(ops[i].get()) + (i > 0 ? 1 : 0));
+        _labels[ce] = label;
+    }
+
+    // Conditions are not evaluated w/vector registers.
+    virtual void visit(UnaryBoolExpr* ue) { }
+    virtual void visit(UnaryNum2BoolExpr* ue) { }
+    virtual void visit(BinaryBoolExpr* be) { }
+    virtual void visit(BinaryNum2BoolExpr* be) { }
+    virtual void visit(IfExpr* ie) {
+        ie->getExpr()->accept(this);
+    }
+
+    // Only the RHS of an equation is evaluated.
+    virtual void visit(EqualsExpr* ee) {
+        ee->getRhs()->accept(this);
+    }
+};
+
+// A visitor that estimates the number of vector registers needed to
+// evaluate a cluster of equations in the order PrintVisitorBottomUp
+// evaluates them. A value is live from when it is made until its last
+// use, and the estimate is the peak number of live values. The number of
+// uses of each node comes from a CounterVisitor. Aligned vectors that are
+// combined into unaligned ones stay live until the last unaligned vector
+// that needs them is made.
+class RegPressureVisitor : public ExprVisitor {
+protected:
+    VecInfoVisitor& _vv;
+    const CounterVisitor& _cv;
+    bool _allowUnalignedLoads;
+    const map<Expr*, string>* _knownExprs; // exprs already in vars, if any.
+
+    map<Expr*, int> _exprUses;  // uses left of each node made so far.
+    map<GridPoint, int> _vecUses; // uses left of each aligned vec.
+    GridPointSet _madeVecs;     // aligned vecs made so far.
+    GridPointSet _madePoints;   // unaligned vecs made so far.
+    int _live, _peak;           // number of live values.
+
+    // Add one live value.
+    virtual void addLive() {
+        _live++;
+        _peak = max(_peak, _live);
+    }
+
+    // Use the value of 'ep' once.
+    virtual void useExpr(Expr* ep) {
+        if (--_exprUses[ep] == 0)
+            _live--;
+    }
+    virtual void useVec(const GridPoint& av) {
+        if (--_vecUses[av] == 0)
+            _live--;
+    }
+
+    // Return true if 'ep' has already been made. Otherwise, remember
+    // how many times it will be used. If it is held in a var outside
+    // this code, make it now and return true.
+    virtual bool alreadyMade(Expr* ep) {
+        if (_exprUses.count(ep))
+            return true;
+        _exprUses[ep] = max(_cv.getCount(ep), 1);
+        if (_knownExprs && _knownExprs->count(ep)) {
+            addLive();
+            return true;
+        }
+        return false;
+    }
+
+public:
+    RegPressureVisitor(VecInfoVisitor& vv,
+                       const CounterVisitor& cv,
+                       bool allowUnalignedLoads,
+                       const map<Expr*, string>* knownExprs = 0) :
+        _vv(vv), _cv(cv), _allowUnalignedLoads(allowUnalignedLoads),
+        _knownExprs(knownExprs), _live(0), _peak(0) {
+
+        // Count the unaligned vecs that need each aligned vec.
+        if (!_allowUnalignedLoads) {
+            for (auto& i : _vv._vblk2avblks)
+                if (!_vv._alignedVecs.count(i.first))
+                    for (auto& av : i.second)
+                        _vecUses[av]++;
+        }
+    }
+    virtual ~RegPressureVisitor() {}
+
+    // Get the estimated number of registers needed.
+    // Pre-requisite: visitor has been accepted.
+    virtual int getPeak() const { return _peak; }
+
+    // Leaf nodes.
+    virtual void visit(ConstExpr* ce) {
+        if (!alreadyMade(ce))
+            addLive();
+    }
+    virtual void visit(CodeExpr* ce) {
+        if (!alreadyMade(ce))
+            addLive();
+    }
+    virtual void visit(IndexExpr* ie) {
+        if (!alreadyMade(ie))
+            addLive();
+    }
+    virtual void visit(IntTupleExpr* ite) {
+        if (!alreadyMade(ite))
+            addLive();
+    }
+
+    // A grid read, which may need aligned vecs to be read first.
+    virtual void visit(GridPoint* gp) {
+        if (alreadyMade(gp))
+            return;
+        if (gp->isParam() || _allowUnalignedLoads ||
+            _vv._alignedVecs.count(*gp) || _madePoints.count(*gp) ||
+            !_vv._vblk2avblks.count(*gp)) {
+            addLive();
+            return;
+        }
+        auto& avbs = _vv._vblk2avblks.at(*gp);
+        for (auto& av : avbs) {
+            if (!_madeVecs.count(av)) {
+                _madeVecs.insert(av);
+                addLive();
+            }
+        }
+        addLive();
+        for (auto& av : avbs)
+            useVec(av);
+        _madePoints.insert(*gp);
+    }
+
+    // Operators: eval operands, then make the result.
+    virtual void visit(UnaryNumExpr* ue) {
+        if (alreadyMade(ue))
+            return;
+        ue->getRhs()->accept(this);
+        useExpr(ue->getRhs().get());
+        addLive();
+    }
+    virtual void visit(BinaryNumExpr* be) {
+        if (alreadyMade(be))
+            return;
+        be->getLhs()->accept(this);
+        be->getRhs()->accept(this);
+        useExpr(be->getLhs().get());
+        useExpr(be->getRhs().get());
+        addLive();
+    }
+
+    // Commutative: each operand after the first is combined w/the
+    // partial result as soon as it is evaluated.
+    virtual void visit(CommutativeExpr* ce) {
+        if (alreadyMade(ce))
+            return;
+        auto& ops = ce->getOps();
+        for (size_t i = 0; i < ops.size(); i++) {
+            ops[i]->accept(this);
+            if (i > 0) {
+                if (i == 1)
+                    useExpr(ops[0].get());
+                else
+                    _live--;    // previous partial result.
+                useExpr(ops[i].get());
+                addLive();
+            }
+        }
+        if (ops.size() == 1) {
+            useExpr(ops[0].get());
+            addLive();
+        }
+    }
+
+    // Conditions are not evaluated w/vector registers.
+    virtual void visit(UnaryBoolExpr* ue) { }
+    virtual void visit(UnaryNum2BoolExpr* ue) { }
+    virtual void visit(BinaryBoolExpr* be) { }
+    virtual void visit(BinaryNum2BoolExpr* be) { }
+    virtual void visit(IfExpr* ie) {
+        ie->getExpr()->accept(this);
+    }
+
+    // The RHS is written to the grid after it is evaluated.
+    virtual void visit(EqualsExpr* ee) {
+        ee->getRhs()->accept(this);
+        useExpr(ee->getRhs().get());
+    }
+};
+
 #endif
@@ -39,6 +39,7 @@ StencilList stencils;
 
 // Misc headers.
 #include <fstream>
+#include <chrono>
 
 // output streams.
 ostream* printPseudo = NULL;
@@ -51,26 +52,42 @@ ostream* printCpp = NULL;
 ostream* printKncCpp = NULL;
 ostream* print512Cpp = NULL;
 ostream* print256Cpp = NULL;
+ostream* printGnuCpp = NULL;
+ostream* printReport = NULL;
 
 // other vars set via cmd-line options.
 int vlenForStats = 0;
+int vlenForAutoFold = 0;
 StencilBase* stencilFunc = NULL;
 string shapeName;
 IntTuple foldOptions;                     // vector fold.
 IntTuple clusterOptions;                  // cluster sizes.
 int maxExprSize = 50;
 int minExprSize = 2;
+int maxFmaChain = 4;
 int radius = 1;
 bool firstInner = true;
 bool allowUnalignedLoads = false;
 string eqGroupTargets;
+string fuseTargets;
 bool doFuse = false;
 bool doComb = false;
 bool doCse = true;
+bool doCsub = false;
+bool doSimp = true;
+bool fastMath = false;
+bool doContract = false;
 string stepDim = "t";
 int haloSize = 0;                     // 0 means auto.
 int stepAlloc = 0;                    // 0 means auto.
 bool find_deps = true;                // find dependencies between equations.
+bool doStats = false;                 // print time spent in each phase.
+int numVecRegs = 0;                   // 0 means auto.
+bool fitRegs = false;                 // shrink cluster to fit in registers.
+int fitLiveVecs = 0;                  // live vectors in fitted cluster.
+bool doRegOrder = false;              // reorder operands to need fewer registers.
+IntTuple reportBlock;                 // block size for -preport.
+int realBytes = 4;                    // FP size for -preport.
 string eq_group_basename_default = "stencil";
 
 ostream* open_file(const string& name) {
@@ -88,6 +105,48 @@ ostream* open_file(const string& name) {
     return ofs;
 }
 
+// Number of vector registers in the target ISA.
+int getNumVecRegs() {
+    if (numVecRegs > 0)
+        return numVecRegs;
+    return print256Cpp ? 16 : 32;
+}
+
+// Phase timing for -stats.
+// Each phase is the time since the end of the previous one, so
+// the phases don't overlap and add up to the total.
+typedef chrono::steady_clock PhaseClock;
+PhaseClock::time_point phaseStart = PhaseClock::now();
+vector<pair<string, double>> phaseTimes; // secs per phase in order seen.
+string phasePrefix;                      // prepended to phase names.
+
+// Add the time since the last call to phase 'name'.
+void endPhase(const string& name) {
+    auto now = PhaseClock::now();
+    double secs = chrono::duration<double>(now - phaseStart).count();
+    phaseStart = now;
+    string pname = phasePrefix + name;
+    for (auto& pt : phaseTimes) {
+        if (pt.first == pname) {
+            pt.second += secs;
+            return;
+        }
+    }
+    phaseTimes.push_back(make_pair(pname, secs));
+}
+
+// Print the phase times.
+void printPhaseTimes(ostream& os) {
+    double total = 0.0;
+    for (auto& pt : phaseTimes)
+        total += pt.second;
+    os << "Time spent in each phase:\n";
+    for (auto& pt : phaseTimes)
+        os << " " << pt.first << ": " << pt.second << " sec(s) (" <<
+            (total > 0.0 ? 100.0 * pt.second / total : 0.0) << "%)\n";
+    os << " total: " << total << " sec(s)\n";
+}
+
 void usage(const string& cmd) {
 
     cout << "Options:\n"
@@ -120,7 +179,6 @@ void usage(const string& cmd) {
         "      Example: '-eq a=foo,b=bar' creates one or more eq-groups with base-name 'a'\n"
         "        containing updates to grids whose name contains 'foo' and one or more eq-groups\n"
         "        with base-name 'b' containing updates to grids whose name contains 'bar'.\n"
-        //" [-no]-fuse         Do [not] pack grids together in meta container(s) (default=" << doFuse << ").\n"
         " -step <dim>\n"
         "    Specify stepping dimension <dim> (default='" << stepDim << "').\n"
         "      This is used for dependence calculation and memory allocation.\n"
@@ -130,6 +188,15 @@ void usage(const string& cmd) {
         " -halo <size>\n"
         "    Specify the sizes of the halos.\n"
         "      By default, halos are calculated automatically for each grid.\n"
+        " [-no]-fuse\n"
+        "    Do [not] interleave the vectors of grids with the same dimensions in\n"
+        "      one allocation, i.e., an array of structures of vectors (default=" << doFuse << ").\n"
+        "      Fused grids use the largest step-dimension allocation and halos among them.\n"
+        " -fuse-grids <name>=<substr>,...\n"
+        "    With -fuse, interleave only grids containing <substr>, and only with others\n"
+        "      matching the same <name>. By default, all grids with the same dimensions are fused.\n"
+        "      Example: '-fuse -fuse-grids v=vel,s=stress' fuses grids containing 'vel' and,\n"
+        "        separately, grids containing 'stress'.\n"
         " [-no]-lus\n"
         "    Make last [first] dimension of fold unit stride (default=" << (!firstInner) << ").\n"
         "      This controls the intra-vector memory layout.\n"
@@ -138,17 +205,61 @@ void usage(const string& cmd) {
         "      To use this correctly, only 1D folds are allowed, and\n"
         "        the memory layout used by YASK must have that same dimension in unit stride.\n"
         " [-no]-comb\n"
-        "    Do [not] combine commutative operations (default=" << doComb << ").\n"
+        "    Do [not] combine commutative operations in the vector code (default=" << doComb << ").\n"
+        " [-no]-simp\n"
+        "    Do [not] simplify expressions algebraically in the vector code, e.g., a*1 => a,\n"
+        "      a/4 => a*0.25, a + -b => a - b (default=" << doSimp << ").\n"
+        " [-no]-fast-math\n"
+        "    Do [not] also allow simplifications that can change the results, e.g.,\n"
+        "      a/3 => a*(1/3), a/p => a*(1/p) for invariant p, c*a + c*b => c*(a+b)\n"
+        "      (default=" << fastMath << ").\n"
         " [-no]-cse\n"
         "    Do [not] eliminate common subexpressions (default=" << doCse << ").\n"
+        " [-no]-csub\n"
+        "    Do [not] eliminate common subsets of commutative operands, e.g., a+b in a+b+c and a+b+d,\n"
+        "      when also eliminating common subexpressions (default=" << doCsub << ").\n"
+        "      This reassociates sums, so it is only applied to the vector code, and\n"
+        "      stencils w/large cancelling terms may no longer match the reference code.\n"
+        " -fma-chain <num-products>\n"
+        "    Split sums of more than <num-products> products into balanced sums of chains\n"
+        "      of at most <num-products> multiply-adds each, 0 to disable (default=" << maxFmaChain << ").\n"
+        "      Only applied to the vector code. The C++ vector printers emit each chain as a\n"
+        "        sequence of FMAs, which use FMA instructions when the target ISA has them,\n"
+        "        e.g., AVX2 and AVX-512. The scalar reference code uses plain multiply-adds.\n"
         " -max-es <num-nodes>\n"
         "    Set heuristic for max single expression-size (default=" << maxExprSize << ").\n"
         " -min-es <num-nodes>\n"
         "    Set heuristic for min expression-size for reuse (default=" << minExprSize << ").\n"
+        " -vregs <num>\n"
+        "    Set number of vector registers used to estimate spills, 0 for auto (default=" <<
+        numVecRegs << ").\n"
+        "      Auto is 16 with -p256 and 32 otherwise.\n"
+        " [-no]-reg-order\n"
+        "    Do [not] evaluate the operands of commutative operators that need the most\n"
+        "      registers first, Sethi-Ullman style, in vector code (default=" << doRegOrder << ").\n"
+        "      This changes the FP rounding of the vector code.\n"
+        " [-no]-fit-regs\n"
+        "    Do [not] shrink the cluster until the estimated number of live vectors fits\n"
+        "      in the vector registers (default=" << fitRegs << ").\n"
+        " [-no]-contract\n"
+        "    Do [not] replace grids that are written by one unconditional equation and read only\n"
+        "      at that same point by equations in the same equation-group with temporaries,\n"
+        "      removing the grids, when also finding dependencies (default=" << doContract << ").\n"
+        "      Both the reference and the vector code are then generated from the contracted\n"
+        "      equations, so the contracted grids are not validated separately.\n"
         " [-no]-find-deps\n"
         "    Automatically find dependencies between equations (default=" << find_deps << ").\n"
+        " -stats\n"
+        "    Print the time spent in each phase of code generation.\n"
         "\n"
         //" -ps <vec-len>         Print stats for all folding options for given vector length.\n"
+        " -auto-fold <vec-len>\n"
+        "    Try all folds of <vec-len> elements and, if -cluster is not specified, all clusters\n"
+        "      of up to 4 vectors. Print a ranked report and use the best fold and cluster.\n"
+        "      Candidates are ranked by the estimated number of vector operations per vector,\n"
+        "        including memory reads, constructions of unaligned vectors, FP operations,\n"
+        "        and spills, using the strategies for the target selected by\n"
+        "        -p512, -p256, -pknc, or -pgnu (AVX-512 if none).\n"
         " -pm <filename>\n"
         "    Print YASK pre-processor macros.\n"
         //" -pg <filename>        Print YASK grid classes.\n"
@@ -160,12 +271,22 @@ void usage(const string& cmd) {
         "    Print YASK stencil classes for CORE AVX-512 & MIC AVX-512 ISAs.\n"
         " -pknc <filename>\n"
         "    Print YASK stencil classes for KNC ISA.\n"
+        " -pgnu <filename>\n"
+        "    Print YASK stencil classes for GCC/Clang vector extensions.\n"
         " -ph <filename>\n"
         "    Print human-readable scalar pseudo-code for one point.\n"
         " -pdot-full <filename>\n"
         "    Print DOT-language description of stencil equation(s).\n"
         " -pdot-lite <filename>\n"
         "    Print DOT-language description of grid dependencies.\n"
+        " -preport <filename>\n"
+        "    Print JSON analysis of each equation-group, including FP operations,\n"
+        "      unique bytes accessed, and arithmetic intensity per point, halos,\n"
+        "      and aligned and constructed vectors per cluster.\n"
+        " -preport-block <dim>=<size>,...\n"
+        "    Set the block size used to count unique bytes for -preport (default=64 in each dim).\n"
+        " -real-bytes <num>\n"
+        "    Set the FP element size in bytes used for -preport (default=" << realBytes << ").\n"
         //" -pp <filename>        Print POV-Ray code.\n"
         "\n"
         "Examples:\n"
@@ -199,6 +320,16 @@ void parseOpts(int argc, const char* argv[])
                 allowUnalignedLoads = true;
             else if (opt == "-no-aul")
                 allowUnalignedLoads = false;
+            else if (opt == "-stats")
+                doStats = true;
+            else if (opt == "-reg-order")
+                doRegOrder = true;
+            else if (opt == "-no-reg-order")
+                doRegOrder = false;
+            else if (opt == "-fit-regs")
+                fitRegs = true;
+            else if (opt == "-no-fit-regs")
+                fitRegs = false;
             else if (opt == "-find-deps")
                 find_deps = true;
             else if (opt == "-no-find-deps")
@@ -211,6 +342,22 @@ void parseOpts(int argc, const char* argv[])
                 doCse = true;
             else if (opt == "-no-cse")
                 doCse = false;
+            else if (opt == "-simp")
+                doSimp = true;
+            else if (opt == "-no-simp")
+                doSimp = false;
+            else if (opt == "-fast-math")
+                fastMath = true;
+            else if (opt == "-no-fast-math")
+                fastMath = false;
+            else if (opt == "-contract")
+                doContract = true;
+            else if (opt == "-no-contract")
+                doContract = false;
+            else if (opt == "-csub")
+                doCsub = true;
+            else if (opt == "-no-csub")
+                doCsub = false;
             else if (opt == "-fuse")
                 doFuse = true;
             else if (opt == "-no-fuse")
@@ -235,7 +382,9 @@ void parseOpts(int argc, const char* argv[])
                     stepDim = argop;
                 else if (opt == "-eq")
                     eqGroupTargets = argop;
-                else if (opt == "-fold" || opt == "-cluster") {
+                else if (opt == "-fuse-grids")
+                    fuseTargets = argop;
+                else if (opt == "-fold" || opt == "-cluster" || opt == "-preport-block") {
 
                     // example: x=4,y=2
                     ArgParser ap;
@@ -246,8 +395,10 @@ void parseOpts(int argc, const char* argv[])
                             // set dim in tuple.
                             if (opt == "-fold")
                                 foldOptions.addDimBack(key, size);
-                            else
+                            else if (opt == "-cluster")
                                 clusterOptions.addDimBack(key, size);
+                            else
+                                reportBlock.addDimBack(key, size);
                         });
                 }
 
@@ -272,6 +423,10 @@ void parseOpts(int argc, const char* argv[])
                     print512Cpp = open_file(argop);
                 else if (opt == "-p256")
                     print256Cpp = open_file(argop);
+                else if (opt == "-pgnu")
+                    printGnuCpp = open_file(argop);
+                else if (opt == "-preport")
+                    printReport = open_file(argop);
             
                 // add any more options w/a string value above.
                 
@@ -284,17 +439,25 @@ void parseOpts(int argc, const char* argv[])
                         maxExprSize = val;
                     if (opt == "-min-es")
                         minExprSize = val;
+                    else if (opt == "-fma-chain")
+                        maxFmaChain = val;
 
                     else if (opt == "-r")
                         radius = val;
 
                     else if (opt == "-ps")
                         vlenForStats = val;
+                    else if (opt == "-auto-fold")
+                        vlenForAutoFold = val;
 
                     else if (opt == "-halo")
                         haloSize = val;
                     else if (opt == "-step-alloc")
                         stepAlloc = val;
+                    else if (opt == "-vregs")
+                        numVecRegs = val;
+                    else if (opt == "-real-bytes")
+                        realBytes = val;
 
                     // add any more options w/int values here.
 
@@ -339,38 +502,78 @@ void parseOpts(int argc, const char* argv[])
 }
 
 // Apply optimizations to eqGroups.
+// 'numPts' is the number of times each eq is replicated, e.g., the
+// number of vectors in a cluster.
+// If 'keepResults', only optimizations that don't change the FP results
+// are applied, e.g., for the reference code.
+// If 'findSubsets', common subsets of commutative operands are
+// eliminated.
 void optimizeEqGroups(EqGroups& eqGroups,
                       const string& descr,
+                      int numPts,
+                      bool keepResults,
+                      bool findSubsets,
                       bool printSets,
                       ostream& os) {
 
     // print stats.
+    // Callers end their own phase before calling this.
     string edescr = "for " + descr + " equation-group(s)";
     eqGroups.printStats(os, edescr);
+
+    // Count FP ops in the same way as printStats().
+    auto countOps = [&]() {
+        int numOps = 0;
+        for (auto& eg : eqGroups) {
+            CounterVisitor cv;
+            eg.visitEqs(&cv);
+            numOps += cv.getNumOps();
+        }
+        return numOps;
+    };
+    int numOps = countOps();
     
     // Make a list of optimizations to apply to eqGroups.
     vector<OptVisitor*> opts;
+    if (doSimp && !keepResults)
+        opts.push_back(new SimplifyVisitor(fastMath));
     if (doCse)
         opts.push_back(new CseVisitor);
-    if (doComb) {
+    if (doComb && !keepResults) {
         opts.push_back(new CombineVisitor);
         if (doCse)
             opts.push_back(new CseVisitor);
     }
+    if (findSubsets && doCse && doCsub)
+        opts.push_back(new CommonSubsetVisitor);
+    if (maxFmaChain > 0 && !keepResults)
+        opts.push_back(new FmaVisitor(maxFmaChain));
 
     // Apply opts.
     for (auto optimizer : opts) {
 
-        eqGroups.visitEqs(optimizer);
+        for (auto& eg : eqGroups) {
+            eg.visitEqs(optimizer);
+            optimizer->endGroup();
+        }
+        endPhase(descr + ": " + optimizer->getName());
         int numChanges = optimizer->getNumChanges();
         string odescr = "after applying " + optimizer->getName() + " to " +
             descr + " equation-group(s)";
 
         // Get new stats.
-        if (numChanges)
+        if (numChanges) {
             eqGroups.printStats(os, odescr);
+            int newNumOps = countOps();
+            if (newNumOps != numOps)
+                os << "  " << (double(numOps - newNumOps) / numPts) <<
+                    " FP math operation(s) saved per point." << endl;
+            numOps = newNumOps;
+        }
         else
             os << "No changes " << odescr << '.' << endl;
+        delete optimizer;
+        endPhase(descr + ": stats");
     }
 
     // Final stats per equation group.
@@ -379,6 +582,302 @@ void optimizeEqGroups(EqGroups& eqGroups,
         for (auto eg : eqGroups)
             eg.printStats(os, "for " + eg.getDescription());
     }
+    endPhase(descr + ": stats");
+}
+
+// Create the eq-groups for 'dims' in 'eqGroups' and optimize them. These
+// are used for the scalar and reference code. Then copy them to
+// 'clusterEqGroups', optimize the copies for the vector code, make copies
+// of all the equations at each cluster offset, and optimize those. This
+// is the sequence for the generated code, so the fold and cluster
+// searches also use it to make their estimates for the code that will
+// actually be generated.
+void makeEqGroups(Grids& grids, Dimensions& dims,
+                  EqGroups& eqGroups, EqGroups& clusterEqGroups,
+                  bool printSets, ostream& os) {
+    eqGroups.findEqGroups(grids, eqGroupTargets, dims._clusterPts, find_deps);
+    endPhase("creating equation-groups");
+    optimizeEqGroups(eqGroups, "scalar", 1, true, false, false, os);
+
+    // Simplification and common subsets are only applied to the vector
+    // code, because they can change the results, and the scalar code
+    // must stay a separate reference for validation. Common subsets are
+    // not searched for again across the cluster to save time.
+    clusterEqGroups = eqGroups;
+    clusterEqGroups.cloneEqs();
+    optimizeEqGroups(clusterEqGroups, "vector", 1, false, true, false, os);
+    os << "Constructing cluster of equations containing " <<
+        dims._clusterMults.product() << " vector(s)...\n";
+    clusterEqGroups.replicateEqsInCluster(dims);
+    endPhase("constructing clusters");
+    optimizeEqGroups(clusterEqGroups, "cluster", dims._clusterMults.product(),
+                     false, false, printSets, os);
+}
+
+// Make sure the cluster chosen by fitClusterToRegs() got the number
+// of live vectors it was fitted with in the generated code.
+void checkFitLiveVecs(YASKCppPrinter& printer) {
+    if (fitRegs && printer.getMaxLiveVecs() != fitLiveVecs) {
+        cerr << "Error: cluster was fitted to " << fitLiveVecs <<
+            " live vector(s), but the generated code has up to " <<
+            printer.getMaxLiveVecs() << ".\n";
+        exit(1);
+    }
+}
+
+// Estimated cost of one fold and cluster.
+struct FoldCost {
+    IntTuple fold, cluster;
+    int numVecs = 0;            // vectors per cluster.
+    int fpOps = 0;              // FP ops per cluster.
+    int numVars = 0;            // vector vars per cluster.
+    int spills = 0;             // live vectors exceeding registers.
+    VecOpCounts counts;         // vector ops per cluster.
+    double cost = 0.0;          // estimated ops per vector.
+};
+
+// Try all folds of 'vlen' elements and, if no cluster was specified,
+// clusters of up to 4 vectors. Return the best one in 'foldOptions' and
+// 'clusterOptions'.  Each candidate is scored by generating the vector
+// code with the intrinsic print helper and counting the resulting ops.
+void findBestFold(Grids& grids, int vlen, ostream& os) {
+    os << "Searching for best fold of " << vlen << " elements";
+    if (clusterOptions.size())
+        os << " with cluster " << clusterOptions.makeDimValStr(",");
+    os << "...\n";
+    phasePrefix = "auto-fold: ";
+
+    // Find dims that can be folded.
+    Dimensions baseDims;
+    ofstream nullos;            // null stream (unopened ofstream).
+    IntTuple noOpts;
+    baseDims.setDims(grids, stepDim, noOpts, noOpts, allowUnalignedLoads, nullos);
+    auto fdims = baseDims._fold.getDims();
+
+    // Find all folds whose sizes multiply to 'vlen'.
+    vector<IntTuple> folds;
+    function<void (size_t di, int rem, const IntTuple& fold)> addFolds =
+        [&](size_t di, int rem, const IntTuple& fold) {
+        if (di == fdims.size()) {
+            if (rem == 1)
+                folds.push_back(fold);
+            return;
+        }
+        for (int len = 1; len <= rem; len++) {
+            if (rem % len == 0) {
+                IntTuple fold2(fold);
+                fold2.addDimBack(fdims[di], len);
+                addFolds(di + 1, rem / len, fold2);
+            }
+        }
+    };
+    addFolds(0, vlen, IntTuple());
+
+    // Find all clusters of up to 4 vectors unless one was given.
+    vector<IntTuple> clusters;
+    if (clusterOptions.size())
+        clusters.push_back(clusterOptions);
+    else {
+        function<void (size_t di, int rem, const IntTuple& cluster)> addClusters =
+            [&](size_t di, int rem, const IntTuple& cluster) {
+            if (di == fdims.size()) {
+                clusters.push_back(cluster);
+                return;
+            }
+            for (int mult = 1; mult <= rem; mult *= 2) {
+                IntTuple cluster2(cluster);
+                cluster2.addDimBack(fdims[di], mult);
+                addClusters(di + 1, rem / mult, cluster2);
+            }
+        };
+        addClusters(0, 4, IntTuple());
+    }
+
+    // Number of vector registers in the target ISA.
+    int numRegs = getNumVecRegs();
+
+    // Evaluate each combination.
+    // Output from the stages of the compiler is discarded.
+    vector<FoldCost> costs;
+    streambuf* coutBuf = cout.rdbuf(nullos.rdbuf());
+    for (auto& fold : folds) {
+
+        // Unaligned loads only work with 1D folds.
+        int nfolded = 0;
+        for (auto* dim : fold.getDims())
+            if (fold.getVal(dim) > 1)
+                nfolded++;
+        if (allowUnalignedLoads && nfolded > 1)
+            continue;
+
+        for (auto& cluster : clusters) {
+            FoldCost fc;
+            fc.fold = fold;
+            fc.cluster = cluster;
+            fc.numVecs = cluster.product();
+
+            // Create the eq-groups and clusters as in main().
+            Dimensions dims;
+            IntTuple foldOpts(fold), clusterOpts(cluster);
+            dims.setDims(grids, stepDim, foldOpts, clusterOpts,
+                         allowUnalignedLoads, nullos);
+
+            // Skip clusters that main() would reject because two eqs
+            // update the same point.
+            EqualsExprPtr eq1, eq2;
+            BoolExprPtr cond;
+            if (find_deps &&
+                grids.findSamePtUpdates(dims._clusterPts, eq1, eq2, cond))
+                continue;
+
+            EqGroups eqGroups(eq_group_basename_default, dims);
+            EqGroups clusterEqGroups(eq_group_basename_default, dims);
+            makeEqGroups(grids, dims, eqGroups, clusterEqGroups, false, nullos);
+
+            // Generate vector code for each eq-group and count ops.
+            for (auto& ceq : clusterEqGroups) {
+                VecInfoVisitor vv(dims);
+                CounterVisitor cv;
+                map<Expr*, string> invariantVars;
+                vector<Expr*> invariantExprs;
+                int peak = YASKCppPrinter::prepVecCode(ceq, vv, cv, doRegOrder,
+                                                       allowUnalignedLoads,
+                                                       invariantVars, invariantExprs);
+                CppVecPrintHelper* vp = 0;
+                if (print256Cpp)
+                    vp = new CppAvx256PrintHelper(vv, allowUnalignedLoads, &cv,
+                                                  "temp_vec", "real_vec_t", " ", ";\n");
+                else if (printKncCpp)
+                    vp = new CppKncPrintHelper(vv, allowUnalignedLoads, &cv,
+                                               "temp_vec", "real_vec_t", " ", ";\n");
+                else if (printGnuCpp)
+                    vp = new CppGnuPrintHelper(vv, allowUnalignedLoads, &cv,
+                                               "temp_vec", "real_vec_t", " ", ";\n");
+                else
+                    vp = new CppAvx512PrintHelper(vv, allowUnalignedLoads, &cv,
+                                                  "temp_vec", "real_vec_t", " ", ";\n");
+                vp->setKnownExprs(invariantVars);
+                PrintVisitorBottomUp pcv(nullos, *vp, maxExprSize, minExprSize);
+                ceq.visitEqs(&pcv);
+
+                auto& oc = vp->getOpCounts();
+                fc.counts.alignedReads += oc.alignedReads;
+                fc.counts.unalignedReads += oc.unalignedReads;
+                fc.counts.unalignedCtors += oc.unalignedCtors;
+                fc.counts.aligns += oc.aligns;
+                fc.counts.perms += oc.perms;
+                fc.counts.perm2s += oc.perm2s;
+                fc.counts.elemCopies += oc.elemCopies;
+                fc.fpOps += cv.getNumOps();
+                fc.numVars += vp->getNumVars();
+                fc.spills += max(peak - numRegs, 0);
+                delete vp;
+            }
+            endPhase("counting vector ops");
+
+            // Estimate ops per vector. Each spill costs a store and a load.
+            auto& c = fc.counts;
+            int nops = fc.fpOps + c.alignedReads + c.unalignedReads +
+                c.aligns + c.perms + c.perm2s + c.elemCopies + 2 * fc.spills;
+            fc.cost = double(nops) / fc.numVecs;
+            costs.push_back(fc);
+        }
+    }
+    cout.rdbuf(coutBuf);
+    if (costs.size() == 0) {
+        cerr << "Error: no valid folds of " << vlen << " elements." << endl;
+        exit(1);
+    }
+
+    // Rank by cost.
+    stable_sort(costs.begin(), costs.end(),
+                [](const FoldCost& a, const FoldCost& b) { return a.cost < b.cost; });
+
+    // Print report.
+    // Counts are per vector, i.e., divided by number of vectors in the cluster.
+    const size_t maxReport = 20;
+    os << "Best fold and cluster choices (" << costs.size() << " tried, counts are per vector):\n"
+        " rank, fold, cluster, aligned reads, unaligned reads, unaligned ctors, aligns,"
+        " perms, perm2s, element copies, FP ops, vars, est spills, est ops\n";
+    for (size_t i = 0; i < costs.size() && i < maxReport; i++) {
+        auto& fc = costs[i];
+        auto& c = fc.counts;
+        double nv = fc.numVecs;
+        os << " " << (i + 1) <<
+            ", " << fc.fold.makeDimValStr("*") <<
+            ", " << fc.cluster.makeDimValStr("*") <<
+            ", " << (c.alignedReads / nv) <<
+            ", " << (c.unalignedReads / nv) <<
+            ", " << (c.unalignedCtors / nv) <<
+            ", " << (c.aligns / nv) <<
+            ", " << (c.perms / nv) <<
+            ", " << (c.perm2s / nv) <<
+            ", " << (c.elemCopies / nv) <<
+            ", " << (fc.fpOps / nv) <<
+            ", " << (fc.numVars / nv) <<
+            ", " << (fc.spills / nv) <<
+            ", " << fc.cost << endl;
+    }
+
+    // Use the best one.
+    auto& best = costs[0];
+    foldOptions = best.fold;
+    clusterOptions = best.cluster;
+    os << "Best choice: -fold " << foldOptions.makeDimValStr(",") <<
+        " -cluster " << clusterOptions.makeDimValStr(",") << endl;
+    endPhase("ranking");
+    phasePrefix = "";
+}
+
+// Halve the largest cluster multiplier until the estimated number of
+// live vectors in every eq-group fits in the vector registers or the
+// cluster is one vector. Return the result in 'clusterOptions'.
+void fitClusterToRegs(Grids& grids, ostream& os) {
+    int numRegs = getNumVecRegs();
+    os << "Fitting cluster to " << numRegs << " vector registers...\n";
+    ofstream nullos;            // null stream (unopened ofstream).
+    ostringstream report;       // printed after cout is restored.
+    streambuf* coutBuf = cout.rdbuf(nullos.rdbuf());
+    while (true) {
+
+        // Create the eq-groups and clusters as in main().
+        Dimensions dims;
+        IntTuple foldOpts(foldOptions), clusterOpts(clusterOptions);
+        dims.setDims(grids, stepDim, foldOpts, clusterOpts,
+                     allowUnalignedLoads, nullos);
+        EqGroups eqGroups(eq_group_basename_default, dims);
+        EqGroups clusterEqGroups(eq_group_basename_default, dims);
+        makeEqGroups(grids, dims, eqGroups, clusterEqGroups, false, nullos);
+
+        // Find the most live vectors in any eq-group as estimated
+        // when printing the code.
+        int peak = 0;
+        for (auto& ceq : clusterEqGroups) {
+            VecInfoVisitor vv(dims);
+            CounterVisitor cv;
+            map<Expr*, string> invariantVars;
+            vector<Expr*> invariantExprs;
+            peak = max(peak, YASKCppPrinter::prepVecCode(ceq, vv, cv, doRegOrder,
+                                                         allowUnalignedLoads,
+                                                         invariantVars, invariantExprs));
+        }
+        fitLiveVecs = peak;
+        report << " Cluster " << dims._clusterMults.makeDimValStr(" * ") <<
+            " has up to " << peak << " live vector(s).\n";
+        if (peak <= numRegs || dims._clusterMults.product() <= 1)
+            break;
+
+        // Halve the largest multiplier.
+        clusterOptions = dims._clusterMults;
+        const string* maxDim = 0;
+        for (auto* dim : clusterOptions.getDims())
+            if (!maxDim || clusterOptions.getVal(dim) > clusterOptions.getVal(maxDim))
+                maxDim = dim;
+        clusterOptions.setVal(maxDim, clusterOptions.getVal(maxDim) / 2);
+    }
+    cout.rdbuf(coutBuf);
+    os << report.str() <<
+        "Using -cluster " << clusterOptions.makeDimValStr(",") << endl;
 }
 
 // Main program.
@@ -390,6 +889,7 @@ int main(int argc, const char* argv[]) {
     
     // parse options.
     parseOpts(argc, argv);
+    endPhase("parsing options");
 
     // Set default fold ordering.
     IntTuple::setDefaultFirstInner(firstInner);
@@ -408,6 +908,45 @@ int main(int argc, const char* argv[]) {
     // Call the stencil 'define' method to create ASTs in grids.
     // All grid points will be relative to origin (0,0,...,0).
     stencilFunc->define(dims._allDims);
+    endPhase("defining stencil");
+
+    // Replace intermediate grids with temporaries.
+    // Do this before choosing a fold so the choice is based
+    // on the contracted equations.
+    if (doContract && find_deps) {
+        cout << "Looking for intermediate grid(s) to contract...\n";
+        EqGroups contractor(eq_group_basename_default, dims);
+        auto contracted = contractor.contractGrids(grids, eqGroupTargets, dims._scalar);
+        cout << " Contracted " << contracted.size() << " grid(s)";
+        string sep = ": ";
+        for (auto& gname : contracted) {
+            cout << sep << "'" << gname << "'";
+            sep = ", ";
+        }
+        cout << ".\n";
+        endPhase("contracting grids");
+    }
+
+    // Choose fold and cluster if requested, then set the final dims.
+    if (vlenForAutoFold > 0) {
+        findBestFold(grids, vlenForAutoFold, cout);
+        dims = Dimensions();
+        dims.setDims(grids, stepDim,
+                     foldOptions, clusterOptions,
+                     allowUnalignedLoads, cout);
+        endPhase("auto-fold: setting dims");
+    }
+
+    // Shrink the cluster if it needs more vector registers than the
+    // target has.
+    if (fitRegs) {
+        fitClusterToRegs(grids, cout);
+        dims = Dimensions();
+        dims.setDims(grids, stepDim,
+                     foldOptions, clusterOptions,
+                     allowUnalignedLoads, cout);
+        endPhase("fitting cluster to registers");
+    }
 
     // Check for illegal dependencies within equations for scalar size.
     if (find_deps) {
@@ -422,22 +961,17 @@ int main(int argc, const char* argv[]) {
             " If this fails, the fold dimensions are not compatible with all equations.\n";
         grids.checkDeps(dims._fold, dims._stepDim);
     }
+    endPhase("checking dependencies");
     
     // Check for illegal dependencies within equations for cluster size and
     // also create equation groups based on legal dependencies.
     cout << "Checking equation(s) with clusters of vectors...\n"
         " If this fails, the cluster dimensions are not compatible with all equations.\n";
-    EqGroups eqGroups(eq_group_basename_default, dims);
-    eqGroups.findEqGroups(grids, eqGroupTargets, dims._clusterPts, find_deps);
-    optimizeEqGroups(eqGroups, "scalar & vector", false, cout);
-
-    // Make copies of all the equations at each cluster offset.
+    // Also make copies of all the equations at each cluster offset.
     // We will use these for inter-cluster optimizations and code generation.
-    cout << "Constructing cluster of equations containing " <<
-        dims._clusterMults.product() << " vector(s)...\n";
-    EqGroups clusterEqGroups(eqGroups);
-    clusterEqGroups.replicateEqsInCluster(dims);
-    optimizeEqGroups(clusterEqGroups, "cluster", true, cout);
+    EqGroups eqGroups(eq_group_basename_default, dims);
+    EqGroups clusterEqGroups(eq_group_basename_default, dims);
+    makeEqGroups(grids, dims, eqGroups, clusterEqGroups, true, cout);
 
     ///// Print out above data based on -p* option(s).
     cout << "Generating requested output...\n";
@@ -447,6 +981,7 @@ int main(int argc, const char* argv[]) {
         PseudoPrinter printer(*stencilFunc, clusterEqGroups,
                               maxExprSize, minExprSize);
         printer.print(*printPseudo);
+        endPhase("printing pseudo-code");
     }
 
     // DOT output.
@@ -454,11 +989,13 @@ int main(int argc, const char* argv[]) {
         DOTPrinter printer(*stencilFunc, clusterEqGroups,
                            maxExprSize, minExprSize, false);
         printer.print(*printDOT);
+        endPhase("printing DOT");
     }
     if (printSimpleDOT) {
         DOTPrinter printer(*stencilFunc, clusterEqGroups,
                            maxExprSize, minExprSize, true);
         printer.print(*printSimpleDOT);
+        endPhase("printing DOT");
     }
 
     // POV-Ray output.
@@ -466,6 +1003,22 @@ int main(int argc, const char* argv[]) {
         POVRayPrinter printer(*stencilFunc, clusterEqGroups,
                               maxExprSize, minExprSize);
         printer.print(*printPOVRay);
+        endPhase("printing POV-Ray");
+    }
+
+    // Analysis report.
+    if (printReport) {
+
+        // Default block size in each domain dim.
+        IntTuple blockSize;
+        for (auto* dim : dims._scalar.getDims()) {
+            auto* p = reportBlock.lookup(dim);
+            blockSize.addDimBack(dim, (p && *p > 0) ? *p : 64);
+        }
+        ReportPrinter printer(*stencilFunc, eqGroups, clusterEqGroups,
+                              dims, blockSize, realBytes);
+        printer.print(*printReport);
+        endPhase("printing report");
     }
 
     // Settings for YASK.
@@ -473,6 +1026,10 @@ int main(int argc, const char* argv[]) {
     yaskSettings._allowUnalignedLoads = allowUnalignedLoads;
     yaskSettings._haloSize = haloSize;
     yaskSettings._stepAlloc = stepAlloc;
+    yaskSettings._doFuse = doFuse;
+    yaskSettings._fuseTargets = fuseTargets;
+    yaskSettings._numVecRegs = getNumVecRegs();
+    yaskSettings._doRegOrder = doRegOrder;
     yaskSettings._maxExprSize = maxExprSize;
     yaskSettings._minExprSize = minExprSize;
     
@@ -482,6 +1039,7 @@ int main(int argc, const char* argv[]) {
         YASKCppPrinter printer(*stencilFunc, eqGroups, clusterEqGroups,
                                dims, yaskSettings);
         printer.printGrids(*printGrids);
+        endPhase("printing grids");
     }
 
     // Print CPP macros.
@@ -489,6 +1047,7 @@ int main(int argc, const char* argv[]) {
         YASKCppPrinter printer(*stencilFunc, eqGroups, clusterEqGroups,
                                dims, yaskSettings);
         printer.printMacros(*printMacros);
+        endPhase("printing macros");
     }
     
     // Print YASK classes to update grids and/or prefetch.
@@ -496,21 +1055,36 @@ int main(int argc, const char* argv[]) {
         YASKCppPrinter printer(*stencilFunc, eqGroups, clusterEqGroups,
                                dims, yaskSettings);
         printer.printCode(*printCpp);
+        checkFitLiveVecs(printer);
+        endPhase("printing C++");
     }
     if (printKncCpp) {
         YASKKncPrinter printer(*stencilFunc, eqGroups, clusterEqGroups,
                                dims, yaskSettings);
         printer.printCode(*printKncCpp);
+        checkFitLiveVecs(printer);
+        endPhase("printing C++");
     }
     if (print512Cpp) {
         YASKAvx512Printer printer(*stencilFunc, eqGroups, clusterEqGroups,
                                   dims, yaskSettings);
         printer.printCode(*print512Cpp);
+        checkFitLiveVecs(printer);
+        endPhase("printing C++");
     }
     if (print256Cpp) {
         YASKAvx256Printer printer(*stencilFunc, eqGroups, clusterEqGroups,
                                   dims, yaskSettings);
         printer.printCode(*print256Cpp);
+        checkFitLiveVecs(printer);
+        endPhase("printing C++");
+    }
+    if (printGnuCpp) {
+        YASKGnuPrinter printer(*stencilFunc, eqGroups, clusterEqGroups,
+                               dims, yaskSettings);
+        printer.printCode(*printGnuCpp);
+        checkFitLiveVecs(printer);
+        endPhase("printing C++");
     }
 
     // TODO: re-enable this.
@@ -542,6 +1116,8 @@ int main(int argc, const char* argv[]) {
     }
 #endif
 
+    if (doStats)
+        printPhaseTimes(cout);
     cout << "YASK Stencil Compiler done.\n";
     return 0;
 }
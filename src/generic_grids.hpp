@@ -26,6 +26,7 @@ IN THE SOFTWARE.
 // Generic grids:
 // T: type stored in grid.
 // LayoutFn: class that transforms N dimensions to 1.
+// _stride: distance between consecutive elements in units of T.
 
 #ifndef GENERIC_GRIDS
 #define GENERIC_GRIDS
@@ -69,7 +70,7 @@ namespace yask {
         // programmer should call get_num_elems() or get_num_bytes() and
         // then provide allocated memory via set_storage().
         virtual void default_alloc() {
-            size_t sz = get_num_bytes();
+            size_t sz = get_num_bytes() * get_stride();
             int ret = posix_memalign((void **)&_elems, _def_alignment, sz);
             if (ret) {
                 std::cerr << "error: cannot allocate " << sz << " bytes." << std::endl;
@@ -91,15 +92,19 @@ namespace yask {
             os << "'" << name << "' data is at " << _elems << ", containing " <<
                 printWithPow10Multiplier(get_num_elems()) << " element(s) of " <<
                 sizeof(T) << " byte(s) each = " <<
-                printWithPow2Multiplier(get_num_bytes()) << " bytes.\n";
+                printWithPow2Multiplier(get_num_bytes()) << " bytes";
+            if (get_stride() > 1)
+                os << ", interleaved with " << (get_stride() - 1) << " other grid(s)";
+            os << ".\n";
         }
 
         // Initialize memory to a given value.
         virtual void set_same(T val) {
+            idx_t stride = get_stride();
 
 #pragma omp parallel for
             for (idx_t ai = 0; ai < get_num_elems(); ai++)
-                _elems[ai] = val;
+                _elems[ai * stride] = val;
         }
 
         // Initialize memory: first element to value,
@@ -107,12 +112,13 @@ namespace yask {
         // occasionally to avoid large numbers.
         virtual void set_diff(T val) {
             const idx_t wrap = 71; // prime number is good to use.
+            idx_t stride = get_stride();
 
             //cout << "set_diff(" << val << "): ";
         
 #pragma omp parallel for
             for (idx_t ai = 0; ai < get_num_elems(); ai++)
-                _elems[ai] = val * T(ai % wrap + 1);
+                _elems[ai * stride] = val * T(ai % wrap + 1);
 
             //cout << "_elems[0] = " << _elems[0] << std::endl;
         }
@@ -121,11 +127,13 @@ namespace yask {
         // Return number of mismatches greater than epsilon.
         virtual idx_t count_diffs(const GenericGridBase<T>& ref, T epsilon) const {
             idx_t errs = 0;
+            idx_t stride = get_stride(), ref_stride = ref.get_stride();
 
             // Count abs diffs > epsilon.
 #pragma omp parallel for reduction(+:errs)
             for (idx_t ai = 0; ai < get_num_elems(); ai++) {
-                if (!within_tolerance(_elems[ai], ref._elems[ai], epsilon))
+                if (!within_tolerance(_elems[ai * stride],
+                                      ref._elems[ai * ref_stride], epsilon))
                     errs++;
             }
 
@@ -146,9 +154,17 @@ namespace yask {
             return _elems;
         }
 
+        // Get distance between elements in units of T.  Greater than one
+        // when elements of several grids are interleaved in the same
+        // storage.
+        virtual idx_t get_stride() const {
+            return 1;
+        }
+
         // Set pointer to storage.
         // Free old storage if it was allocated in ctor.
-        // 'buf' should provide get_num_bytes() bytes at offset bytes.
+        // 'buf' should provide get_num_bytes() * get_stride() bytes at
+        // offset bytes.
         void set_storage(void* buf, size_t offset) {
             if (_elems && _do_free) {
                 free(_elems);
@@ -224,7 +240,7 @@ namespace yask {
     // A generic 1D grid (array) of elements of type T.
     // The LayoutFn class must provide a 1:1 transform between
     // 1D and 1D indices (usually trivial).
-    template <typename T, typename LayoutFn> class GenericGrid1d :
+    template <typename T, typename LayoutFn, idx_t _stride = 1> class GenericGrid1d :
         public GenericGridBase<T> {
     protected:
         LayoutFn _layout;
@@ -247,6 +263,11 @@ namespace yask {
             return _layout.get_size();
         }
 
+        // Get distance between elements in units of T.
+        virtual idx_t get_stride() const {
+            return _stride;
+        }
+
         // Print some info.
         virtual void print_info(const std::string& name, std::ostream& os) {
             os << "1D (" << get_d1() << ") ";
@@ -267,12 +288,12 @@ namespace yask {
 
         // Access element.
         inline const T& operator()(idx_t i, bool check=true) const {
-            return this->_elems[get_index(i, check)];
+            return this->_elems[get_index(i, check) * _stride];
         }
 
         // Non-const version.
         inline T& operator()(idx_t i, bool check=true) {
-            return this->_elems[get_index(i, check)];
+            return this->_elems[get_index(i, check) * _stride];
         }
 
         // Check for equality.
@@ -318,7 +339,7 @@ namespace yask {
     // A generic 2D grid of elements of type T.
     // The LayoutFn class must provide a 1:1 transform between
     // 2D and 1D indices.
-    template <typename T, typename LayoutFn> class GenericGrid2d :
+    template <typename T, typename LayoutFn, idx_t _stride = 1> class GenericGrid2d :
         public GenericGridBase<T> {
     protected:
         LayoutFn _layout;
@@ -343,6 +364,11 @@ namespace yask {
             return _layout.get_size();
         }
 
+        // Get distance between elements in units of T.
+        virtual idx_t get_stride() const {
+            return _stride;
+        }
+
         // Print some info.
         virtual void print_info(const std::string& name, std::ostream& os) {
             os << "2D (" << get_d1() << " * " << get_d2() << ") ";
@@ -365,12 +391,12 @@ namespace yask {
 
         // Access element given 2D indices.
         inline const T& operator()(idx_t i, idx_t j, bool check=true) const {
-            return this->_elems[get_index(i, j, check)];
+            return this->_elems[get_index(i, j, check) * _stride];
         }
 
         // Non-const version.
         inline T& operator()(idx_t i, idx_t j, bool check=true) {
-            return this->_elems[get_index(i, j, check)];
+            return this->_elems[get_index(i, j, check) * _stride];
         }
 
         // Check for equality.
@@ -419,7 +445,7 @@ namespace yask {
     // A generic 3D grid of elements of type T.
     // The LayoutFn class must provide a 1:1 transform between
     // 3D and 1D indices.
-    template <typename T, typename LayoutFn> class GenericGrid3d :
+    template <typename T, typename LayoutFn, idx_t _stride = 1> class GenericGrid3d :
         public GenericGridBase<T> {
     protected:
         LayoutFn _layout;
@@ -446,6 +472,11 @@ namespace yask {
             return _layout.get_size();
         }
 
+        // Get distance between elements in units of T.
+        virtual idx_t get_stride() const {
+            return _stride;
+        }
+
         // Print some info.
         virtual void print_info(const std::string& name, std::ostream& os) {
             os << "3D (" << get_d1() << " * " << get_d2() << " * " << get_d3() << ") ";
@@ -470,12 +501,12 @@ namespace yask {
 
         // Access element given 3D indices.
         inline const T& operator()(idx_t i, idx_t j, idx_t k, bool check=true) const {
-            return this->_elems[get_index(i, j, k, check)];
+            return this->_elems[get_index(i, j, k, check) * _stride];
         }
 
         // Non-const version.
         inline T& operator()(idx_t i, idx_t j, idx_t k, bool check=true) {
-            return this->_elems[get_index(i, j, k, check)];
+            return this->_elems[get_index(i, j, k, check) * _stride];
         }
 
         // Check for equality.
@@ -526,7 +557,7 @@ namespace yask {
     // A generic 4D grid of elements of type T.
     // The LayoutFn class must provide a 1:1 transform between
     // 4D and 1D indices.
-    template <typename T, typename LayoutFn> class GenericGrid4d :
+    template <typename T, typename LayoutFn, idx_t _stride = 1> class GenericGrid4d :
         public GenericGridBase<T> {
     protected:
         LayoutFn _layout;
@@ -555,6 +586,11 @@ namespace yask {
             return _layout.get_size();
         }
 
+        // Get distance between elements in units of T.
+        virtual idx_t get_stride() const {
+            return _stride;
+        }
+
         // Print some info.
         virtual void print_info(const std::string& name, std::ostream& os) {
             os << "4D (" << get_d1() << " * " << get_d2() << " * " << get_d3() << " * " << get_d4() << ") ";
@@ -581,12 +617,12 @@ namespace yask {
 
         // Access element given 4D indices.
         inline const T& operator()(idx_t i, idx_t j, idx_t k, idx_t l, bool check=true) const {
-            return this->_elems[get_index(i, j, k, l, check)];
+            return this->_elems[get_index(i, j, k, l, check) * _stride];
         }
 
         // Non-const version.
         inline T& operator()(idx_t i, idx_t j, idx_t k, idx_t l, bool check=true) {
-            return this->_elems[get_index(i, j, k, l, check)];
+            return this->_elems[get_index(i, j, k, l, check) * _stride];
         }
 
         // Check for equality.
@@ -640,7 +676,7 @@ namespace yask {
     // A generic 5D grid of elements of type T.
     // The LayoutFn class must provide a 1:1 transform between
     // 5D and 1D indices.
-    template <typename T, typename LayoutFn> class GenericGrid5d :
+    template <typename T, typename LayoutFn, idx_t _stride = 1> class GenericGrid5d :
         public GenericGridBase<T> {
     protected:
         LayoutFn _layout;
@@ -671,6 +707,11 @@ namespace yask {
             return _layout.get_size();
         }
 
+        // Get distance between elements in units of T.
+        virtual idx_t get_stride() const {
+            return _stride;
+        }
+
         // Print some info.
         virtual void print_info(const std::string& name, std::ostream& os) {
             os << "5D (" << get_d1() << " * " << get_d2() << " * " <<
@@ -702,13 +743,13 @@ namespace yask {
         // Access element given 5D indices.
         inline const T& operator()(idx_t i, idx_t j, idx_t k, idx_t l, idx_t m,
                                    bool check=true) const {
-            return this->_elems[get_index(i, j, k, l, m, check)];
+            return this->_elems[get_index(i, j, k, l, m, check) * _stride];
         }
 
         // Non-const version.
         inline T& operator()(idx_t i, idx_t j, idx_t k, idx_t l, idx_t m,
                              bool check=true) {
-            return this->_elems[get_index(i, j, k, l, m, check)];
+            return this->_elems[get_index(i, j, k, l, m, check) * _stride];
         }
 
         // Check for equality.
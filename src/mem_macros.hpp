@@ -71,4 +71,57 @@ IN THE SOFTWARE.
 #define PFDL2 2
 #endif
 
+////// Prefetch distances computed from each grid's footprint.
+// The stencil compiler counts the aligned vectors of each grid on the
+// leading edge of each eq-group for one cluster step in each direction.
+// A step takes about (edge bytes / bytes per cycle) cycles to stream in
+// that grid, so the distance for each cache is the number of steps
+// needed to cover its fill latency, i.e., latency * bytes per cycle /
+// the grid's edge bytes, rounded up. For L1, the latency and bandwidth
+// are those of L2 hits; for L2, those of memory accesses from one core.
+// These distances replace PFDL1 and PFDL2 in the directional prefetches
+// if USE_AUTO_PFD is set. The Makefile sets the latencies and bandwidths
+// for each arch; the defaults below are only placeholders.
+
+#ifndef PF_L1_LATENCY
+#define PF_L1_LATENCY 16            // cycles.
+#endif
+#ifndef PF_L1_BYTES_PER_CYCLE
+#define PF_L1_BYTES_PER_CYCLE 32
+#endif
+#ifndef PF_L2_LATENCY
+#define PF_L2_LATENCY 300           // cycles.
+#endif
+#ifndef PF_L2_BYTES_PER_CYCLE
+#define PF_L2_BYTES_PER_CYCLE 8
+#endif
+
+// Bytes read in one step with 'nvecs' aligned vectors on the edge, at
+// least one byte.
+#define PF_STEP_BYTES(nvecs) ((nvecs) > 0 ? (nvecs) * VLEN * REAL_BYTES : 1)
+
+// Steps needed to cover 'latency' cycles at 'bpc' bytes per cycle.
+#define PF_STEPS_(latency, bpc, nvecs) \
+    (((latency) * (bpc) + PF_STEP_BYTES(nvecs) - 1) / PF_STEP_BYTES(nvecs))
+
+// Distances for 'nvecs' aligned vectors per step.
+// The L2 distance is always greater than the L1 one.
+// Nothing new is read in a direction w/o any vectors on its edge, so
+// the manual distances are used for it.
+#define AUTO_PFDL1_(nvecs) PF_STEPS_(PF_L1_LATENCY, PF_L1_BYTES_PER_CYCLE, nvecs)
+#define AUTO_PFDL2_(nvecs) PF_STEPS_(PF_L2_LATENCY, PF_L2_BYTES_PER_CYCLE, nvecs)
+#define AUTO_PFDL1(nvecs) ((nvecs) > 0 ? AUTO_PFDL1_(nvecs) : PFDL1)
+#define AUTO_PFDL2(nvecs) ((nvecs) > 0 ? \
+                           ((AUTO_PFDL2_(nvecs) > AUTO_PFDL1_(nvecs)) ? \
+                            AUTO_PFDL2_(nvecs) : (AUTO_PFDL1_(nvecs) + 1)) : PFDL2)
+
+// Steps to add to a prefetch index computed w/PFDL1 or PFDL2 to get one
+// computed w/'pfd_l1' or 'pfd_l2' for the given cache 'level'.
+#ifdef USE_AUTO_PFD
+#define PFD_SHIFT(level, pfd_l1, pfd_l2) \
+    (((level) == L1) ? ((pfd_l1) - PFDL1) : ((pfd_l2) - PFDL2))
+#else
+#define PFD_SHIFT(level, pfd_l1, pfd_l2) (0)
+#endif
+
 #endif
@@ -0,0 +1,484 @@
+/*****************************************************************************
+
+YASK: Yet Another Stencil Kernel
+Copyright (c) 2014-2017, Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+* The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+IN THE SOFTWARE.
+
+*****************************************************************************/
+
+// In-process MPI emulator. See mpi_emu.hpp.
+
+#include "stencil.hpp"
+
+#ifdef USE_MPI_EMU
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <tuple>
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+    // A communicator, which is also used as its own group.
+    struct EmuComm {
+        vector<int> world_ranks; // world rank of each rank in this comm.
+
+        // State for collectives.
+        mutex mtx;
+        condition_variable cv;
+        int num_waiting = 0;
+        size_t generation = 0;
+        vector<vector<char>> slots; // data from each rank.
+
+        EmuComm(const vector<int>& wr) :
+            world_ranks(wr), slots(wr.size()) { }
+
+        int size() const { return int(world_ranks.size()); }
+    };
+
+    // A shared-memory window.
+    struct EmuWin {
+        MPI_Comm comm;
+        vector<void*> segs;      // segment of each rank.
+        vector<MPI_Aint> sizes;  // size of each segment.
+        vector<int> disp_units;
+    };
+
+    // Key for a message queue: comm, dest, source, tag.
+    typedef tuple<int, int, int, int> MsgKey;
+
+    // State shared by all ranks.
+    struct EmuState {
+        int num_ranks = 1;
+        mutex mtx;              // protects everything below.
+        condition_variable msg_cv;
+        vector<unique_ptr<EmuComm>> comms;
+        vector<unique_ptr<EmuWin>> wins; // [0] is unused.
+        map<MsgKey, deque<vector<char>>> mail;
+    };
+    EmuState* state = 0;
+
+    // World rank of the calling thread or -1 if not a rank.
+    thread_local int my_world_rank = -1;
+    thread_local bool is_initialized = false;
+
+    EmuComm& get_comm(MPI_Comm comm) {
+        lock_guard<mutex> lock(state->mtx);
+        assert(comm >= 0 && size_t(comm) < state->comms.size());
+        assert(state->comms[comm]);
+        return *state->comms[comm];
+    }
+    EmuWin& get_win(MPI_Win win) {
+        lock_guard<mutex> lock(state->mtx);
+        assert(win > 0 && size_t(win) < state->wins.size());
+        assert(state->wins[win]);
+        return *state->wins[win];
+    }
+
+    // Rank of caller in 'c'.
+    int comm_rank(const EmuComm& c) {
+        auto it = find(c.world_ranks.begin(), c.world_ranks.end(), my_world_rank);
+        assert(it != c.world_ranks.end());
+        return int(it - c.world_ranks.begin());
+    }
+
+    size_t type_size(MPI_Datatype datatype) {
+        switch (datatype) {
+        case MPI_BYTE: return 1;
+        case MPI_INT: return sizeof(int);
+        case MPI_INTEGER8: return sizeof(int64_t);
+        case MPI_FLOAT: return sizeof(float);
+        case MPI_DOUBLE: return sizeof(double);
+        }
+        cerr << "error: MPI emulator: unsupported datatype " << datatype << endl;
+        exit(1);
+    }
+
+    void barrier(EmuComm& c) {
+        unique_lock<mutex> lock(c.mtx);
+        size_t gen = c.generation;
+        if (++c.num_waiting == c.size()) {
+            c.num_waiting = 0;
+            c.generation++;
+            c.cv.notify_all();
+        }
+        else
+            c.cv.wait(lock, [&]{ return c.generation != gen; });
+    }
+
+    // Gather 'nbytes' from each rank into 'recvbuf' on all ranks.
+    void allgather(EmuComm& c, const void* sendbuf, size_t nbytes, void* recvbuf) {
+        int me = comm_rank(c);
+        const char* sp = (const char*)sendbuf;
+        c.slots[me].assign(sp, sp + nbytes);
+        barrier(c);
+        for (int i = 0; i < c.size(); i++)
+            memcpy((char*)recvbuf + i * nbytes, c.slots[i].data(), nbytes);
+
+        // Don't allow slots to be reused until all ranks have read them.
+        barrier(c);
+    }
+
+    // Reduce 'count' elements from each rank in 'all' into 'recvbuf'.
+    // Every rank reduces in the same order, so results are identical.
+    template <typename T>
+    void reduce(const char* all, int nranks, void* recvbuf, int count, MPI_Op op) {
+        T* res = (T*)recvbuf;
+        const T* src = (const T*)all;
+        for (int j = 0; j < count; j++) {
+            T val = src[j];
+            for (int i = 1; i < nranks; i++) {
+                T v = src[i * count + j];
+                switch (op) {
+                case MPI_SUM: val += v; break;
+                case MPI_MIN: val = min(val, v); break;
+                case MPI_MAX: val = max(val, v); break;
+                default:
+                    cerr << "error: MPI emulator: unsupported op " << op << endl;
+                    exit(1);
+                }
+            }
+            res[j] = val;
+        }
+    }
+}
+
+struct MPI_Emu_Request {
+    void* buf;
+    size_t nbytes;
+    MsgKey key;
+};
+
+int MPI_Emu_run(int (*main_fn)(int argc, char** argv), int argc, char** argv)
+{
+    int nranks = 1;
+    const char* nrs = getenv("YASK_EMU_RANKS");
+    if (nrs)
+        nranks = atoi(nrs);
+    if (nranks < 1) {
+        cerr << "error: YASK_EMU_RANKS must be a positive integer.\n";
+        exit(1);
+    }
+    int nthreads = max(omp_get_max_threads() / nranks, 1);
+    cout << "Emulating " << nranks << " MPI rank(s) with " << nthreads <<
+        " OpenMP thread(s) each.\n" << flush;
+
+    EmuState st;
+    st.num_ranks = nranks;
+    vector<int> world(nranks);
+    for (int i = 0; i < nranks; i++)
+        world[i] = i;
+    st.comms.emplace_back(new EmuComm(world)); // MPI_COMM_WORLD.
+    st.wins.emplace_back();                     // MPI_WIN_NULL.
+    state = &st;
+
+    // Each rank gets its own thread and OpenMP team.
+    vector<int> rcs(nranks, 0);
+    vector<thread> threads;
+    for (int i = 0; i < nranks; i++)
+        threads.emplace_back([&, i]() {
+                my_world_rank = i;
+                omp_set_num_threads(nthreads);
+                rcs[i] = main_fn(argc, argv);
+            });
+    for (auto& t : threads)
+        t.join();
+    state = 0;
+    return *max_element(rcs.begin(), rcs.end());
+}
+
+int MPI_Init_thread(int* argc, char*** argv, int required, int* provided) {
+    if (!state || my_world_rank < 0) {
+        cerr << "error: MPI emulator: MPI_Init_thread() called outside of MPI_Emu_run().\n";
+        exit(1);
+    }
+    is_initialized = true;
+    *provided = MPI_THREAD_MULTIPLE;
+    return MPI_SUCCESS;
+}
+int MPI_Initialized(int* flag) {
+    *flag = is_initialized;
+    return MPI_SUCCESS;
+}
+int MPI_Finalize() {
+    barrier(get_comm(MPI_COMM_WORLD));
+    is_initialized = false;
+    return MPI_SUCCESS;
+}
+int MPI_Abort(MPI_Comm comm, int errorcode) {
+    cout << flush;
+    cerr << flush;
+    exit(errorcode);
+}
+
+int MPI_Comm_rank(MPI_Comm comm, int* rank) {
+    *rank = comm_rank(get_comm(comm));
+    return MPI_SUCCESS;
+}
+int MPI_Comm_size(MPI_Comm comm, int* size) {
+    *size = get_comm(comm).size();
+    return MPI_SUCCESS;
+}
+
+// All emulated ranks share memory, so the new comm contains
+// all the ranks of 'comm', ordered by 'key'.
+int MPI_Comm_split_type(MPI_Comm comm, int split_type, int key,
+                        MPI_Info info, MPI_Comm* newcomm) {
+    EmuComm& c = get_comm(comm);
+    int nr = c.size();
+    int mine[2] = { key, my_world_rank };
+    vector<int> all(2 * nr);
+    allgather(c, mine, sizeof(mine), all.data());
+
+    // First rank makes the new comm.
+    int id = 0;
+    if (comm_rank(c) == 0) {
+        vector<pair<int, int>> keys;
+        for (int i = 0; i < nr; i++)
+            keys.push_back(make_pair(all[2 * i], all[2 * i + 1]));
+        stable_sort(keys.begin(), keys.end());
+        vector<int> wr;
+        for (auto& k : keys)
+            wr.push_back(k.second);
+        lock_guard<mutex> lock(state->mtx);
+        id = int(state->comms.size());
+        state->comms.emplace_back(new EmuComm(wr));
+    }
+    MPI_Bcast(&id, 1, MPI_INT, 0, comm);
+    *newcomm = id;
+    return MPI_SUCCESS;
+}
+int MPI_Comm_group(MPI_Comm comm, MPI_Group* group) {
+    *group = comm;
+    return MPI_SUCCESS;
+}
+int MPI_Group_translate_ranks(MPI_Group group1, int n, const int ranks1[],
+                              MPI_Group group2, int ranks2[]) {
+    EmuComm& c1 = get_comm(group1);
+    EmuComm& c2 = get_comm(group2);
+    for (int i = 0; i < n; i++) {
+        int wr = c1.world_ranks[ranks1[i]];
+        auto it = find(c2.world_ranks.begin(), c2.world_ranks.end(), wr);
+        ranks2[i] = (it == c2.world_ranks.end()) ? MPI_UNDEFINED :
+            int(it - c2.world_ranks.begin());
+    }
+    return MPI_SUCCESS;
+}
+int MPI_Group_free(MPI_Group* group) {
+    *group = MPI_GROUP_NULL;
+    return MPI_SUCCESS;
+}
+
+int MPI_Barrier(MPI_Comm comm) {
+    barrier(get_comm(comm));
+    return MPI_SUCCESS;
+}
+int MPI_Bcast(void* buffer, int count, MPI_Datatype datatype,
+              int root, MPI_Comm comm) {
+    EmuComm& c = get_comm(comm);
+    size_t nbytes = count * type_size(datatype);
+    if (comm_rank(c) == root) {
+        const char* bp = (const char*)buffer;
+        c.slots[root].assign(bp, bp + nbytes);
+    }
+    barrier(c);
+    if (comm_rank(c) != root)
+        memcpy(buffer, c.slots[root].data(), nbytes);
+    barrier(c);
+    return MPI_SUCCESS;
+}
+int MPI_Allgather(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                  void* recvbuf, int recvcount, MPI_Datatype recvtype,
+                  MPI_Comm comm) {
+    size_t nbytes = sendcount * type_size(sendtype);
+    assert(nbytes == recvcount * type_size(recvtype));
+    allgather(get_comm(comm), sendbuf, nbytes, recvbuf);
+    return MPI_SUCCESS;
+}
+int MPI_Allreduce(const void* sendbuf, void* recvbuf, int count,
+                  MPI_Datatype datatype, MPI_Op op, MPI_Comm comm) {
+    EmuComm& c = get_comm(comm);
+    size_t nbytes = count * type_size(datatype);
+    vector<char> all(nbytes * c.size());
+    allgather(c, sendbuf == MPI_IN_PLACE ? recvbuf : sendbuf, nbytes, all.data());
+    switch (datatype) {
+    case MPI_INT: reduce<int>(all.data(), c.size(), recvbuf, count, op); break;
+    case MPI_INTEGER8: reduce<int64_t>(all.data(), c.size(), recvbuf, count, op); break;
+    case MPI_FLOAT: reduce<float>(all.data(), c.size(), recvbuf, count, op); break;
+    case MPI_DOUBLE: reduce<double>(all.data(), c.size(), recvbuf, count, op); break;
+    default:
+        cerr << "error: MPI emulator: cannot reduce datatype " << datatype << endl;
+        exit(1);
+    }
+    return MPI_SUCCESS;
+}
+
+int MPI_Isend(const void* buf, int count, MPI_Datatype datatype, int dest,
+              int tag, MPI_Comm comm, MPI_Request* request) {
+    *request = MPI_REQUEST_NULL;
+    if (dest == MPI_PROC_NULL)
+        return MPI_SUCCESS;
+    EmuComm& c = get_comm(comm);
+    size_t nbytes = count * type_size(datatype);
+    const char* bp = (const char*)buf;
+    MsgKey key(comm, dest, comm_rank(c), tag);
+    {
+        lock_guard<mutex> lock(state->mtx);
+        state->mail[key].emplace_back(bp, bp + nbytes);
+    }
+    state->msg_cv.notify_all();
+    return MPI_SUCCESS;
+}
+int MPI_Irecv(void* buf, int count, MPI_Datatype datatype, int source,
+              int tag, MPI_Comm comm, MPI_Request* request) {
+    *request = MPI_REQUEST_NULL;
+    if (source == MPI_PROC_NULL)
+        return MPI_SUCCESS;
+    EmuComm& c = get_comm(comm);
+    *request = new MPI_Emu_Request { buf, count * type_size(datatype),
+                                     MsgKey(comm, comm_rank(c), source, tag) };
+    return MPI_SUCCESS;
+}
+int MPI_Wait(MPI_Request* request, MPI_Status* status) {
+    MPI_Emu_Request* req = *request;
+    if (!req)
+        return MPI_SUCCESS;
+
+    // Wait for a matching message.
+    vector<char> msg;
+    {
+        unique_lock<mutex> lock(state->mtx);
+        auto& q = state->mail[req->key];
+        state->msg_cv.wait(lock, [&]{ return !q.empty(); });
+        msg.swap(q.front());
+        q.pop_front();
+    }
+    if (msg.size() > req->nbytes) {
+        cerr << "error: MPI emulator: message of " << msg.size() <<
+            " bytes truncated to " << req->nbytes << " bytes.\n";
+        exit(1);
+    }
+    memcpy(req->buf, msg.data(), msg.size());
+    if (status) {
+        status->MPI_SOURCE = get<2>(req->key);
+        status->MPI_TAG = get<3>(req->key);
+        status->MPI_ERROR = MPI_SUCCESS;
+    }
+    delete req;
+    *request = MPI_REQUEST_NULL;
+    return MPI_SUCCESS;
+}
+int MPI_Waitall(int count, MPI_Request requests[], MPI_Status statuses[]) {
+    for (int i = 0; i < count; i++)
+        MPI_Wait(&requests[i], statuses ? &statuses[i] : MPI_STATUS_IGNORE);
+    return MPI_SUCCESS;
+}
+
+int MPI_Info_create(MPI_Info* info) {
+    *info = MPI_INFO_NULL;
+    return MPI_SUCCESS;
+}
+int MPI_Info_set(MPI_Info info, const char* key, const char* value) {
+    return MPI_SUCCESS;
+}
+int MPI_Info_free(MPI_Info* info) {
+    *info = MPI_INFO_NULL;
+    return MPI_SUCCESS;
+}
+
+// Each rank allocates its own segment, and all segments are
+// visible to all ranks because they are in the same process.
+int MPI_Win_allocate_shared(MPI_Aint size, int disp_unit, MPI_Info info,
+                            MPI_Comm comm, void* baseptr, MPI_Win* win) {
+    EmuComm& c = get_comm(comm);
+    void* seg = 0;
+    if (size > 0 && posix_memalign(&seg, CACHELINE_BYTES, size))
+        seg = 0;
+    *(void**)baseptr = seg;
+
+    struct SegInfo {
+        void* seg;
+        MPI_Aint size;
+        int disp_unit;
+    } mine = { seg, size, disp_unit };
+    vector<SegInfo> all(c.size());
+    allgather(c, &mine, sizeof(mine), all.data());
+
+    // First rank makes the window.
+    int id = 0;
+    if (comm_rank(c) == 0) {
+        EmuWin* w = new EmuWin;
+        w->comm = comm;
+        for (int i = 0; i < c.size(); i++) {
+            w->segs.push_back(all[i].seg);
+            w->sizes.push_back(all[i].size);
+            w->disp_units.push_back(all[i].disp_unit);
+        }
+        lock_guard<mutex> lock(state->mtx);
+        id = int(state->wins.size());
+        state->wins.emplace_back(w);
+    }
+    MPI_Bcast(&id, 1, MPI_INT, 0, comm);
+    *win = id;
+    return MPI_SUCCESS;
+}
+int MPI_Win_shared_query(MPI_Win win, int rank, MPI_Aint* size,
+                         int* disp_unit, void* baseptr) {
+    EmuWin& w = get_win(win);
+    *size = w.sizes[rank];
+    *disp_unit = w.disp_units[rank];
+    *(void**)baseptr = w.segs[rank];
+    return MPI_SUCCESS;
+}
+int MPI_Win_lock_all(int assert, MPI_Win win) {
+    return MPI_SUCCESS;
+}
+int MPI_Win_unlock_all(MPI_Win win) {
+    return MPI_SUCCESS;
+}
+int MPI_Win_sync(MPI_Win win) {
+    atomic_thread_fence(memory_order_seq_cst);
+    return MPI_SUCCESS;
+}
+int MPI_Win_free(MPI_Win* win) {
+    EmuWin& w = get_win(*win);
+    EmuComm& c = get_comm(w.comm);
+    int me = comm_rank(c);
+    MPI_Win id = *win;
+
+    // Nobody may use the window after this barrier.
+    barrier(c);
+    free(w.segs[me]);
+    barrier(c);
+    if (me == 0) {
+        lock_guard<mutex> lock(state->mtx);
+        state->wins[id].reset();
+    }
+    *win = MPI_WIN_NULL;
+    return MPI_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,146 @@
+/*****************************************************************************
+
+YASK: Yet Another Stencil Kernel
+Copyright (c) 2014-2017, Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+* The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+IN THE SOFTWARE.
+
+*****************************************************************************/
+
+// In-process MPI emulator.
+// Implements the subset of MPI used by YASK, so that multiple ranks can
+// run as threads in one process without an MPI library.
+// Each emulated rank runs the app's main function on its own thread with
+// its own OpenMP thread team. Point-to-point messages are copied through
+// in-memory mailboxes, and shared-memory windows are just the address
+// space of the process, which is shared by all emulated ranks.
+// Enabled by building with 'mpi=emu', which defines both USE_MPI and
+// USE_MPI_EMU.
+
+#ifndef MPI_EMU_HPP
+#define MPI_EMU_HPP
+
+#include <stddef.h>
+
+// Handles.
+// Comm, group, and window handles are indices into tables of objects
+// that are shared by all ranks. Window handle 0 is never valid.
+typedef int MPI_Comm;
+typedef int MPI_Group;
+typedef int MPI_Win;
+typedef int MPI_Info;
+typedef int MPI_Datatype;
+typedef int MPI_Op;
+typedef ptrdiff_t MPI_Aint;
+struct MPI_Emu_Request;
+typedef MPI_Emu_Request* MPI_Request;
+struct MPI_Status {
+    int MPI_SOURCE;
+    int MPI_TAG;
+    int MPI_ERROR;
+};
+
+#define MPI_SUCCESS 0
+#define MPI_COMM_WORLD 0
+#define MPI_GROUP_NULL (-1)
+#define MPI_WIN_NULL 0
+#define MPI_INFO_NULL 0
+#define MPI_REQUEST_NULL ((MPI_Request)0)
+#define MPI_STATUS_IGNORE ((MPI_Status*)0)
+#define MPI_STATUSES_IGNORE ((MPI_Status*)0)
+#define MPI_IN_PLACE ((void*)1)
+#define MPI_PROC_NULL (-1)
+#define MPI_UNDEFINED (-32766)
+#define MPI_COMM_TYPE_SHARED 1
+#define MPI_MODE_NOCHECK 1024
+
+#define MPI_THREAD_SINGLE 0
+#define MPI_THREAD_FUNNELED 1
+#define MPI_THREAD_SERIALIZED 2
+#define MPI_THREAD_MULTIPLE 3
+
+// Datatypes.
+#define MPI_BYTE 1
+#define MPI_INT 2
+#define MPI_INTEGER8 3
+#define MPI_FLOAT 4
+#define MPI_DOUBLE 5
+
+// Reduction ops.
+#define MPI_SUM 1
+#define MPI_MIN 2
+#define MPI_MAX 3
+
+// Run 'main_fn' once for each emulated rank and wait for all to finish.
+// The number of ranks is taken from the YASK_EMU_RANKS env var (default
+// is 1), and the OpenMP threads are divided evenly among the ranks.
+// Returns the largest value returned by 'main_fn'.
+int MPI_Emu_run(int (*main_fn)(int argc, char** argv), int argc, char** argv);
+
+// Environment.
+int MPI_Init_thread(int* argc, char*** argv, int required, int* provided);
+int MPI_Initialized(int* flag);
+int MPI_Finalize();
+int MPI_Abort(MPI_Comm comm, int errorcode);
+
+// Communicators and groups.
+int MPI_Comm_rank(MPI_Comm comm, int* rank);
+int MPI_Comm_size(MPI_Comm comm, int* size);
+int MPI_Comm_split_type(MPI_Comm comm, int split_type, int key,
+                        MPI_Info info, MPI_Comm* newcomm);
+int MPI_Comm_group(MPI_Comm comm, MPI_Group* group);
+int MPI_Group_translate_ranks(MPI_Group group1, int n, const int ranks1[],
+                              MPI_Group group2, int ranks2[]);
+int MPI_Group_free(MPI_Group* group);
+
+// Collectives.
+int MPI_Barrier(MPI_Comm comm);
+int MPI_Bcast(void* buffer, int count, MPI_Datatype datatype,
+              int root, MPI_Comm comm);
+int MPI_Allgather(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                  void* recvbuf, int recvcount, MPI_Datatype recvtype,
+                  MPI_Comm comm);
+int MPI_Allreduce(const void* sendbuf, void* recvbuf, int count,
+                  MPI_Datatype datatype, MPI_Op op, MPI_Comm comm);
+
+// Point-to-point.
+// Sends are buffered, so they complete immediately.
+int MPI_Isend(const void* buf, int count, MPI_Datatype datatype, int dest,
+              int tag, MPI_Comm comm, MPI_Request* request);
+int MPI_Irecv(void* buf, int count, MPI_Datatype datatype, int source,
+              int tag, MPI_Comm comm, MPI_Request* request);
+int MPI_Wait(MPI_Request* request, MPI_Status* status);
+int MPI_Waitall(int count, MPI_Request requests[], MPI_Status statuses[]);
+
+// Info objects are accepted and ignored.
+int MPI_Info_create(MPI_Info* info);
+int MPI_Info_set(MPI_Info info, const char* key, const char* value);
+int MPI_Info_free(MPI_Info* info);
+
+// Shared-memory windows.
+int MPI_Win_allocate_shared(MPI_Aint size, int disp_unit, MPI_Info info,
+                            MPI_Comm comm, void* baseptr, MPI_Win* win);
+int MPI_Win_shared_query(MPI_Win win, int rank, MPI_Aint* size,
+                         int* disp_unit, void* baseptr);
+int MPI_Win_lock_all(int assert, MPI_Win win);
+int MPI_Win_unlock_all(MPI_Win win);
+int MPI_Win_sync(MPI_Win win);
+int MPI_Win_free(MPI_Win* win);
+
+#endif
@@ -145,7 +145,9 @@ namespace yask {
     // note: no warning here because intrinsics aren't wanted in this case.
 
 #elif !defined(INAME)
-#warning "Emulating intrinsics because HW vector length not defined; set USE_INTRIN256 or USE_INTRIN512"
+#ifndef USE_GNU_VEC
+#warning "Emulating intrinsics because HW vector length not defined; set USE_INTRIN256, USE_INTRIN512, or USE_GNU_VEC"
+#endif
 #define NO_INTRINSICS
 
 #elif VLEN != VEC_ELEMS
@@ -155,6 +157,22 @@ namespace yask {
 
 #undef VEC_ELEMS
 
+    // GCC/Clang vector extensions.
+    // These need a power-of-two vector size.
+#ifdef USE_GNU_VEC
+#if defined(__INTEL_COMPILER)
+#error "USE_GNU_VEC requires GCC or Clang"
+#elif VLEN == 1
+#undef USE_GNU_VEC
+#elif (VLEN & (VLEN - 1)) != 0
+#warning "Not using GCC/Clang vector extensions because VLEN is not a power of 2"
+#undef USE_GNU_VEC
+#else
+    typedef real_t real_gnu_vec_t __attribute__((vector_size(VLEN * REAL_BYTES)));
+    typedef ctrl_t ctrl_gnu_vec_t __attribute__((vector_size(VLEN * REAL_BYTES)));
+#endif
+#endif
+
     // Macro for looping through an aligned real_vec_t.
 #if defined(DEBUG) || (VLEN==1) || !defined(__INTEL_COMPILER) 
 #define REAL_VEC_LOOP(i)                        \
@@ -211,6 +229,11 @@ namespace yask {
 #elif REAL_BYTES == 8 && defined(USE_INTRIN512)
         __m512d mr;
 #endif
+#endif
+
+#ifdef USE_GNU_VEC
+        // real vector using GCC/Clang vector extensions.
+        real_gnu_vec_t gv;
 #endif
     };
   
@@ -250,7 +273,9 @@ namespace yask {
 
         // copy whole vector.
         ALWAYS_INLINE real_vec_t& operator=(const real_vec_t& rhs) {
-#ifdef NO_INTRINSICS
+#if defined(USE_GNU_VEC)
+            u.gv = rhs.u.gv;
+#elif defined(NO_INTRINSICS)
             REAL_VEC_LOOP(i) u.r[i] = rhs[i];
 #else
             u.mr = rhs.u.mr;
@@ -264,14 +289,18 @@ namespace yask {
 
         // assignment: single value broadcast.
         ALWAYS_INLINE void operator=(double val) {
-#ifdef NO_INTRINSICS
+#if defined(USE_GNU_VEC)
+            u.gv = real_gnu_vec_t{} + real_t(val);
+#elif defined(NO_INTRINSICS)
             REAL_VEC_LOOP(i) u.r[i] = real_t(val);
 #else
             u.mr = INAME(set1)(real_t(val));
 #endif
         }
         ALWAYS_INLINE void operator=(float val) {
-#ifdef NO_INTRINSICS
+#if defined(USE_GNU_VEC)
+            u.gv = real_gnu_vec_t{} + real_t(val);
+#elif defined(NO_INTRINSICS)
             REAL_VEC_LOOP(i) u.r[i] = real_t(val);
 #else
             u.mr = INAME(set1)(real_t(val));
@@ -299,8 +328,8 @@ namespace yask {
             return u.r[l];
         }
 
-        // access a real_t by w,x,y,z element indices.
-        ALWAYS_INLINE const real_t& operator()(idx_t w, idx_t x, idx_t y, idx_t z) const {
+        // get index of the real_t at w,x,y,z element indices.
+        static ALWAYS_INLINE idx_t get_elem_index(idx_t w, idx_t x, idx_t y, idx_t z) {
             assert(w >= 0);
             assert(w < VLEN_W);
             assert(x >= 0);
@@ -320,8 +349,12 @@ namespace yask {
             // z dim is unit stride, followed by y, x, w.
             idx_t l = LAYOUT_1234(w, x, y, z, VLEN_W, VLEN_X, VLEN_Y, VLEN_Z);
 #endif
-        
-            return u.r[l];
+            return l;
+        }
+
+        // access a real_t by w,x,y,z element indices.
+        ALWAYS_INLINE const real_t& operator()(idx_t w, idx_t x, idx_t y, idx_t z) const {
+            return u.r[get_elem_index(w, x, y, z)];
         }
         ALWAYS_INLINE real_t& operator()(idx_t w, idx_t x, idx_t y, idx_t z) {
             const real_vec_t* ct = const_cast<const real_vec_t*>(this);
@@ -332,7 +365,9 @@ namespace yask {
         // unary negate.
         ALWAYS_INLINE real_vec_t operator-() const {
             real_vec_t res;
-#ifdef NO_INTRINSICS
+#if defined(USE_GNU_VEC)
+            res.u.gv = -u.gv;
+#elif defined(NO_INTRINSICS)
             REAL_VEC_LOOP(i) res[i] = -u.r[i];
 #else
             // subtract from zero.
@@ -344,7 +379,9 @@ namespace yask {
         // add.
         ALWAYS_INLINE real_vec_t operator+(real_vec_t rhs) const {
             real_vec_t res;
-#ifdef NO_INTRINSICS
+#if defined(USE_GNU_VEC)
+            res.u.gv = u.gv + rhs.u.gv;
+#elif defined(NO_INTRINSICS)
             REAL_VEC_LOOP(i) res[i] = u.r[i] + rhs[i];
 #else
             res.u.mr = INAME(add)(u.mr, rhs.u.mr);
@@ -360,7 +397,9 @@ namespace yask {
         // sub.
         ALWAYS_INLINE real_vec_t operator-(real_vec_t rhs) const {
             real_vec_t res;
-#ifdef NO_INTRINSICS
+#if defined(USE_GNU_VEC)
+            res.u.gv = u.gv - rhs.u.gv;
+#elif defined(NO_INTRINSICS)
             REAL_VEC_LOOP(i) res[i] = u.r[i] - rhs[i];
 #else
             res.u.mr = INAME(sub)(u.mr, rhs.u.mr);
@@ -376,7 +415,9 @@ namespace yask {
         // mul.
         ALWAYS_INLINE real_vec_t operator*(real_vec_t rhs) const {
             real_vec_t res;
-#ifdef NO_INTRINSICS
+#if defined(USE_GNU_VEC)
+            res.u.gv = u.gv * rhs.u.gv;
+#elif defined(NO_INTRINSICS)
             REAL_VEC_LOOP(i) res[i] = u.r[i] * rhs[i];
 #else
             res.u.mr = INAME(mul)(u.mr, rhs.u.mr);
@@ -392,7 +433,9 @@ namespace yask {
         // div.
         ALWAYS_INLINE real_vec_t operator/(real_vec_t rhs) const {
             real_vec_t res, rcp;
-#ifdef NO_INTRINSICS
+#if defined(USE_GNU_VEC) && !defined(USE_RCP14) && !defined(USE_RCP28)
+            res.u.gv = u.gv / rhs.u.gv;
+#elif defined(NO_INTRINSICS)
             REAL_VEC_LOOP(i) res[i] = u.r[i] / rhs[i];
 #elif defined(USE_RCP14)
             rcp.u.mr = INAME(rcp14)(rhs.u.mr);
@@ -449,7 +492,9 @@ namespace yask {
     
         // aligned load.
         ALWAYS_INLINE void loadFrom(const real_vec_t* __restrict__ from) {
-#if defined(NO_INTRINSICS) || defined(NO_LOAD_INTRINSICS)
+#if defined(USE_GNU_VEC)
+            u.gv = from->u.gv;
+#elif defined(NO_INTRINSICS) || defined(NO_LOAD_INTRINSICS)
             REAL_VEC_LOOP(i) u.r[i] = (*from)[i];
 #else
             u.mr = INAME(load)((imem_t const*)from);
@@ -474,7 +519,9 @@ namespace yask {
             // defining and not defining NO_STORE_INTRINSICS and comparing
             // the sizes of the stencil computation loop and the overall
             // performance.
-#if defined(NO_INTRINSICS) || defined(NO_STORE_INTRINSICS)
+#if defined(USE_GNU_VEC) && (defined(NO_INTRINSICS) || !defined(USE_STREAMING_STORE))
+            to->u.gv = u.gv;
+#elif defined(NO_INTRINSICS) || defined(NO_STORE_INTRINSICS)
 #if defined(__INTEL_COMPILER) && (VLEN > 1) && defined(USE_STREAMING_STORE)
             _Pragma("vector nontemporal")
 #endif
@@ -488,6 +535,19 @@ namespace yask {
 #endif
         }
 
+        // masked store: write only the elements whose bits are set in 'k1'.
+        // Other elements in 'to' are not accessed.
+        ALWAYS_INLINE void storeTo_masked(real_vec_t* __restrict__ to,
+                                          unsigned int k1) const {
+#if defined(NO_INTRINSICS) || !defined(USE_INTRIN512)
+            for (int i = 0; i < VLEN; i++)
+                if ((k1 >> i) & 1)
+                    (*to)[i] = u.r[i];
+#else
+            INAME(mask_store)((imem_t*)to, real_mask_t(k1), u.mr);
+#endif
+        }
+
         // Output.
         void print_ctrls(std::ostream& os, bool doEnd=true) const {
             for (int j = 0; j < VLEN; j++) {
@@ -532,6 +592,89 @@ namespace yask {
     // wrappers around some intrinsics w/non-intrinsic equivalents.
     // TODO: make these methods in the real_vec_t union.
 
+    // Multiply-adds used by the generated vector code.
+    // These use FMA instructions only when the target has them, so the
+    // elements of a vector without intrinsics round the same way as
+    // those with them. The scalar reference code uses plain multiplies
+    // and adds so that validation can catch FMA-related changes.
+#if defined(__FMA__) || defined(__AVX512F__) || defined(__MIC__)
+#define USE_FMA
+#endif
+
+    // Return (a * b) + c.
+    ALWAYS_INLINE real_t real_fmadd(real_t a, real_t b, real_t c) {
+#if !defined(USE_FMA)
+        return a * b + c;
+#elif REAL_BYTES == 4
+        return fmaf(a, b, c);
+#else
+        return fma(a, b, c);
+#endif
+    }
+
+    // Return c - (a * b).
+    ALWAYS_INLINE real_t real_fnmadd(real_t a, real_t b, real_t c) {
+        return real_fmadd(-a, b, c);
+    }
+
+    // Return (a * b) + c for each element.
+    ALWAYS_INLINE real_vec_t real_vec_fmadd(const real_vec_t& a, const real_vec_t& b,
+                                            const real_vec_t& c) {
+        real_vec_t res;
+#if defined(NO_INTRINSICS) || !defined(USE_FMA)
+        REAL_VEC_LOOP(i) res.u.r[i] = real_fmadd(a.u.r[i], b.u.r[i], c.u.r[i]);
+#else
+        res.u.mr = INAME(fmadd)(a.u.mr, b.u.mr, c.u.mr);
+#endif
+        return res;
+    }
+
+    // Return c - (a * b) for each element.
+    ALWAYS_INLINE real_vec_t real_vec_fnmadd(const real_vec_t& a, const real_vec_t& b,
+                                             const real_vec_t& c) {
+        real_vec_t res;
+#if defined(NO_INTRINSICS) || !defined(USE_FMA)
+        REAL_VEC_LOOP(i) res.u.r[i] = real_fnmadd(a.u.r[i], b.u.r[i], c.u.r[i]);
+#else
+        res.u.mr = INAME(fnmadd)(a.u.mr, b.u.mr, c.u.mr);
+#endif
+        return res;
+    }
+
+    // Get elements from two vectors selected at compile-time.
+    // Element i of res is element Is[i] of the concatenation of a and b,
+    // i.e., a[Is[i]] if Is[i] < VLEN, b[Is[i] - VLEN] otherwise.
+    template<int... Is>
+    ALWAYS_INLINE void real_vec_shuffle2(real_vec_t& res, const real_vec_t& a, const real_vec_t& b) {
+        static_assert(sizeof...(Is) == VLEN, "need one index per element");
+#if defined(USE_GNU_VEC) && (defined(__clang__) || __GNUC__ >= 12)
+        res.u.gv = __builtin_shufflevector(a.u.gv, b.u.gv, Is...);
+#elif defined(USE_GNU_VEC)
+        res.u.gv = __builtin_shuffle(a.u.gv, b.u.gv, ctrl_gnu_vec_t{ Is... });
+#else
+        // must make temp copies in case &res == &a or &b.
+        const int idxs[] = { Is... };
+        real_vec_t tmpa = a, tmpb = b;
+        for (int i = 0; i < VLEN; i++)
+            res.u.r[i] = (idxs[i] < VLEN) ? tmpa.u.r[idxs[i]] : tmpb.u.r[idxs[i] - VLEN];
+#endif
+    }
+
+    // Compile-time list of indices 0..N-1 for shuffles.
+    template<int... Is> struct real_vec_idxs { };
+    template<int N, int... Is> struct real_vec_make_idxs :
+        real_vec_make_idxs<N - 1, N - 1, Is...> { };
+    template<int... Is> struct real_vec_make_idxs<0, Is...> {
+        typedef real_vec_idxs<Is...> type;
+    };
+
+    // Align using a shuffle of b and a.
+    template<int count, int... Is>
+    ALWAYS_INLINE void real_vec_align_shuffle(real_vec_t& res, const real_vec_t& a, const real_vec_t& b,
+                                              real_vec_idxs<Is...>) {
+        real_vec_shuffle2<(Is + count)...>(res, b, a);
+    }
+
     // Get consecutive elements from two vectors.
     // Concat a and b, shift right by count elements, keep rightmost elements.
     // Thus, shift of 0 returns b; shift of VLEN returns a.
@@ -546,7 +689,11 @@ namespace yask {
         b.print_reals(cout);
 #endif
 
-#if defined(NO_INTRINSICS)
+#if defined(USE_GNU_VEC)
+        // Element i of res is element i+count of the concatenation of b and a.
+        real_vec_align_shuffle<count>(res, a, b, typename real_vec_make_idxs<VLEN>::type());
+
+#elif defined(NO_INTRINSICS)
         // must make temp copies in case &res == &a or &b.
         real_vec_t tmpa = a, tmpb = b;
         for (int i = 0; i < VLEN-count; i++)
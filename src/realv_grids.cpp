@@ -54,7 +54,10 @@ namespace yask {
                 printWithPow10Multiplier(get_num_elems()) << " element(s) of " <<
                 sizeof(real_t) << " byte(s) each, " <<
                 printWithPow10Multiplier(get_num_real_vecs()) << " vector(s), " <<
-                printWithPow2Multiplier(get_num_bytes()) << "B.\n";
+                printWithPow2Multiplier(get_num_bytes()) << "B";
+        if (get_stride() > 1)
+            os << ", interleaved with " << (get_stride() - 1) << " other grid(s)";
+        os << ".\n";
         }
     
     // Check for equality.
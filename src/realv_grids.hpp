@@ -118,6 +118,10 @@ namespace yask {
             _name(name), _gp(gp) { }
         virtual ~RealVecGridBase() { }
 
+        // Make a new grid of the same type with the given name.
+        // Sizes are not copied, and no storage is allocated.
+        virtual RealVecGridBase* new_like(const std::string& name) const =0;
+
         // Get name.
         const std::string& get_name() { return _name; }
 
@@ -311,6 +315,9 @@ namespace yask {
         void set_storage(void* buf, size_t offset) {
             _gp->set_storage(buf, offset);
         }
+        idx_t get_stride() const {
+            return _gp->get_stride();
+        }
         RealVecGrid* getGenericGrid() {
             return _gp;
         }
@@ -322,12 +329,13 @@ namespace yask {
     
     // A 3D (x, y, z) collection of real_vec_t elements.
     // Supports symmetric padding in each dimension.
-    template <typename LayoutFn> class RealVecGrid_XYZ :
+    // Vectors are '_stride' real_vec_t's apart, e.g., when grids are fused.
+    template <typename LayoutFn, idx_t _stride = 1> class RealVecGrid_XYZ :
         public RealVecGridBase {
 
     protected:
 
-        GenericGrid3d<real_vec_t, LayoutFn> _data;
+        GenericGrid3d<real_vec_t, LayoutFn, _stride> _data;
 
         virtual void resize_g() {
             _data.set_d1(_dxv + 2 * _pxv);
@@ -341,6 +349,11 @@ namespace yask {
         RealVecGrid_XYZ(const std::string& name) :
             RealVecGridBase(name, &_data) { }
 
+        // Make a new grid of the same type.
+        virtual RealVecGridBase* new_like(const std::string& name) const {
+            return new RealVecGrid_XYZ(name);
+        }
+
         // Determine what dims are defined.
         virtual bool got_x() const { return true; }
         virtual bool got_y() const { return true; }
@@ -446,7 +459,7 @@ namespace yask {
             std::cout << "readVecNorm(" << xv << "," << yv << "," << zv << ")..." << std::endl;
 #endif        
             const real_vec_t* p = getVecPtrNorm(xv, yv, zv);
-            __assume_aligned(p, CACHELINE_BYTES);
+            __assume_aligned(p, alignof(real_vec_t));
             real_vec_t v;
             v.loadFrom(p);
 #ifdef TRACE_MEM
@@ -464,7 +477,7 @@ namespace yask {
         void writeVecNorm(const real_vec_t& v, idx_t xv, idx_t yv, idx_t zv,
                           int line) {
             real_vec_t* p = getVecPtrNorm(xv, yv, zv);
-            __assume_aligned(p, CACHELINE_BYTES);
+            __assume_aligned(p, alignof(real_vec_t));
             v.storeTo(p);
 #ifdef TRACE_MEM
             printVecNorm(std::cout, "writeVec", xv, yv, zv, v, line);
@@ -474,6 +487,23 @@ namespace yask {
 #endif
         }
 
+        // Write the elements selected by 'mask' in one vector at vector offset xv, yv, zv.
+        // Indices must be normalized, i.e., already divided by VLEN_*.
+        ALWAYS_INLINE
+        void writeVecNorm_masked(const real_vec_t& v, unsigned int mask,
+                                 idx_t xv, idx_t yv, idx_t zv,
+                                 int line) {
+            real_vec_t* p = getVecPtrNorm(xv, yv, zv);
+            __assume_aligned(p, alignof(real_vec_t));
+            v.storeTo_masked(p, mask);
+#ifdef TRACE_MEM
+            printVecNorm(std::cout, "writeVecMasked", xv, yv, zv, v, line);
+#endif
+#ifdef MODEL_CACHE
+            cache_model.write(p, line);
+#endif
+        }
+
         // Prefetch one vector at vector offset xv, yv, zv.
         // Indices must be normalized, i.e., already divided by VLEN_*.
         template <int level>
@@ -485,7 +515,7 @@ namespace yask {
                 xv << "," << yv << "," << zv << ")..." << std::endl;
 #endif        
             const char* p = (const char*)getVecPtrNorm(xv, yv, zv, false);
-            __assume_aligned(p, CACHELINE_BYTES);
+            __assume_aligned(p, alignof(real_vec_t));
             _mm_prefetch (p, level);
 #ifdef MODEL_CACHE
             cache_model.prefetch(p, level, line);
@@ -545,12 +575,13 @@ namespace yask {
 
     // A 4D (w, x, y, z) collection of real_vec_t elements.
     // Supports symmetric padding in each dimension.
-    template <typename LayoutFn> class RealVecGrid_WXYZ :
+    // Vectors are '_stride' real_vec_t's apart, e.g., when grids are fused.
+    template <typename LayoutFn, idx_t _stride = 1> class RealVecGrid_WXYZ :
         public RealVecGridBase {
     
     protected:
 
-        GenericGrid4d<real_vec_t, LayoutFn> _data;
+        GenericGrid4d<real_vec_t, LayoutFn, _stride> _data;
 
         virtual void resize_g() {
             _data.set_d1(_dwv + 2 * _pwv);
@@ -565,6 +596,11 @@ namespace yask {
         RealVecGrid_WXYZ(const std::string& name) :
             RealVecGridBase(name, &_data) { }
 
+        // Make a new grid of the same type.
+        virtual RealVecGridBase* new_like(const std::string& name) const {
+            return new RealVecGrid_WXYZ(name);
+        }
+
         // Determine what dims are defined.
         virtual bool got_w() const { return true; }
         virtual bool got_x() const { return true; }
@@ -672,7 +708,7 @@ namespace yask {
             std::cout << "readVecNorm(" << wv << "," << xv << "," << yv << "," << zv << ")..." << std::endl;
 #endif        
             const real_vec_t* p = getVecPtrNorm(wv, xv, yv, zv);
-            __assume_aligned(p, CACHELINE_BYTES);
+            __assume_aligned(p, alignof(real_vec_t));
             real_vec_t v;
             v.loadFrom(p);
 #ifdef TRACE_MEM
@@ -690,7 +726,7 @@ namespace yask {
         void writeVecNorm(const real_vec_t& v, idx_t wv, idx_t xv, idx_t yv, idx_t zv,
                           int line) {
             real_vec_t* p = getVecPtrNorm(wv, xv, yv, zv);
-            __assume_aligned(p, CACHELINE_BYTES);
+            __assume_aligned(p, alignof(real_vec_t));
             v.storeTo(p);
 #ifdef TRACE_MEM
             printVecNorm(std::cout, "writeVec", wv, xv, yv, zv, v, line);
@@ -700,6 +736,23 @@ namespace yask {
 #endif
         }
 
+        // Write the elements selected by 'mask' in one vector at vector offset wv, xv, yv, zv.
+        // Indices must be normalized, i.e., already divided by VLEN_*.
+        ALWAYS_INLINE
+        void writeVecNorm_masked(const real_vec_t& v, unsigned int mask,
+                                 idx_t wv, idx_t xv, idx_t yv, idx_t zv,
+                                 int line) {
+            real_vec_t* p = getVecPtrNorm(wv, xv, yv, zv);
+            __assume_aligned(p, alignof(real_vec_t));
+            v.storeTo_masked(p, mask);
+#ifdef TRACE_MEM
+            printVecNorm(std::cout, "writeVecMasked", wv, xv, yv, zv, v, line);
+#endif
+#ifdef MODEL_CACHE
+            cache_model.write(p, line);
+#endif
+        }
+
         // Prefetch one vector at vector offset wv, xv, yv, zv.
         // Indices must be normalized, i.e., already divided by VLEN_*.
         template <int level>
@@ -711,7 +764,7 @@ namespace yask {
                 wv << "," << xv << "," << yv << "," << zv << ")..." << std::endl;
 #endif        
             const char* p = (const char*)getVecPtrNorm(wv, xv, yv, zv, false);
-            __assume_aligned(p, CACHELINE_BYTES);
+            __assume_aligned(p, alignof(real_vec_t));
             _mm_prefetch (p, level);
 #ifdef MODEL_CACHE
             cache_model.prefetch(p, level, line);
@@ -811,12 +864,13 @@ namespace yask {
 
     // A 4D (t, x, y, z) collection of real_vec_t elements.
     // Supports symmetric padding in each dimension.
-    template <typename LayoutFn, idx_t _tdim> class RealVecGrid_TXYZ :
+    // Vectors are '_stride' real_vec_t's apart, e.g., when grids are fused.
+    template <typename LayoutFn, idx_t _tdim, idx_t _stride = 1> class RealVecGrid_TXYZ :
         public RealVecGridTemplate<_tdim> {
     
     protected:
 
-        GenericGrid4d<real_vec_t, LayoutFn> _data;
+        GenericGrid4d<real_vec_t, LayoutFn, _stride> _data;
 
         virtual void resize_g() {
             _data.set_d1(_tdim);
@@ -831,6 +885,11 @@ namespace yask {
         RealVecGrid_TXYZ(const std::string& name) :
             RealVecGridTemplate<_tdim>(name, &_data) { }
 
+        // Make a new grid of the same type.
+        virtual RealVecGridBase* new_like(const std::string& name) const {
+            return new RealVecGrid_TXYZ(name);
+        }
+
         // Determine what dims are defined.
         virtual bool got_t() const { return true; }
         virtual bool got_x() const { return true; }
@@ -939,7 +998,7 @@ namespace yask {
                 "," << yv << "," << zv << ")..." << std::endl;
 #endif        
             const real_vec_t* p = getVecPtrNorm(t, xv, yv, zv);
-            __assume_aligned(p, CACHELINE_BYTES);
+            __assume_aligned(p, alignof(real_vec_t));
             real_vec_t v;
             v.loadFrom(p);
 #ifdef TRACE_MEM
@@ -958,7 +1017,7 @@ namespace yask {
                      idx_t t, idx_t xv, idx_t yv, idx_t zv,
                      int line) {
             real_vec_t* p = getVecPtrNorm(t, xv, yv, zv);
-            __assume_aligned(p, CACHELINE_BYTES);
+            __assume_aligned(p, alignof(real_vec_t));
             v.storeTo(p);
 #ifdef TRACE_MEM
             printVecNorm(std::cout, "writeVec", t, xv, yv, zv, v, line);
@@ -968,6 +1027,23 @@ namespace yask {
 #endif
         }
 
+        // Write the elements selected by 'mask' in one vector at vector offset t, xv, yv, zv.
+        // Indices must be normalized, i.e., already divided by VLEN_*.
+        ALWAYS_INLINE void
+        writeVecNorm_masked(const real_vec_t& v, unsigned int mask,
+                            idx_t t, idx_t xv, idx_t yv, idx_t zv,
+                            int line) {
+            real_vec_t* p = getVecPtrNorm(t, xv, yv, zv);
+            __assume_aligned(p, alignof(real_vec_t));
+            v.storeTo_masked(p, mask);
+#ifdef TRACE_MEM
+            printVecNorm(std::cout, "writeVecMasked", t, xv, yv, zv, v, line);
+#endif
+#ifdef MODEL_CACHE
+            cache_model.write(p, line);
+#endif
+        }
+
         // Prefetch one vector at vector offset t, xv, yv, zv.
         // Indices must be normalized, i.e., already divided by VLEN_*.
         template <int level>
@@ -979,7 +1055,7 @@ namespace yask {
                 xv << "," << yv << "," << zv << ")..." << std::endl;
 #endif
             const char* p = (const char*)getVecPtrNorm(t, xv, yv, zv, false);
-            __assume_aligned(p, CACHELINE_BYTES);
+            __assume_aligned(p, alignof(real_vec_t));
             _mm_prefetch (p, level);
 #ifdef MODEL_CACHE
             cache_model.prefetch(p, level, line);
@@ -1037,12 +1113,13 @@ namespace yask {
 
     // A 5D (t, w, x, y, z) collection of real_vec_t elements.
     // Supports symmetric padding in each dimension.
-    template <typename LayoutFn, idx_t _tdim> class RealVecGrid_TWXYZ :
+    // Vectors are '_stride' real_vec_t's apart, e.g., when grids are fused.
+    template <typename LayoutFn, idx_t _tdim, idx_t _stride = 1> class RealVecGrid_TWXYZ :
         public RealVecGridTemplate<_tdim> {
     
     protected:
 
-        GenericGrid5d<real_vec_t, LayoutFn> _data;
+        GenericGrid5d<real_vec_t, LayoutFn, _stride> _data;
 
         virtual void resize_g() {
             _data.set_d1(_tdim);
@@ -1058,6 +1135,11 @@ namespace yask {
         RealVecGrid_TWXYZ(const std::string& name) :
             RealVecGridTemplate<_tdim>(name, &_data) { }
 
+        // Make a new grid of the same type.
+        virtual RealVecGridBase* new_like(const std::string& name) const {
+            return new RealVecGrid_TWXYZ(name);
+        }
+
         // Determine what dims are defined.
         virtual bool got_t() const { return true; }
         virtual bool got_w() const { return true; }
@@ -1170,7 +1252,7 @@ namespace yask {
                 "," << yv << "," << zv << ")..." << std::endl;
 #endif        
             const real_vec_t* p = getVecPtrNorm(t, wv, xv, yv, zv);
-            __assume_aligned(p, CACHELINE_BYTES);
+            __assume_aligned(p, alignof(real_vec_t));
             real_vec_t v;
             v.loadFrom(p);
 #ifdef TRACE_MEM
@@ -1189,7 +1271,7 @@ namespace yask {
                      idx_t t, idx_t wv, idx_t xv, idx_t yv, idx_t zv,
                      int line) {
             real_vec_t* p = getVecPtrNorm(t, wv, xv, yv, zv);
-            __assume_aligned(p, CACHELINE_BYTES);
+            __assume_aligned(p, alignof(real_vec_t));
             v.storeTo(p);
 #ifdef TRACE_MEM
             printVecNorm(std::cout, "writeVec", t, wv, xv, yv, zv, v, line);
@@ -1199,6 +1281,23 @@ namespace yask {
 #endif
         }
 
+        // Write the elements selected by 'mask' in one vector at vector offset t, wv, xv, yv, zv.
+        // Indices must be normalized, i.e., already divided by VLEN_*.
+        ALWAYS_INLINE void
+        writeVecNorm_masked(const real_vec_t& v, unsigned int mask,
+                            idx_t t, idx_t wv, idx_t xv, idx_t yv, idx_t zv,
+                            int line) {
+            real_vec_t* p = getVecPtrNorm(t, wv, xv, yv, zv);
+            __assume_aligned(p, alignof(real_vec_t));
+            v.storeTo_masked(p, mask);
+#ifdef TRACE_MEM
+            printVecNorm(std::cout, "writeVecMasked", t, wv, xv, yv, zv, v, line);
+#endif
+#ifdef MODEL_CACHE
+            cache_model.write(p, line);
+#endif
+        }
+
         // Prefetch one vector at vector offset t, wv, xv, yv, zv.
         // Indices must be normalized, i.e., already divided by VLEN_*.
         template <int level>
@@ -1210,7 +1309,7 @@ namespace yask {
                 wv << "," << xv << "," << yv << "," << zv << ")..." << std::endl;
 #endif        
             const char* p = (const char*)getVecPtrNorm(t, wv, xv, yv, zv, false);
-            __assume_aligned(p, CACHELINE_BYTES);
+            __assume_aligned(p, alignof(real_vec_t));
             _mm_prefetch (p, level);
 #ifdef MODEL_CACHE
             cache_model.prefetch(p, level, line);
@@ -95,6 +95,21 @@ IN THE SOFTWARE.
 #define DEF_BLOCK_SIZE (32)
 #endif
 
+// Number of loop-code variants generated for each level.
+// These are set from the *_LOOP_VARIANTS make vars.
+#ifndef NUM_RANK_LOOP_VARIANTS
+#define NUM_RANK_LOOP_VARIANTS (1)
+#endif
+#ifndef NUM_REGION_LOOP_VARIANTS
+#define NUM_REGION_LOOP_VARIANTS (1)
+#endif
+#ifndef NUM_BLOCK_LOOP_VARIANTS
+#define NUM_BLOCK_LOOP_VARIANTS (1)
+#endif
+#ifndef NUM_SUB_BLOCK_LOOP_VARIANTS
+#define NUM_SUB_BLOCK_LOOP_VARIANTS (1)
+#endif
+
 // Memory-accessing code.
 #include "mem_macros.hpp"
 #include "realv_grids.hpp"
@@ -102,7 +117,7 @@ IN THE SOFTWARE.
 // First/last index macros.
 // These are relative to global problem, not rank.
 #define FIRST_INDEX(dim) (0)
-#define LAST_INDEX(dim) (context.tot_ ## dim - 1)
+#define LAST_INDEX(dim) (_context->tot_ ## dim - 1)
 
 namespace yask {
 
@@ -131,6 +146,16 @@ namespace yask {
     template <idx_t tdim>
     using Grid_TWXYZ = RealVecGrid_TWXYZ<LAYOUT_TWXYZ, tdim>;
 
+    // RealVecGrids interleaved w/'nfused' grids in one allocation.
+    template <idx_t nfused>
+    using FusedGrid_XYZ = RealVecGrid_XYZ<LAYOUT_XYZ, nfused>;
+    template <idx_t nfused>
+    using FusedGrid_WXYZ = RealVecGrid_WXYZ<LAYOUT_WXYZ, nfused>;
+    template <idx_t tdim, idx_t nfused>
+    using FusedGrid_TXYZ = RealVecGrid_TXYZ<LAYOUT_TXYZ, tdim, nfused>;
+    template <idx_t tdim, idx_t nfused>
+    using FusedGrid_TWXYZ = RealVecGrid_TWXYZ<LAYOUT_TWXYZ, tdim, nfused>;
+
     // RealGrids using traditional C layout.
     typedef GenericGrid3d<real_t, LAYOUT_XYZ> RealGrid_XYZ;
     typedef GenericGrid4d<real_t, LAYOUT_WXYZ> RealGrid_WXYZ;
@@ -55,8 +55,15 @@ namespace yask {
         comm = MPI_COMM_WORLD;
         MPI_Comm_rank(comm, &my_rank);
         MPI_Comm_size(comm, &num_ranks);
+
+        // Find the ranks that can share memory with this one.
+        MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, my_rank,
+                            MPI_INFO_NULL, &shm_comm);
+        MPI_Comm_rank(shm_comm, &my_shm_rank);
+        MPI_Comm_size(shm_comm, &num_shm_ranks);
 #else
         comm = 0;
+        shm_comm = 0;
 #endif
 
         // Enable the default output stream on the msg-rank only.
@@ -75,6 +82,9 @@ namespace yask {
         comm = src.comm;
         my_rank = src.my_rank;
         num_ranks = src.num_ranks;
+        shm_comm = src.shm_comm;
+        my_shm_rank = src.my_shm_rank;
+        num_shm_ranks = src.num_shm_ranks;
         _ostr = src._ostr;
     }
 
@@ -115,19 +125,35 @@ namespace yask {
 
                 // Loop through 4D space within the bounding-box of this
                 // equation set.
+                if (!_opts->ref_rows) {
 #pragma omp parallel for collapse(4)
-                for (idx_t w = eg->begin_bbw; w < eg->end_bbw; w++)
-                    for (idx_t x = eg->begin_bbx; x < eg->end_bbx; x++)
-                        for (idx_t y = eg->begin_bby; y < eg->end_bby; y++)
-                            for (idx_t z = eg->begin_bbz; z < eg->end_bbz; z++) {
+                    for (idx_t w = eg->begin_bbw; w < eg->end_bbw; w++)
+                        for (idx_t x = eg->begin_bbx; x < eg->end_bbx; x++)
+                            for (idx_t y = eg->begin_bby; y < eg->end_bby; y++)
+                                for (idx_t z = eg->begin_bbz; z < eg->end_bbz; z++) {
 
-                                // Update only if point is in sub-domain for this eq group.
-                                if (eg->is_in_valid_domain(t, ARG_W(w) x, y, z)) {
+                                    // Update only if point is in sub-domain for this eq group.
+                                    if (eg->is_in_valid_domain(t, ARG_W(w) x, y, z)) {
                                     
-                                    // Evaluate the reference scalar code.
-                                    eg->calc_scalar(t, ARG_W(w) x, y, z);
+                                        // Evaluate the reference scalar code.
+                                        eg->calc_scalar(t, ARG_W(w) x, y, z);
+                                    }
                                 }
+                }
+
+                // Loop through rows in 4D space within the bounding-box
+                // of this equation set.
+                else {
+#pragma omp parallel for collapse(3)
+                    for (idx_t w = eg->begin_bbw; w < eg->end_bbw; w++)
+                        for (idx_t x = eg->begin_bbx; x < eg->end_bbx; x++)
+                            for (idx_t y = eg->begin_bby; y < eg->end_bby; y++) {
+
+                                // Evaluate the reference scalar code in a row.
+                                eg->calc_ref_row(t, ARG_W(w) x, y,
+                                                 eg->begin_bbz, eg->end_bbz);
                             }
+                }
 
                 // Remember grids that have been written to by this eq-group.
                 mark_grids_dirty(*eg);
@@ -146,6 +172,9 @@ namespace yask {
                   " by " << step_dt << ")");
         ostream& os = get_ostr();
 
+        // Variant of the generated rank loops to run.
+        const int loop_variant = _opts->rank_loop_variant;
+
 #ifdef MODEL_CACHE
         if (context.my_rank != context.msg_rank)
             cache_model.disable();
@@ -211,6 +240,10 @@ namespace yask {
                   ", z=" << begin_dz << ".." << (end_dz-1) <<
                   ")");
 
+        // Evaluate parameter expressions once for this run.
+        for (auto* eg : eqGroups)
+            eg->init_invariants();
+
         // Set number of threads for a region.
         set_region_threads();
 
@@ -302,10 +335,23 @@ namespace yask {
 
         // Steps within a region are based on block sizes.
         const idx_t step_rt = _opts->bt;
+#ifdef USE_BISECT_REGIONS
+        // When bisecting, the region is split on cluster boundaries
+        // into leaves of up to the sub-block sizes.
+        const idx_t step_rw = CPTS_W;
+        const idx_t step_rx = CPTS_X;
+        const idx_t step_ry = CPTS_Y;
+        const idx_t step_rz = CPTS_Z;
+        const idx_t leaf_size_rw = _opts->sbw;
+        const idx_t leaf_size_rx = _opts->sbx;
+        const idx_t leaf_size_ry = _opts->sby;
+        const idx_t leaf_size_rz = _opts->sbz;
+#else
         const idx_t step_rw = _opts->bw;
         const idx_t step_rx = _opts->bx;
         const idx_t step_ry = _opts->by;
         const idx_t step_rz = _opts->bz;
+#endif
 
         // Groups in region loops are based on block-group sizes.
         const idx_t group_size_rw = _opts->bgw;
@@ -313,6 +359,9 @@ namespace yask {
         const idx_t group_size_ry = _opts->bgy;
         const idx_t group_size_rz = _opts->bgz;
 
+        // Variant of the generated region loops to run.
+        const int loop_variant = _opts->region_loop_variant;
+
         // Not yet supporting temporal blocking.
         if (step_rt != 1) {
             cerr << "Error: temporal blocking not yet supported." << endl;
@@ -420,6 +469,9 @@ namespace yask {
         const idx_t group_size_by = opts.sbgy;
         const idx_t group_size_bz = opts.sbgz;
 
+        // Variant of the generated block loops to run.
+        const int loop_variant = opts.block_loop_variant;
+
         // Set number of threads for a block.
         // This should be nested within a top-level OpenMP task.
         _generic_context->set_block_threads();
@@ -445,10 +497,16 @@ namespace yask {
                    ", z=" << begin_sbz << ".." << (end_sbz-1) <<
                    ").");
         
-        // If not a 'simple' domain, must use scalar code.  TODO: this
-        // is very inefficient--need to vectorize as much as possible.
+        // If not a 'simple' domain, use clusters with masked writes so
+        // that only the valid points in this sub-block are updated.
         if (!bb_simple) {
-            
+
+#ifndef NO_MASKED_CLUSTERS
+            TRACE_MSG2("...using masked clusters.");
+            calc_sub_block_of_masked_clusters(sbt, ARG_W(begin_sbw)
+                                              begin_sbx, begin_sby, begin_sbz,
+                                              ARG_W(end_sbw) end_sbx, end_sby, end_sbz);
+#else
             TRACE_MSG2("...using scalar code.");
             for (idx_t w = begin_sbw; w < end_sbw; w++)
                 for (idx_t x = begin_sbx; x < end_sbx; x++)
@@ -471,6 +529,7 @@ namespace yask {
                             }
                         }
                     }
+#endif
         }
 
         // Full rectangular polytope: use optimized code.
@@ -519,6 +578,17 @@ namespace yask {
         }
         assertEqualityOverRanks(_opts->dt, comm, "time-step");
 
+        // Reading halos directly from other ranks requires that all ranks
+        // agree on using it and on the padding of the grids.
+        assertEqualityOverRanks(_opts->use_shm, comm, "use_shm");
+        if (is_shm_enabled()) {
+            os << "Num ranks sharing memory with this rank: " << num_shm_ranks << endl;
+            assertEqualityOverRanks(_opts->pw, comm, "extra-padding in w");
+            assertEqualityOverRanks(_opts->px, comm, "extra-padding in x");
+            assertEqualityOverRanks(_opts->py, comm, "extra-padding in y");
+            assertEqualityOverRanks(_opts->pz, comm, "extra-padding in z");
+        }
+
         // Determine my coordinates if not provided already.
         // TODO: do this more intelligently based on proximity.
         if (_opts->find_loc) {
@@ -551,6 +621,12 @@ namespace yask {
         rsizes[my_rank][2] = _opts->dy;
         rsizes[my_rank][3] = _opts->dz;
 
+        // A table of each rank's index in 'shm_comm'.
+        // MPI_PROC_NULL indicates the rank doesn't share memory with this one.
+        int shm_ranks[num_ranks];
+        for (int rn = 0; rn < num_ranks; rn++)
+            shm_ranks[rn] = MPI_PROC_NULL;
+
 #ifdef USE_MPI
         // Exchange coord and size info between all ranks.
         for (int rn = 0; rn < num_ranks; rn++) {
@@ -559,6 +635,22 @@ namespace yask {
             MPI_Bcast(&rsizes[rn][0], num_dims, MPI_INTEGER8,
                       rn, comm);
         }
+
+        // Translate ranks in 'comm' to ranks in 'shm_comm'.
+        if (is_shm_enabled()) {
+            MPI_Group group, shm_group;
+            MPI_Comm_group(comm, &group);
+            MPI_Comm_group(shm_comm, &shm_group);
+            int ranks[num_ranks];
+            for (int rn = 0; rn < num_ranks; rn++)
+                ranks[rn] = rn;
+            MPI_Group_translate_ranks(group, num_ranks, ranks, shm_group, shm_ranks);
+            for (int rn = 0; rn < num_ranks; rn++)
+                if (shm_ranks[rn] == MPI_UNDEFINED)
+                    shm_ranks[rn] = MPI_PROC_NULL;
+            MPI_Group_free(&group);
+            MPI_Group_free(&shm_group);
+        }
 #endif
         
         ofs_w = ofs_x = ofs_y = ofs_z = 0;
@@ -640,10 +732,14 @@ namespace yask {
             // Save rank of this neighbor.
             // Add one to -1..+1 dist to get 0..2 range for my_neighbors indices.
             my_neighbors[rdw+1][rdx+1][rdy+1][rdz+1] = rn;
+            my_shm_neighbors[rdw+1][rdx+1][rdy+1][rdz+1] = shm_ranks[rn];
             num_neighbors++;
             os << "Neighbor #" << num_neighbors << " at " <<
                 rnw << ", " << rnx << ", " << rny << ", " << rnz <<
-                " is rank " << rn << endl;
+                " is rank " << rn;
+            if (shm_ranks[rn] != MPI_PROC_NULL)
+                os << " on this node";
+            os << endl;
                     
             // Check against max dist needed.  TODO: determine max dist
             // automatically from stencil equations; may not be same for all
@@ -676,6 +772,20 @@ namespace yask {
                     os << " No halo exchange needed for grid '" << gname <<
                         "' with rank " << rn << '.' << endl;
                 }
+
+                // Make a view into the neighbor's grid if it shares
+                // memory with this rank. Halos will be copied directly
+                // from it, so no MPI buffers are needed.
+                else if (shm_ranks[rn] != MPI_PROC_NULL) {
+                    ostringstream oss;
+                    oss << gname << "_shm_view_of_" << rn;
+                    mpiBufs[gname].makeShmGrid(rdw+1, rdx+1, rdy+1, rdz+1,
+                                               gp, rsw, rsx, rsy, rsz,
+                                               oss.str());
+                    num_exchanges++;
+                    os << " Shared-memory halo exchange enabled for grid '" << gname <<
+                        "' with rank " << rn << '.' << endl;
+                }
                 else {
 
                     // Make a buffer in each direction (send & receive).
@@ -717,6 +827,12 @@ namespace yask {
         // Determine how many bytes are needed.
         size_t nbytes = 0, gbytes = 0, pbytes = 0, bbytes = 0;
         
+        // Find the list containing each fused grid.
+        std::map<RealVecGridBase*, GridPtrs*> fusedLists;
+        for (auto& fgl : fusedGridPtrs)
+            for (auto* gp : fgl)
+                fusedLists[gp] = &fgl;
+
         // Grids.
         for (auto gp : gridPtrs) {
 
@@ -733,19 +849,48 @@ namespace yask {
             gp->set_ofs_x(ofs_x);
             gp->set_ofs_y(ofs_y);
             gp->set_ofs_z(ofs_z);
+        }
+        for (auto gp : gridPtrs) {
+
+            // Fused grids are all placed with the first one in their list,
+            // one vector from each grid in turn.
+            GridPtrs fgl(1, gp);
+            if (fusedLists.count(gp)) {
+                fgl = *fusedLists.at(gp);
+                if (gp != fgl.front())
+                    continue;
+                for (auto* fgp : fgl) {
+                    if (fgp->get_num_bytes() != gp->get_num_bytes()) {
+                        cerr << "Error: cannot fuse grids '" << gp->get_name() <<
+                            "' and '" << fgp->get_name() << "' with different sizes.\n";
+                        exit_yask(1);
+                    }
+                }
+            }
+            idx_t nfused = fgl.size();
+            for (auto* fgp : fgl) {
+                if (fgp->get_stride() != nfused) {
+                    cerr << "Error: grid '" << fgp->get_name() << "' has a stride of " <<
+                        fgp->get_stride() << " but is fused with " << nfused << " grid(s).\n";
+                    exit_yask(1);
+                }
+            }
 
             // set storage if requested.
             if (_data_buf) {
-                gp->set_storage(_data_buf, nbytes);
-                gp->print_info(os);
+                for (idx_t i = 0; i < nfused; i++) {
+                    fgl[i]->set_storage(_data_buf, nbytes + i * sizeof(real_vec_t));
+                    fgl[i]->print_info(os);
+                }
             }
 
             // determine size used (also offset to next location).
-            gbytes += gp->get_num_bytes();
-            nbytes += ROUND_UP(gp->get_num_bytes() + _data_buf_pad,
+            size_t fbytes = gp->get_num_bytes() * nfused;
+            gbytes += fbytes;
+            nbytes += ROUND_UP(fbytes + _data_buf_pad,
                                CACHELINE_BYTES);
             TRACE_MSG("grid '" << gp->get_name() << "' needs " <<
-                      gp->get_num_bytes() << " bytes");
+                      fbytes << " bytes");
         }
 
         // Params.
@@ -806,10 +951,34 @@ namespace yask {
             os << "Allocating " << printWithPow2Multiplier(nbytes) <<
                 "B for all grids, parameters, and other buffers with a " <<
                 printWithPow2Multiplier(_data_buf_alignment) << "B alignment...\n" << flush;
-            int ret = posix_memalign(&_data_buf, _data_buf_alignment, nbytes);
-            if (ret || !_data_buf) {
-                cerr << "Error: unable to allocate memory.\n";
-                exit_yask(1);
+#ifdef USE_MPI
+            // Allocate in a shared-memory window, so ranks on the same
+            // node can read halos directly from this rank's grids.
+            // Extra space is requested to allow for alignment.
+            if (is_shm_enabled()) {
+                MPI_Info info;
+                MPI_Info_create(&info);
+                MPI_Info_set(info, (char*)"alloc_shared_noncontig", (char*)"true");
+                void* wbuf = 0;
+                MPI_Win_allocate_shared(MPI_Aint(nbytes + _data_buf_alignment), 1,
+                                        info, shm_comm, &wbuf, &shm_win);
+                MPI_Info_free(&info);
+                if (!wbuf) {
+                    cerr << "Error: unable to allocate shared memory.\n";
+                    exit_yask(1);
+                }
+
+                // Open an access epoch to all ranks for MPI_Win_sync().
+                MPI_Win_lock_all(MPI_MODE_NOCHECK, shm_win);
+                _data_buf = (void*)ROUND_UP(uintptr_t(wbuf), _data_buf_alignment);
+            }
+#endif
+            if (!_data_buf) {
+                int ret = posix_memalign(&_data_buf, _data_buf_alignment, nbytes);
+                if (ret || !_data_buf) {
+                    cerr << "Error: unable to allocate memory.\n";
+                    exit_yask(1);
+                }
             }
             _data_buf_size = nbytes;
 
@@ -821,7 +990,74 @@ namespace yask {
                 
             // Distribute this allocation w/a recursive call.
             allocData();
+
+            // Find neighbors' grids in shared memory.
+            setupShmGrids();
+        }
+    }
+
+    // Set sizes, offsets, and storage of the views into the grids of
+    // the neighbors that share memory with this rank.  Each rank
+    // publishes the offset of each of its grids from the beginning of its
+    // segment of the shared-memory window.
+    void StencilContext::setupShmGrids() {
+#ifdef USE_MPI
+        if (!is_shm_enabled())
+            return;
+
+        // Beginning of my segment.
+        MPI_Aint seg_size;
+        int disp_unit;
+        void* my_seg = 0;
+        MPI_Win_shared_query(shm_win, my_shm_rank, &seg_size, &disp_unit, &my_seg);
+
+        // Share offsets of all grids with all ranks on this node.
+        int ngrids = int(gridPtrs.size());
+        vector<idx_t> my_ofs(ngrids);
+        for (int gi = 0; gi < ngrids; gi++)
+            my_ofs[gi] = (char*)(gridPtrs[gi]->get_storage()) - (char*)my_seg;
+        vector<idx_t> all_ofs(num_shm_ranks * ngrids);
+        MPI_Allgather(my_ofs.data(), ngrids, MPI_INTEGER8,
+                      all_ofs.data(), ngrids, MPI_INTEGER8, shm_comm);
+
+        for (int gi = 0; gi < ngrids; gi++) {
+            auto gp = gridPtrs[gi];
+            auto& gname = gp->get_name();
+            if (mpiBufs.count(gname) == 0)
+                continue;
+
+            // Visit views of neighbors' grids.
+            mpiBufs[gname].visitShmNeighbors
+                (*this,
+                 [&](idx_t nw, idx_t nx, idx_t ny, idx_t nz,
+                     int shm_rank,
+                     RealVecGridBase* sgp)
+                 {
+                     // Padding is same as this rank's.
+                     sgp->set_pad_w(_opts->pw);
+                     sgp->set_pad_x(_opts->px);
+                     sgp->set_pad_y(_opts->py);
+                     sgp->set_pad_z(_opts->pz);
+
+                     // Offsets are adjacent to this rank's domain.
+                     sgp->set_ofs_w((nw == idx_t(MPIBufs::rank_prev)) ? ofs_w - sgp->get_dw() :
+                                    (nw == idx_t(MPIBufs::rank_next)) ? ofs_w + _opts->dw : ofs_w);
+                     sgp->set_ofs_x((nx == idx_t(MPIBufs::rank_prev)) ? ofs_x - sgp->get_dx() :
+                                    (nx == idx_t(MPIBufs::rank_next)) ? ofs_x + _opts->dx : ofs_x);
+                     sgp->set_ofs_y((ny == idx_t(MPIBufs::rank_prev)) ? ofs_y - sgp->get_dy() :
+                                    (ny == idx_t(MPIBufs::rank_next)) ? ofs_y + _opts->dy : ofs_y);
+                     sgp->set_ofs_z((nz == idx_t(MPIBufs::rank_prev)) ? ofs_z - sgp->get_dz() :
+                                    (nz == idx_t(MPIBufs::rank_next)) ? ofs_z + _opts->dz : ofs_z);
+
+                     // Storage is in neighbor's segment.
+                     void* seg = 0;
+                     MPI_Win_shared_query(shm_win, shm_rank, &seg_size, &disp_unit, &seg);
+                     sgp->set_storage(seg, all_ofs[shm_rank * ngrids + gi]);
+                     TRACE_MSG("view '" << sgp->get_name() << "' is at " <<
+                               sgp->get_storage());
+                 } );
         }
+#endif
     }
 
     // Allocate grids, params, and MPI bufs.
@@ -848,6 +1084,12 @@ namespace yask {
         os << "*** WARNING: YASK compiled with TRACE_INTRINSICS; ignore performance results.\n";
 #endif
         
+        // Save settings before they are adjusted.
+        if (!_user_opts_saved) {
+            _user_opts = *_opts;
+            _user_opts_saved = true;
+        }
+
         // Adjust all settings before setting MPI buffers or sizing grids.
         _opts->finalizeSettings(os);
         
@@ -919,6 +1161,16 @@ namespace yask {
             " max-halos: " << hw << '+' << hx << '+' << hy << '+' << hz << endl <<
             " manual-L1-prefetch-distance: " << PFDL1 << endl <<
             " manual-L2-prefetch-distance: " << PFDL2 << endl <<
+#ifdef USE_AUTO_PFD
+            " footprint-prefetch-distances: enabled" << endl <<
+#else
+            " footprint-prefetch-distances: disabled" << endl <<
+#endif
+#ifdef USE_BISECT_REGIONS
+            " region-bisection: enabled" << endl <<
+#else
+            " region-bisection: disabled" << endl <<
+#endif
             endl;
         
         // sums across eqs for this rank.
@@ -1021,6 +1273,163 @@ namespace yask {
             "\n";
     }
 
+    // Free grids, params, and MPI bufs.
+    // Grids and params remain in their lists, but they have no storage.
+    void StencilContext::freeAll()
+    {
+        TRACE_MSG("freeAll()");
+
+        // MPI buffers and views of neighbors' grids.
+        for (auto& i : mpiBufs) {
+            auto& mb = i.second;
+            Grid_WXYZ** bp = &mb.bufs[0][0][0][0][0];
+            for (int bi = 0; bi < MPIBufs::nBufDirs * MPIBufs::neighborhood_size; bi++)
+                delete bp[bi];
+            RealVecGridBase** sp = &mb.shmGrids[0][0][0][0];
+            for (int si = 0; si < MPIBufs::neighborhood_size; si++)
+                delete sp[si];
+        }
+        mpiBufs.clear();
+        int *p = (int *)my_neighbors;
+        int *sp = (int *)my_shm_neighbors;
+        for (int i = 0; i < MPIBufs::neighborhood_size; i++)
+            p[i] = sp[i] = MPI_PROC_NULL;
+
+        // Data for grids, params, and MPI buffers.
+        if (_data_buf) {
+#ifdef USE_MPI
+            if (shm_win) {
+                MPI_Win_unlock_all(shm_win);
+                MPI_Win_free(&shm_win);
+                shm_win = 0;
+            }
+            else
+#endif
+                free(_data_buf);
+        }
+        _data_buf = 0;
+        _data_buf_size = 0;
+
+        // Halos and bounding-boxes are no longer valid.
+        for (auto gp : gridPtrs)
+            gp->set_updated(false);
+        for (auto eg : eqGroups)
+            eg->bb_valid = false;
+        bb_valid = false;
+    }
+
+    // Run 'balance_steps' steps to measure the throughput of each rank.
+    // Then, set the rank-domain size of each slab of ranks along each
+    // dimension in proportion to its average throughput and reallocate.
+    // The total size in each dimension is not changed.
+    void StencilContext::balanceRanks()
+    {
+#ifdef USE_MPI
+        ostream& os = get_ostr();
+        idx_t nsteps = _opts->balance_steps;
+        if (nsteps < 1 || num_ranks < 2)
+            return;
+
+        // Time this rank, not counting halo exchange, because that
+        // includes waiting for other ranks.
+        os << "\nRunning " << nsteps << " time step(s) to balance rank-domain sizes...\n" << flush;
+        initData();
+        idx_t dt = _opts->dt;
+        _opts->dt = nsteps;
+        global_barrier();
+        mpi_time = 0.0;
+        double start_time = getTimeInSecs();
+        calc_rank_opt();
+        double calc_time = getTimeInSecs() - start_time - mpi_time;
+        _opts->dt = dt;
+        double rate = double(rank_domain_1t * nsteps) / max(calc_time, 1e-9);
+        os << " throughput of this rank (prob-size-points/sec), not including halo exchange: " <<
+            printWithPow10Multiplier(rate) << endl;
+
+        // Share coordinates, sizes, and throughputs of all ranks.
+        const int num_dims = 4;
+        idx_t my_coords[num_dims] = { _opts->riw, _opts->rix, _opts->riy, _opts->riz };
+        idx_t my_sizes[num_dims] = { _opts->dw, _opts->dx, _opts->dy, _opts->dz };
+        idx_t coords[num_ranks][num_dims];
+        idx_t rsizes[num_ranks][num_dims];
+        double rates[num_ranks];
+        MPI_Allgather(my_coords, num_dims, MPI_INTEGER8,
+                      &coords[0][0], num_dims, MPI_INTEGER8, comm);
+        MPI_Allgather(my_sizes, num_dims, MPI_INTEGER8,
+                      &rsizes[0][0], num_dims, MPI_INTEGER8, comm);
+        MPI_Allgather(&rate, 1, MPI_DOUBLE, rates, 1, MPI_DOUBLE, comm);
+
+        // Find new sizes in each dim.
+        const idx_t nrs[num_dims] = { _opts->nrw, _opts->nrx, _opts->nry, _opts->nrz };
+        const idx_t cpts[num_dims] = { CPTS_W, CPTS_X, CPTS_Y, CPTS_Z };
+        const idx_t halos[num_dims] = { hw, hx, hy, hz };
+        const char* dnames[num_dims] = { "w", "x", "y", "z" };
+        idx_t new_sizes[num_dims];
+        for (int d = 0; d < num_dims; d++) {
+            new_sizes[d] = my_sizes[d];
+            idx_t nr = nrs[d];
+            if (nr < 2)
+                continue;
+
+            // Average throughput and size of each slab of ranks.
+            vector<double> slab_rates(nr, 0.0);
+            vector<idx_t> slab_counts(nr, 0), slab_sizes(nr, 0);
+            for (int rn = 0; rn < num_ranks; rn++) {
+                idx_t si = coords[rn][d];
+                slab_rates[si] += rates[rn];
+                slab_counts[si]++;
+                slab_sizes[si] = rsizes[rn][d];
+            }
+            double tot_rate = 0.0;
+            idx_t tot_size = 0;
+            for (idx_t si = 0; si < nr; si++) {
+                slab_rates[si] /= max<idx_t>(slab_counts[si], 1);
+                tot_rate += slab_rates[si];
+                tot_size += slab_sizes[si];
+            }
+
+            // Divide total size proportionally, rounding to cluster
+            // multiples and keeping each size at least as big as the
+            // max halo. Adjust the largest one to keep the same total.
+            idx_t min_size = ROUND_UP(max<idx_t>(halos[d], 1), cpts[d]);
+            vector<idx_t> sizes(nr);
+            idx_t sum = 0, imax = 0;
+            for (idx_t si = 0; si < nr; si++) {
+                double frac = slab_rates[si] / tot_rate;
+                idx_t sz = idx_t(tot_size * frac / cpts[d] + 0.5) * cpts[d];
+                sizes[si] = max(sz, min_size);
+                sum += sizes[si];
+                if (sizes[si] > sizes[imax])
+                    imax = si;
+            }
+            sizes[imax] += tot_size - sum;
+            if (sizes[imax] < min_size) {
+                os << " Cannot balance rank-domain sizes in '" << dnames[d] << "' dimension.\n";
+                continue;
+            }
+
+            os << " rank-domain sizes in '" << dnames[d] << "' dimension:";
+            for (idx_t si = 0; si < nr; si++)
+                os << ' ' << slab_sizes[si] << "=>" << sizes[si];
+            os << endl;
+            new_sizes[d] = sizes[my_coords[d]];
+        }
+
+        // Reallocate everything using the original settings
+        // and new sizes.
+        freeAll();
+        *_opts = _user_opts;
+        _opts->dw = new_sizes[0];
+        _opts->dx = new_sizes[1];
+        _opts->dy = new_sizes[2];
+        _opts->dz = new_sizes[3];
+        os << "\nReallocating with balanced rank-domain size " <<
+            _opts->dw << '*' << _opts->dx << '*' << _opts->dy << '*' << _opts->dz <<
+            " on this rank...\n";
+        allocAll();
+#endif
+    }
+
     // Init all grids & params by calling initFn.
     void StencilContext::initValues(function<void (RealVecGridBase* gp, 
                                                    real_t seed)> realVecInitFn,
@@ -1195,7 +1604,7 @@ namespace yask {
                 printWithPow10Multiplier(bb_num_points) <<
                 " valid point(s) inside its bounding-box of " <<
                 printWithPow10Multiplier(bb_size) <<
-                " point(s); slower scalar calculations will be used.\n";
+                " point(s); masked vector calculations will be used.\n";
             bb_simple = false;
         }
 
@@ -1206,7 +1615,7 @@ namespace yask {
                  len_bbz % CLEN_Z) {
             os << "Warning: domain for equation-group '" << get_name() <<
                 "' has one or more sizes that are not vector-cluster multiples;"
-                " slower scalar calculations will be used.\n";
+                " masked vector calculations will be used.\n";
             bb_simple = false;
         }
 
@@ -1217,13 +1626,16 @@ namespace yask {
                  begin_bbz % CLEN_Z) {
             os << "Warning: domain for equation-group '" << get_name() <<
                 "' has one or more edges that do not start on vector-cluster boundaries;"
-                " slower scalar calculations will be used.\n";
+                " masked vector calculations will be used.\n";
             bb_simple = false;
         }
     }
     
     // Exchange halo data needed by eq-group 'eg' at the given time.
     // Data is needed for input grids that have not already been updated.
+    // All faces of all grids are packed in one parallel loop, and
+    // then unpacked in another one. Each face is split into chunks
+    // to balance the work across threads.
     // TODO: overlap halo exchange with computation.
     void StencilContext::exchange_halos(idx_t start_dt, idx_t stop_dt, EqGroupBase& eg)
     {
@@ -1251,235 +1663,461 @@ namespace yask {
         const idx_t group_size_yv = 1;
         const idx_t group_size_zv = 1;
 
-        // 1D array to store send request handles.
-        // We use a 1D array so we can call MPI_Waitall().
-        MPI_Request send_reqs[eg.inputGridPtrs.size() * MPIBufs::neighborhood_size];
-        int num_send_reqs = 0;
-
-        // 2D array for receive request handles.
-        // We use a 2D array to simplify individual indexing.
-        MPI_Request recv_reqs[eg.inputGridPtrs.size()][MPIBufs::neighborhood_size];
-
-        // Sequence of things to do for each grid's neighbors.
-        enum halo_steps { halo_irecv, halo_isend, halo_unpack, halo_nsteps };
-        for (int hi = 0; hi < halo_nsteps; hi++) {
-
-            if (hi == halo_irecv)
-                TRACE_MSG("exchange_halos: requesting data...");
-            else if (hi == halo_isend)
-                TRACE_MSG("exchange_halos: sending data...");
-            else if (hi == halo_unpack)
-                TRACE_MSG("exchange_halos: unpacking data...");
-            
-            // Loop thru all grids.
-            for (size_t gi = 0; gi < eg.inputGridPtrs.size(); gi++) {
-                auto gp = eg.inputGridPtrs[gi];
+        // Approximate number of vectors in each chunk of work.
+#ifndef HALO_CHUNK_VECS
+#define HALO_CHUNK_VECS (1024)
+#endif
 
-                // Only need to swap grids whose halos are not up-to-date.
-                if (gp->is_updated())
-                    continue;
+        // Assume only one time-step to exchange.
+        // TODO: fix this when MPI + wave-front is enabled.
+        assert(stop_dt == start_dt + 1);
+
+        // Synchronize with ranks on the same node if any grid needs to be
+        // exchanged. Since grids are marked as updated in the same order on
+        // all ranks, all ranks in 'shm_comm' will agree on this.
+        bool shm_sync = false;
+        if (is_shm_enabled()) {
+            for (auto gp : eg.inputGridPtrs)
+                if (!gp->is_updated())
+                    shm_sync = true;
+        }
 
-                // Only need to swap grids that have MPI buffers.
-                auto& gname = gp->get_name();
-                if (mpiBufs.count(gname) == 0)
-                    continue;
+        // Work to be done in parallel.
+        vector<HaloWork> pack_work, unpack_work;
+
+        // MPI request handles.
+        vector<MPI_Request> send_reqs, recv_reqs;
+
+        // Stats for each receive request.
+        vector<HaloStats*> recv_stats;
+
+        // Number of chunks left to pack for each send buffer.
+        vector<int> send_chunks;
+
+        // Add work to copy 'work's range to 'work_list', split into
+        // chunks along the largest of the w, x, and y dims.
+        // Return number of chunks.
+        auto add_work = [&](vector<HaloWork>& work_list, const HaloWork& work) {
+            idx_t nvecs = 1;
+            int sd = 0;
+            for (int d = 0; d < 4; d++) {
+                idx_t len = work.end_v[d] - work.begin_v[d];
+                nvecs *= len;
+                if (d < 3 && len > work.end_v[sd] - work.begin_v[sd])
+                    sd = d;
+            }
+            assert(nvecs > 0);
+            idx_t len = work.end_v[sd] - work.begin_v[sd];
+            idx_t nchunks = min(len, CEIL_DIV(nvecs, idx_t(HALO_CHUNK_VECS)));
+            for (idx_t ci = 0; ci < nchunks; ci++) {
+                HaloWork chunk = work;
+                chunk.begin_v[sd] = work.begin_v[sd] + (len * ci) / nchunks;
+                chunk.end_v[sd] = work.begin_v[sd] + (len * (ci + 1)) / nchunks;
+                work_list.push_back(chunk);
+            }
+            return int(nchunks);
+        };
+
+        // Find work and submit requests to receive data from neighbors.
+        TRACE_MSG("exchange_halos: requesting data...");
+        for (size_t gi = 0; gi < eg.inputGridPtrs.size(); gi++) {
+            auto gp = eg.inputGridPtrs[gi];
+
+            // Only need to swap grids whose halos are not up-to-date.
+            if (gp->is_updated())
+                continue;
+
+            // Only need to swap grids that have MPI buffers.
+            auto& gname = gp->get_name();
+            if (mpiBufs.count(gname) == 0)
+                continue;
+            
+            // Determine halo sizes to be exchanged for this grid.  Round up
+            // to vector lengths because the halo exchange only works with
+            // whole vectors. TODO: make this more efficient for halos that
+            // are not vector-length multiples.
+            idx_t ghalos[4] = { ROUND_UP(gp->get_halo_w(), VLEN_W),
+                                ROUND_UP(gp->get_halo_x(), VLEN_X),
+                                ROUND_UP(gp->get_halo_y(), VLEN_Y),
+                                ROUND_UP(gp->get_halo_z(), VLEN_Z) };
+            const idx_t dsizes[4] = { opts.dw, opts.dx, opts.dy, opts.dz };
+            const idx_t ofs[4] = { ofs_w, ofs_x, ofs_y, ofs_z };
+            const idx_t vlens[4] = { VLEN_W, VLEN_X, VLEN_Y, VLEN_Z };
+
+            // Force dummy time value for grids w/o time dim.
+            idx_t t = gp->got_t() ? start_dt : 0;
             
-                // Determine halo sizes to be exchanged for this grid.  Round up
-                // to vector lengths because the halo exchange only works with
-                // whole vectors. TODO: make this more efficient for halos that
-                // are not vector-length multiples.
-                idx_t ghw = ROUND_UP(gp->get_halo_w(), VLEN_W);
-                idx_t ghx = ROUND_UP(gp->get_halo_x(), VLEN_X);
-                idx_t ghy = ROUND_UP(gp->get_halo_y(), VLEN_Y);
-                idx_t ghz = ROUND_UP(gp->get_halo_z(), VLEN_Z);
-
-                // Visit all this rank's neighbors.
-                int ni = 0;
-                mpiBufs[gname].visitNeighbors
-                    (*this, false,
-                     [&](idx_t nw, idx_t nx, idx_t ny, idx_t nz,
-                         int neighbor_rank,
-                         Grid_WXYZ* sendBuf,
-                         Grid_WXYZ* rcvBuf)
-                     {
-                         ni++;
-
-                         // Submit request to receive data from neighbor.
-                         if (hi == halo_irecv) {
-                             TRACE_MSG("exchange_halos: requesting data from rank " <<
-                                       neighbor_rank << " for grid '" << gname << "'...");
-                             void* buf = (void*)(rcvBuf->get_storage());
-                             MPI_Irecv(buf, rcvBuf->get_num_bytes(), MPI_BYTE,
-                                       neighbor_rank, int(gi), comm, &recv_reqs[gi][ni]);
+            // Visit all this rank's neighbors.
+            // Neighbors that share memory with this rank have a view
+            // of their grid instead of MPI buffers.
+            mpiBufs[gname].visitNeighbors
+                (*this, true,
+                 [&](idx_t nw, idx_t nx, idx_t ny, idx_t nz,
+                     int neighbor_rank,
+                     Grid_WXYZ* sendBuf,
+                     Grid_WXYZ* rcvBuf)
+                 {
+                     RealVecGridBase* shmGrid = mpiBufs[gname].shmGrids[nw][nx][ny][nz];
+                     if (!shmGrid && !(sendBuf && rcvBuf))
+                         return;
+                     const idx_t nofs[4] = { nw, nx, ny, nz };
+                     HaloStats& stats = mpiBufs[gname].stats[nw][nx][ny][nz];
+                     stats.num_exchanges++;
+
+                     // Submit request to receive data from neighbor.
+                     if (!shmGrid) {
+                         TRACE_MSG("exchange_halos: requesting data from rank " <<
+                                   neighbor_rank << " for grid '" << gname << "'...");
+                         void* buf = (void*)(rcvBuf->get_storage());
+                         recv_reqs.push_back(MPI_REQUEST_NULL);
+                         recv_stats.push_back(&stats);
+                         double post_start = getTimeInSecs();
+                         MPI_Irecv(buf, rcvBuf->get_num_bytes(), MPI_BYTE,
+                                   neighbor_rank, int(gi), comm, &recv_reqs.back());
+                         double post_time = getTimeInSecs() - post_start;
+                         stats.post_time += post_time;
+                         halo_stats.post_time += post_time;
+                     }
+
+                     // Set ranges for packing and unpacking.
+                     // Init range to whole rank domain (inside halos).
+                     HaloWork send_work, recv_work;
+                     send_work.gp = recv_work.gp = gp;
+                     send_work.t = recv_work.t = t;
+                     send_work.is_send = true;
+                     send_work.neighbor_rank = neighbor_rank;
+                     send_work.tag = int(gi);
+                     send_work.buf = sendBuf;
+                     recv_work.buf = rcvBuf;
+                     recv_work.shmGrid = shmGrid;
+                     send_work.stats = recv_work.stats = &stats;
+                     for (int d = 0; d < 4; d++) {
+                         idx_t sbegin = 0, send = dsizes[d];
+                         idx_t rbegin = 0, rend = dsizes[d];
+
+                         // Region to read from, i.e., data to be put into receiver's halo,
+                         // and region to write to, i.e., this rank's halo.
+                         if (nofs[d] == idx_t(MPIBufs::rank_prev)) {
+                             send = ghalos[d]; // read first halo-width only.
+                             rbegin = -ghalos[d]; // begin at outside of halo.
+                             rend = 0;            // end at inside of halo.
+                         }
+                         else if (nofs[d] == idx_t(MPIBufs::rank_next)) {
+                             sbegin = dsizes[d] - ghalos[d]; // read last halo-width only.
+                             rbegin = dsizes[d];             // begin at inside of halo.
+                             rend = dsizes[d] + ghalos[d];   // end at outside of halo.
                          }
 
-                         // Common code for pack (and send) and unpack.
-                         if (hi == halo_isend || hi == halo_unpack) {
-
-                             // Set begin/end vars to indicate what part
-                             // of main grid to read from or write to.
-                             // Init range to whole rank domain (inside halos).
-                             idx_t begin_w = 0;
-                             idx_t begin_x = 0;
-                             idx_t begin_y = 0;
-                             idx_t begin_z = 0;
-                             idx_t end_w = opts.dw;
-                             idx_t end_x = opts.dx;
-                             idx_t end_y = opts.dy;
-                             idx_t end_z = opts.dz;
-
-                             // Region to read from, i.e., data to be put into receiver's halo.
-                             if (hi == halo_isend) {
-
-                                 // Modify begin and/or end based on direction.
-                                 if (nw == idx_t(MPIBufs::rank_prev)) // neighbor is prev W.
-                                     end_w = ghw; // read first halo-width only.
-                                 if (nw == idx_t(MPIBufs::rank_next)) // neighbor is next W.
-                                     begin_w = opts.dw - ghw; // read last halo-width only.
-                                 if (nx == idx_t(MPIBufs::rank_prev)) // neighbor is on left.
-                                     end_x = ghx;
-                                 if (nx == idx_t(MPIBufs::rank_next)) // neighbor is on right.
-                                     begin_x = opts.dx - ghx;
-                                 if (ny == idx_t(MPIBufs::rank_prev)) // neighbor is in front.
-                                     end_y = ghy;
-                                 if (ny == idx_t(MPIBufs::rank_next)) // neighbor is in back.
-                                     begin_y = opts.dy - ghy;
-                                 if (nz == idx_t(MPIBufs::rank_prev)) // neighbor is above.
-                                     end_z = ghz;
-                                 if (nz == idx_t(MPIBufs::rank_next)) // neighbor is below.
-                                     begin_z = opts.dz - ghz;
-                             }
-
-                             // Region to write to, i.e., this rank's halo.
-                             else if (hi == halo_unpack) {
-
-                                 // Modify begin and/or end based on direction.
-                                 if (nw == idx_t(MPIBufs::rank_prev)) { // neighbor is prev W.
-                                     begin_w = -ghw; // begin at outside of halo.
-                                     end_w = 0;     // end at inside of halo.
-                                 }
-                                 if (nw == idx_t(MPIBufs::rank_next)) { // neighbor is next W.
-                                     begin_w = opts.dw; // begin at inside of halo.
-                                     end_w = opts.dw + ghw; // end of outside of halo.
-                                 }
-                                 if (nx == idx_t(MPIBufs::rank_prev)) { // neighbor is on left.
-                                     begin_x = -ghx;
-                                     end_x = 0;
-                                 }
-                                 if (nx == idx_t(MPIBufs::rank_next)) { // neighbor is on right.
-                                     begin_x = opts.dx;
-                                     end_x = opts.dx + ghx;
-                                 }
-                                 if (ny == idx_t(MPIBufs::rank_prev)) { // neighbor is in front.
-                                     begin_y = -ghy;
-                                     end_y = 0;
-                                 }
-                                 if (ny == idx_t(MPIBufs::rank_next)) { // neighbor is in back.
-                                     begin_y = opts.dy;
-                                     end_y = opts.dy + ghy;
-                                 }
-                                 if (nz == idx_t(MPIBufs::rank_prev)) { // neighbor is above.
-                                     begin_z = -ghz;
-                                     end_z = 0;
-                                 }
-                                 if (nz == idx_t(MPIBufs::rank_next)) { // neighbor is below.
-                                     begin_z = opts.dz;
-                                     end_z = opts.dz + ghz;
-                                 }
-                             }
-
-                             // Add offsets and divide indices by vector
-                             // lengths. Use idiv_flr() because indices may be neg (in halo).
-                             idx_t begin_wv = idiv_flr<idx_t>(ofs_w + begin_w, VLEN_W);
-                             idx_t begin_xv = idiv_flr<idx_t>(ofs_x + begin_x, VLEN_X);
-                             idx_t begin_yv = idiv_flr<idx_t>(ofs_y + begin_y, VLEN_Y);
-                             idx_t begin_zv = idiv_flr<idx_t>(ofs_z + begin_z, VLEN_Z);
-                             idx_t end_wv = idiv_flr<idx_t>(ofs_w + end_w, VLEN_W);
-                             idx_t end_xv = idiv_flr<idx_t>(ofs_x + end_x, VLEN_X);
-                             idx_t end_yv = idiv_flr<idx_t>(ofs_y + end_y, VLEN_Y);
-                             idx_t end_zv = idiv_flr<idx_t>(ofs_z + end_z, VLEN_Z);
-
-                             // Assume only one time-step to exchange.
-                             // TODO: fix this when MPI + wave-front is enabled.
-                             assert(stop_dt = start_dt + 1);
-                             idx_t t = start_dt;
-
-                             // Force dummy time value for grids w/o time dim.
-                             if (!gp->got_t())
-                                 t = 0;
-
-                             // Wait for data.
-                             if (hi == halo_unpack) {
-                                 TRACE_MSG("exchange_halos: waiting for data from rank " <<
-                                           neighbor_rank << " for grid '" << gname << "'...");
-                                 MPI_Wait(&recv_reqs[gi][ni], MPI_STATUS_IGNORE);
-                                 TRACE_MSG("exchange_halos: done waiting for data.");
-                             }
-
-                             // Define calc_halo to copy data between main grid and MPI buffer.
-                             // Add a short loop in z-dim to increase work done in halo loop.
-                             // Use 'index_*' vars to access buffers because they are always 0-based.
+                         // Add offsets and divide indices by vector
+                         // lengths. Use idiv_flr() because indices may be neg (in halo).
+                         send_work.begin_v[d] = send_work.buf_begin_v[d] =
+                             idiv_flr<idx_t>(ofs[d] + sbegin, vlens[d]);
+                         send_work.end_v[d] = idiv_flr<idx_t>(ofs[d] + send, vlens[d]);
+                         recv_work.begin_v[d] = recv_work.buf_begin_v[d] =
+                             idiv_flr<idx_t>(ofs[d] + rbegin, vlens[d]);
+                         recv_work.end_v[d] = idiv_flr<idx_t>(ofs[d] + rend, vlens[d]);
+                     }
+
+                     // Nothing to send to neighbors that read directly from this rank.
+                     idx_t send_bytes = 0, recv_bytes = 0;
+                     if (!shmGrid) {
+                         send_work.buf_idx = int(send_reqs.size());
+                         send_reqs.push_back(MPI_REQUEST_NULL);
+                         send_chunks.push_back(add_work(pack_work, send_work));
+                         send_bytes = sendBuf->get_num_bytes();
+                         recv_bytes = rcvBuf->get_num_bytes();
+                     }
+                     else {
+                         recv_bytes = sizeof(real_vec_t);
+                         for (int d = 0; d < 4; d++)
+                             recv_bytes *= recv_work.end_v[d] - recv_work.begin_v[d];
+                     }
+                     add_work(unpack_work, recv_work);
+                     stats.send_bytes += send_bytes;
+                     stats.recv_bytes += recv_bytes;
+                     halo_stats.send_bytes += send_bytes;
+                     halo_stats.recv_bytes += recv_bytes;
+                 } ); // visit neighbors.
+        } // grids.
+
+        // Define calc_halo to copy data between main grid and MPI buffer
+        // or neighbor's grid.
+        // Add a short loop in z-dim to increase work done in halo loop.
+        // Buffer indices are relative to the beginning of the whole buffer,
+        // not the chunk. Neighbors' grids in shared memory use the same
+        // indices as the main grid.
 #define calc_halo(t,                                                    \
                   start_wv, start_xv, start_yv, start_zv,               \
                   stop_wv, stop_xv, stop_yv, stop_zv)  do {             \
-                                 idx_t wv = start_wv;                   \
-                                 idx_t xv = start_xv;                   \
-                                 idx_t yv = start_yv;                   \
-                                 idx_t izv = index_zv * step_zv;        \
-                                 if (hi == halo_isend) {                \
-                                     for (idx_t zv = start_zv; zv < stop_zv; zv++) { \
-                                         real_vec_t hval =              \
-                                             gp->readVecNorm_TWXYZ(t, wv, xv, yv, zv, \
-                                                                   __LINE__); \
-                                         sendBuf->writeVecNorm(hval, index_wv, index_xv, index_yv, izv++, \
-                                                               __LINE__); \
-                                     }                                  \
-                                 } else if (hi == halo_unpack) {        \
-                                     for (idx_t zv = start_zv; zv < stop_zv; zv++) { \
-                                         real_vec_t hval =              \
-                                             rcvBuf->readVecNorm(index_wv, index_xv, index_yv, izv++, \
-                                                                 __LINE__); \
-                                         gp->writeVecNorm_TWXYZ(hval, t, wv, xv, yv, zv, \
-                                                                __LINE__); \
-                                     } } } while(0)
-
-                             // Include auto-generated loops to invoke calc_halo() from
-                             // begin_*v to end_*v by step_*v.
+            idx_t wv = start_wv;                                        \
+            idx_t xv = start_xv;                                        \
+            idx_t yv = start_yv;                                        \
+            idx_t iwv = wv - work.buf_begin_v[0];                       \
+            idx_t ixv = xv - work.buf_begin_v[1];                       \
+            idx_t iyv = yv - work.buf_begin_v[2];                       \
+            idx_t izv = start_zv - work.buf_begin_v[3];                 \
+            if (work.shmGrid) {                                         \
+                for (idx_t zv = start_zv; zv < stop_zv; zv++) {         \
+                    real_vec_t hval =                                   \
+                        work.shmGrid->readVecNorm_TWXYZ(t, wv, xv, yv, zv, \
+                                                        __LINE__);      \
+                    work.gp->writeVecNorm_TWXYZ(hval, t, wv, xv, yv, zv, \
+                                                __LINE__);              \
+                }                                                       \
+            } else if (work.is_send) {                                  \
+                for (idx_t zv = start_zv; zv < stop_zv; zv++) {        \
+                    real_vec_t hval =                                   \
+                        work.gp->readVecNorm_TWXYZ(t, wv, xv, yv, zv,   \
+                                                   __LINE__);           \
+                    work.buf->writeVecNorm(hval, iwv, ixv, iyv, izv++,  \
+                                           __LINE__);                   \
+                }                                                       \
+            } else {                                                    \
+                for (idx_t zv = start_zv; zv < stop_zv; zv++) {         \
+                    real_vec_t hval =                                   \
+                        work.buf->readVecNorm(iwv, ixv, iyv, izv++,     \
+                                              __LINE__);                \
+                    work.gp->writeVecNorm_TWXYZ(hval, t, wv, xv, yv, zv, \
+                                                __LINE__);              \
+                }                                                       \
+            } } while(0)
+
+        // Copy data for one chunk of work.
+        auto do_work = [&](const HaloWork& work) {
+            idx_t t = work.t;
+            idx_t begin_wv = work.begin_v[0];
+            idx_t begin_xv = work.begin_v[1];
+            idx_t begin_yv = work.begin_v[2];
+            idx_t begin_zv = work.begin_v[3];
+            idx_t end_wv = work.end_v[0];
+            idx_t end_xv = work.end_v[1];
+            idx_t end_yv = work.end_v[2];
+            idx_t end_zv = work.end_v[3];
+
+            // Include auto-generated loops to invoke calc_halo() from
+            // begin_*v to end_*v by step_*v.
 #include "stencil_halo_loops.hpp"
-#undef calc_halo
-
-                             // Send filled buffer to neighbor.
-                             if (hi == halo_isend) {
-                                 TRACE_MSG("exchange_halos: sending data to rank " <<
-                                           neighbor_rank << " for grid '" << gname << "'...");
-                                 const void* buf = (const void*)(sendBuf->get_storage());
-                                 MPI_Isend(buf, sendBuf->get_num_bytes(), MPI_BYTE,
-                                           neighbor_rank, int(gi), comm, &send_reqs[num_send_reqs++]);
-                             }
-                         } // not receive.
-                     } ); // visit neighbors.
-                
-                // Mark this grid as up-to-date.
-                if (hi == halo_unpack) {
-                    gp->set_updated(true);
-                    TRACE_MSG("exchange_halos: grid '" << gp->get_name() << "' is updated");
+        };
+        
+        // Pack all buffers in one parallel loop.  Send each buffer as soon
+        // as its last chunk is packed. MPI calls are serialized because
+        // only MPI_THREAD_SERIALIZED is required.
+        TRACE_MSG("exchange_halos: packing and sending " << pack_work.size() <<
+                  " chunk(s) of data...");
+        if (pack_work.size() || unpack_work.size())
+            halo_stats.num_exchanges++;
+        double phase_start = getTimeInSecs();
+#pragma omp parallel for schedule(dynamic, 1)
+        for (size_t wi = 0; wi < pack_work.size(); wi++) {
+            auto& work = pack_work[wi];
+            double pack_start = getTimeInSecs();
+            do_work(work);
+            double pack_time = getTimeInSecs() - pack_start;
+#pragma omp atomic
+            work.stats->pack_time += pack_time;
+
+            int nleft;
+#pragma omp atomic capture
+            nleft = --send_chunks[work.buf_idx];
+            if (nleft == 0) {
+                const void* buf = (const void*)(work.buf->get_storage());
+#pragma omp critical (yask_mpi)
+                {
+                    double post_start = getTimeInSecs();
+                    MPI_Isend(buf, work.buf->get_num_bytes(), MPI_BYTE,
+                              work.neighbor_rank, work.tag, comm, &send_reqs[work.buf_idx]);
+                    double post_time = getTimeInSecs() - post_start;
+                    work.stats->post_time += post_time;
+                    halo_stats.post_time += post_time;
                 }
-                
-            } // grids.
+            }
+        }
+        double phase_end = getTimeInSecs();
+        halo_stats.pack_time += phase_end - phase_start;
+        phase_start = phase_end;
+
+        // Before unpacking, wait for ranks on the same node to finish
+        // updating the grids that will be read directly.
+        if (shm_sync) {
+            TRACE_MSG("exchange_halos: waiting for ranks on this node...");
+            MPI_Win_sync(shm_win);
+            MPI_Barrier(shm_comm);
+            MPI_Win_sync(shm_win);
+        }
 
-        } // halo sequence.
+        // Wait for all data to arrive. Wait for each request separately
+        // to attribute the waiting time to each grid and neighbor.
+        TRACE_MSG("exchange_halos: waiting for " << recv_reqs.size() << " MPI receive request(s)...");
+        for (size_t ri = 0; ri < recv_reqs.size(); ri++) {
+            double wait_start = getTimeInSecs();
+            MPI_Wait(&recv_reqs[ri], MPI_STATUS_IGNORE);
+            recv_stats[ri]->wait_time += getTimeInSecs() - wait_start;
+        }
+        TRACE_MSG("exchange_halos: done waiting for MPI receive request(s).");
+        phase_end = getTimeInSecs();
+        halo_stats.wait_time += phase_end - phase_start;
+        phase_start = phase_end;
+
+        // Unpack all buffers in one parallel loop.
+        TRACE_MSG("exchange_halos: unpacking " << unpack_work.size() <<
+                  " chunk(s) of data...");
+#pragma omp parallel for schedule(dynamic, 1)
+        for (size_t wi = 0; wi < unpack_work.size(); wi++) {
+            auto& work = unpack_work[wi];
+            double unpack_start = getTimeInSecs();
+            do_work(work);
+            double unpack_time = getTimeInSecs() - unpack_start;
+#pragma omp atomic
+            work.stats->unpack_time += unpack_time;
+        }
+#undef calc_halo
+        phase_end = getTimeInSecs();
+        halo_stats.unpack_time += phase_end - phase_start;
+        phase_start = phase_end;
+
+        // Mark grids as up-to-date. This includes grids that did not
+        // need any buffers, so the state is the same on all ranks.
+        for (auto gp : eg.inputGridPtrs) {
+            if (!gp->is_updated()) {
+                gp->set_updated(true);
+                TRACE_MSG("exchange_halos: grid '" << gp->get_name() << "' is updated");
+            }
+        }
 
         // Wait for all send requests to complete.
         // TODO: delay this until next attempted halo exchange.
-        TRACE_MSG("exchange_halos: waiting for " << num_send_reqs << " MPI send request(s)...");
-        MPI_Waitall(num_send_reqs, send_reqs, MPI_STATUS_IGNORE);
+        TRACE_MSG("exchange_halos: waiting for " << send_reqs.size() << " MPI send request(s)...");
+        MPI_Waitall(int(send_reqs.size()), send_reqs.data(), MPI_STATUSES_IGNORE);
         TRACE_MSG("exchange_halos: done waiting for MPI send request(s).");
+
+        // Wait for ranks on the same node to finish reading from this
+        // rank's grids before they are modified.
+        if (shm_sync) {
+            TRACE_MSG("exchange_halos: waiting for ranks on this node to finish reading...");
+            MPI_Barrier(shm_comm);
+        }
         
         double end_time = getTimeInSecs();
+        halo_stats.wait_time += end_time - phase_start;
         mpi_time += end_time - start_time;
 #endif
     }
 
+    // Reset halo-exchange stats.
+    void StencilContext::clearHaloStats()
+    {
+        halo_stats = HaloStats();
+        for (auto& i : mpiBufs) {
+            HaloStats* sp = &i.second.stats[0][0][0][0];
+            for (int si = 0; si < MPIBufs::neighborhood_size; si++)
+                sp[si] = HaloStats();
+        }
+    }
+
+    // Print halo-exchange stats for all grids and for each grid and
+    // neighbor. Each value is reduced to min, avg, and max over the ranks
+    // that exchanged with that neighbor.
+    void StencilContext::printHaloStats(ostream& os)
+    {
+#ifdef USE_MPI
+        if (num_ranks < 2)
+            return;
+
+        // Vals for each set of stats: totals first, then each grid and
+        // neighbor.  Rates are bytes sent and received divided by the
+        // sum of the times.
+        enum { send_bytes, recv_bytes, pack_time, post_time, wait_time, unpack_time,
+               rate, nvals };
+        const char* val_names[nvals] = {
+            "bytes sent:                 ",
+            "bytes received:             ",
+            "pack time (sec):            ",
+            "post time (sec):            ",
+            "wait time (sec):            ",
+            "unpack time (sec):          ",
+            "effective rate (GB/sec):    " };
+        size_t nsets = 1 + gridPtrs.size() * MPIBufs::neighborhood_size;
+        vector<double> mins(nsets * nvals), maxs(nsets * nvals), sums(nsets * nvals);
+        vector<double> counts(nsets);
+        auto add_stats = [&](size_t si, const HaloStats* hs) {
+            double* v = &sums[si * nvals];
+            if (hs && hs->num_exchanges) {
+                v[send_bytes] = double(hs->send_bytes);
+                v[recv_bytes] = double(hs->recv_bytes);
+                v[pack_time] = hs->pack_time;
+                v[post_time] = hs->post_time;
+                v[wait_time] = hs->wait_time;
+                v[unpack_time] = hs->unpack_time;
+                double tot_time = hs->pack_time + hs->post_time +
+                    hs->wait_time + hs->unpack_time;
+                v[rate] = tot_time > 0.0 ?
+                    double(hs->send_bytes + hs->recv_bytes) / tot_time * 1e-9 : 0.0;
+                counts[si] = 1.0;
+                for (int vi = 0; vi < nvals; vi++)
+                    mins[si * nvals + vi] = maxs[si * nvals + vi] = v[vi];
+            } else {
+                for (int vi = 0; vi < nvals; vi++) {
+                    mins[si * nvals + vi] = DBL_MAX;
+                    maxs[si * nvals + vi] = -DBL_MAX;
+                }
+            }
+        };
+        add_stats(0, &halo_stats);
+        for (size_t gi = 0; gi < gridPtrs.size(); gi++) {
+            auto& gname = gridPtrs[gi]->get_name();
+            const HaloStats* sp = mpiBufs.count(gname) ?
+                &mpiBufs[gname].stats[0][0][0][0] : 0;
+            for (int ni = 0; ni < MPIBufs::neighborhood_size; ni++)
+                add_stats(1 + gi * MPIBufs::neighborhood_size + ni, sp ? sp + ni : 0);
+        }
+        MPI_Allreduce(MPI_IN_PLACE, mins.data(), int(mins.size()), MPI_DOUBLE, MPI_MIN, comm);
+        MPI_Allreduce(MPI_IN_PLACE, maxs.data(), int(maxs.size()), MPI_DOUBLE, MPI_MAX, comm);
+        MPI_Allreduce(MPI_IN_PLACE, sums.data(), int(sums.size()), MPI_DOUBLE, MPI_SUM, comm);
+        MPI_Allreduce(MPI_IN_PLACE, counts.data(), int(counts.size()), MPI_DOUBLE, MPI_SUM, comm);
+
+        // Print one set of stats.
+        auto print_stats = [&](size_t si, const string& descr) {
+            if (counts[si] == 0.0)
+                return;
+            os << " " << descr << " (" << int(counts[si]) << " rank(s)):\n";
+            for (int vi = 0; vi < nvals; vi++) {
+                size_t i = si * nvals + vi;
+                os << "  " << val_names[vi] <<
+                    printWithPow10Multiplier(mins[i]) << " / " <<
+                    printWithPow10Multiplier(sums[i] / counts[si]) << " / " <<
+                    printWithPow10Multiplier(maxs[i]) << endl;
+            }
+        };
+        os << "\nHalo-exchange stats (min / avg / max across ranks):\n";
+        print_stats(0, "All grids and neighbors");
+        const char* dnames[] = { "w", "x", "y", "z" };
+        for (size_t gi = 0; gi < gridPtrs.size(); gi++) {
+            for (int ni = 0; ni < MPIBufs::neighborhood_size; ni++) {
+
+                // Make a string like 'x-1,y+1' for the direction.
+                // The index is w, x, y, z in row-major order.
+                const int nn = MPIBufs::num_neighbors;
+                const int nofs[4] = { ni / (nn * nn * nn), ni / (nn * nn) % nn,
+                                      ni / nn % nn, ni % nn };
+                string dir;
+                for (int d = 0; d < 4; d++) {
+                    int ofs = nofs[d];
+                    if (ofs == MPIBufs::rank_prev)
+                        dir += string(dir.length() ? "," : "") + dnames[d] + "-1";
+                    else if (ofs == MPIBufs::rank_next)
+                        dir += string(dir.length() ? "," : "") + dnames[d] + "+1";
+                }
+                print_stats(1 + gi * MPIBufs::neighborhood_size + ni,
+                            "Grid '" + gridPtrs[gi]->get_name() + "' with neighbor at " + dir);
+            }
+        }
+        os << " Times for each grid and neighbor are summed over threads.\n"
+            " Times for all grids and neighbors are elapsed times, where post time\n"
+            "  for sends overlaps pack time.\n"
+            " Effective rate is bytes sent and received divided by the sum of the times.\n";
+#endif
+    }
+
     // Mark grids that have been written to by eq-group 'eg'.
     // TODO: only mark grids that are written to in their halo-read area.
     void StencilContext::mark_grids_dirty(EqGroupBase& eg)
@@ -1515,6 +2153,57 @@ namespace yask {
                         }
     }
 
+    // Apply a function to each neighbor rank that shares memory with this rank.
+    // Called visitor function will contain the index of the neighbor in 'shm_comm'.
+    void MPIBufs::visitShmNeighbors(StencilContext& context,
+                                    std::function<void (idx_t nw, idx_t nx, idx_t ny, idx_t nz,
+                                                        int shm_rank,
+                                                        RealVecGridBase* shmGrid)> visitor)
+    {
+        for (idx_t nw = 0; nw < num_neighbors; nw++)
+            for (idx_t nx = 0; nx < num_neighbors; nx++)
+                for (idx_t ny = 0; ny < num_neighbors; ny++)
+                    for (idx_t nz = 0; nz < num_neighbors; nz++)
+                        if (context.my_shm_neighbors[nw][nx][ny][nz] != MPI_PROC_NULL) {
+                            RealVecGridBase* shmGrid = shmGrids[nw][nx][ny][nz];
+                            if (shmGrid) {
+                                visitor(nw, nx, ny, nz,
+                                        context.my_shm_neighbors[nw][nx][ny][nz],
+                                        shmGrid);
+                            }
+                        }
+    }
+
+    // Create a view into a neighbor's copy of grid 'gp'.
+    // Does not yet set its padding, offsets, or storage.
+    RealVecGridBase* MPIBufs::makeShmGrid(idx_t nw, idx_t nx, idx_t ny, idx_t nz,
+                                          const RealVecGridBase* gp,
+                                          idx_t dw, idx_t dx, idx_t dy, idx_t dz,
+                                          const std::string& name)
+    {
+        TRACE_MSG0(cout, "making shared-memory view '" << name << "' at " <<
+                   nw << ", " << nx << ", " << ny << ", " << nz << " with size " <<
+                   dw << " * " << dx << " * " << dy << " * " << dz);
+        assert(nw >= 0 && nw < num_neighbors);
+        assert(nx >= 0 && nx < num_neighbors);
+        assert(ny >= 0 && ny < num_neighbors);
+        assert(nz >= 0 && nz < num_neighbors);
+        RealVecGridBase* sgp = gp->new_like(name);
+        assert(sgp);
+
+        // Halos are same as this rank's; domain size is neighbor's.
+        sgp->set_halo_w(gp->get_halo_w());
+        sgp->set_halo_x(gp->get_halo_x());
+        sgp->set_halo_y(gp->get_halo_y());
+        sgp->set_halo_z(gp->get_halo_z());
+        sgp->set_dw(dw);
+        sgp->set_dx(dx);
+        sgp->set_dy(dy);
+        sgp->set_dz(dz);
+        shmGrids[nw][nx][ny][nz] = sgp;
+        return sgp;
+    }
+
     // Create new buffer in given direction and size.
     // Does not yet allocate space in it.
     Grid_WXYZ* MPIBufs::makeBuf(int bd,
@@ -1592,6 +2281,17 @@ namespace yask {
                           ("msg_rank",
                            "Rank that will print informational messages.",
                            msg_rank));
+        parser.add_option(new CommandLineParser::IntOption
+                          ("balance_steps",
+                           "Number of time-steps to run to measure the throughput of each rank "
+                           "before adjusting rank-domain sizes to balance the load. "
+                           "Zero disables balancing.",
+                           balance_steps));
+        parser.add_option(new CommandLineParser::BoolOption
+                          ("use_shm",
+                           "Exchange halos with ranks on the same node by reading their grids "
+                           "directly from an MPI shared-memory window.",
+                           use_shm));
 #endif
         parser.add_option(new CommandLineParser::IntOption
                           ("max_threads",
@@ -1605,6 +2305,28 @@ namespace yask {
                           ("block_threads",
                            "Number of threads to use within each block.",
                            num_block_threads));
+        parser.add_option(new CommandLineParser::IntOption
+                          ("rank_loop_variant",
+                           "Index of generated loop-code variant to use for rank loops.",
+                           rank_loop_variant));
+        parser.add_option(new CommandLineParser::IntOption
+                          ("region_loop_variant",
+                           "Index of generated loop-code variant to use for region loops.",
+                           region_loop_variant));
+        parser.add_option(new CommandLineParser::IntOption
+                          ("block_loop_variant",
+                           "Index of generated loop-code variant to use for block loops.",
+                           block_loop_variant));
+        parser.add_option(new CommandLineParser::IntOption
+                          ("sub_block_loop_variant",
+                           "Index of generated loop-code variant to use for sub-block loops.",
+                           sub_block_loop_variant));
+        parser.add_option(new CommandLineParser::BoolOption
+                          ("ref_rows",
+                           "Evaluate the reference code for validation a row at a time, "
+                           "allowing the C++ compiler to vectorize it, instead of one point at a time. "
+                           "Faster, but the compiler may change the FP rounding of the reference.",
+                           ref_rows));
     }
     
     // Print usage message.
@@ -1686,13 +2408,30 @@ namespace yask {
             "  Num threads per region = max_threads / thread_divisor / block_threads.\n"
             "  Num threads per block = block_threads.\n"
             "  Num threads per sub-block = 1.\n"
-            "  Num threads used for halo exchange is same as num per region.\n" <<
+            "  Num threads used for halo exchange is same as num per region.\n"
+            "Selecting loop code:\n"
+            " Loop code for each level may be generated in several variants,\n"
+            "  e.g., with different orders, paths, or prefetching, via the\n"
+            "  RANK_LOOP_VARIANTS, REGION_LOOP_VARIANTS, BLOCK_LOOP_VARIANTS, and\n"
+            "  SUB_BLOCK_LOOP_VARIANTS make vars.\n"
+            " Use the -*_loop_variant options to select which one runs.\n"
+            "  Variant 0 is the default loop code for each level.\n"
+            "  This binary has " << NUM_RANK_LOOP_VARIANTS << ", " <<
+            NUM_REGION_LOOP_VARIANTS << ", " << NUM_BLOCK_LOOP_VARIANTS << ", and " <<
+            NUM_SUB_BLOCK_LOOP_VARIANTS << " variant(s) for the rank, region, block,\n"
+            "   and sub-block loops, respectively.\n" <<
 #ifdef USE_MPI
             "Controlling MPI scaling:\n"
             "  To 'weak-scale' to a larger overall-problem size, use multiple MPI ranks\n"
             "   and keep the rank-domain sizes constant.\n"
             "  To 'strong-scale' a given overall-problem size, use multiple MPI ranks\n"
-            "   and reduce the size of each rank-domain appropriately.\n" <<
+            "   and reduce the size of each rank-domain appropriately.\n"
+            "  Using '-use_shm' => halos are copied directly from the grids of\n"
+            "   neighboring ranks on the same node instead of through MPI buffers.\n"
+            "  Using '-balance_steps <integer>' => rank-domain sizes are adjusted in\n"
+            "   each dimension in proportion to the measured throughput of each rank.\n"
+            "   The sizes given by -d* are the starting sizes, and the overall-problem\n"
+            "   size is not changed.\n" <<
 #endif
             appNotes <<
             "Examples:\n" <<
@@ -1813,6 +2552,23 @@ namespace yask {
             nsbz = findNumSubBlocksInSubBlockGroup(os, sbz, sbgz, CPTS_Z, "z");
             nsb = nsbw * nsbx * nsby * nsbz;
             os << " num-sub-blocks-per-sub-block-group: " << nsb << endl;
+
+            // Make sure the selected loop-code variants were generated.
+            os << "\nLoop-code variants:" << endl;
+            auto checkVariant = [&](int variant, int num_variants, const string& level) {
+                if (variant < 0 || variant >= num_variants) {
+                    cerr << "error: " << level << "-loop variant " << variant <<
+                        " requested, but only " << num_variants <<
+                        " variant(s) were generated." << endl;
+                    exit_yask(1);
+                }
+                os << " " << level << "-loop-variant: " << variant <<
+                    " of " << num_variants << endl;
+            };
+            checkVariant(rank_loop_variant, NUM_RANK_LOOP_VARIANTS, "rank");
+            checkVariant(region_loop_variant, NUM_REGION_LOOP_VARIANTS, "region");
+            checkVariant(block_loop_variant, NUM_BLOCK_LOOP_VARIANTS, "block");
+            checkVariant(sub_block_loop_variant, NUM_SUB_BLOCK_LOOP_VARIANTS, "sub-block");
         }
 
 } // namespace yask.
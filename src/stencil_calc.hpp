@@ -45,6 +45,19 @@ namespace yask {
 
     // Forward defn.
     struct StencilContext;
+
+    // Halo-exchange stats for one grid and neighbor or for all of them.
+    // For one grid and neighbor, pack and unpack times are summed over
+    // threads. For all of them, pack, wait, and unpack times are
+    // wall-clock times.
+    struct HaloStats {
+        idx_t num_exchanges = 0;
+        idx_t send_bytes = 0, recv_bytes = 0;
+        double pack_time = 0.0;   // copying from grid to buffers.
+        double post_time = 0.0;   // posting MPI sends and receives.
+        double wait_time = 0.0;   // waiting for MPI and other ranks.
+        double unpack_time = 0.0; // copying from buffers or neighbors to grid.
+    };
     
     // MPI buffers for *one* grid.
     struct MPIBufs {
@@ -64,8 +77,18 @@ namespace yask {
         typedef Grid_WXYZ* NeighborBufs[nBufDirs][num_neighbors][num_neighbors][num_neighbors][num_neighbors];
         NeighborBufs bufs;
 
+        // A type to store views into the grids of neighbors that
+        // share memory with this rank. These are used to read halo
+        // data directly instead of using MPI buffers.
+        typedef RealVecGridBase* NeighborGrids[num_neighbors][num_neighbors][num_neighbors][num_neighbors];
+        NeighborGrids shmGrids;
+
+        // Halo-exchange stats for each neighbor.
+        HaloStats stats[num_neighbors][num_neighbors][num_neighbors][num_neighbors];
+
         MPIBufs() {
             memset(bufs, 0, sizeof(bufs));
+            memset(shmGrids, 0, sizeof(shmGrids));
         }
 
         // Access a buffer by direction and 4D neighbor indices.
@@ -95,11 +118,44 @@ namespace yask {
                                                         Grid_WXYZ* sendBuf,
                                                         Grid_WXYZ* rcvBuf)> visitor);
             
+        // Apply a function to each neighbor rank that shares memory
+        // with this rank. Called visitor function will contain the
+        // index of the neighbor in the context's 'shm_comm'.
+        virtual void visitShmNeighbors(StencilContext& context,
+                                       std::function<void (idx_t nw, idx_t nx, idx_t ny, idx_t nz,
+                                                           int shm_rank,
+                                                           RealVecGridBase* shmGrid)> visitor);
+
         // Create new buffer in given direction and size.
         virtual Grid_WXYZ* makeBuf(int bd,
                                    idx_t nw, idx_t nx, idx_t ny, idx_t nz,
                                    idx_t dw, idx_t dx, idx_t dy, idx_t dz,
                                    const std::string& name);
+
+        // Create a view into a neighbor's copy of grid 'gp'.
+        // The neighbor's domain size is given by dw, dx, dy, dz.
+        // Does not yet set its storage or offsets.
+        virtual RealVecGridBase* makeShmGrid(idx_t nw, idx_t nx, idx_t ny, idx_t nz,
+                                             const RealVecGridBase* gp,
+                                             idx_t dw, idx_t dx, idx_t dy, idx_t dz,
+                                             const std::string& name);
+    };
+
+    // A unit of work for packing or unpacking halos: a range of one grid
+    // to be copied to or from one neighbor's buffer or grid.  Ranges are
+    // in vector units, in w, x, y, z order.
+    struct HaloWork {
+        RealVecGridBase* gp = 0;      // this rank's grid.
+        Grid_WXYZ* buf = 0;           // MPI buffer to copy to or from.
+        RealVecGridBase* shmGrid = 0; // neighbor's grid to copy from if in shared memory.
+        bool is_send = false;         // copy from 'gp' to 'buf' if true.
+        int neighbor_rank = 0;        // rank to send 'buf' to.
+        int tag = 0;                  // MPI tag for sending 'buf'.
+        int buf_idx = 0;              // index of MPI request for sending 'buf'.
+        HaloStats* stats = 0;         // stats for this grid and neighbor.
+        idx_t t = 0;                  // time index.
+        idx_t begin_v[4], end_v[4];   // range to copy.
+        idx_t buf_begin_v[4];         // grid indices of first element in 'buf'.
     };
 
     // Application settings to control size and perf of stencil code.
@@ -122,12 +178,21 @@ namespace yask {
         idx_t riw=0, rix=0, riy=0, riz=0; // my rank index in each dim.
         bool find_loc=true;            // whether my rank index needs to be calculated.
         int msg_rank=0;             // rank that prints informational messages.
+        bool use_shm=false;         // read halos directly from ranks on the same node.
+        int balance_steps=0;        // steps to run to balance rank-domain sizes (0 => don't).
 
         // OpenMP settings.
         int max_threads;        // Initial number of threads to use overall.
         int thread_divisor=1;   // Reduce number of threads by this amount.
         int num_block_threads=1; // Number of threads to use for a block.
 
+        // Generated loop-code variants to run at each level.
+        int rank_loop_variant=0, region_loop_variant=0,
+            block_loop_variant=0, sub_block_loop_variant=0;
+
+        // Validation settings.
+        bool ref_rows=false;    // evaluate reference code by rows instead of points.
+
         // Ctor.
         StencilSettings() {
             max_threads = omp_get_max_threads();
@@ -205,6 +270,11 @@ namespace yask {
         // Command-line and env parameters.
         StencilSettings* _opts;
 
+        // Copy of parameters before they were adjusted by the first
+        // call to allocAll(), for use when reallocating.
+        StencilSettings _user_opts;
+        bool _user_opts_saved = false;
+
         // Underlying data allocation.
         // TODO: create different types of memory, e.g., HBM.
         void* _data_buf = 0;
@@ -240,6 +310,11 @@ namespace yask {
         GridPtrs outputGridPtrs;
         GridPtrMap outputGridMap;
 
+        // Lists of grids that share one allocation, interleaved by
+        // vector, i.e., an array of structures of vectors. Grids in a list
+        // must have the same type and sizes.
+        std::vector<GridPtrs> fusedGridPtrs;
+
         // Non-grid parameters.
         ParamPtrs paramPtrs;
         ParamPtrMap paramMap;
@@ -273,8 +348,16 @@ namespace yask {
         MPI_Comm comm=0;
         int num_ranks=1, my_rank=0;   // MPI-assigned index.
         double mpi_time=0.0;          // time spent doing MPI.
+        HaloStats halo_stats;         // halo-exchange stats for all grids.
         MPIBufs::Neighbors my_neighbors;   // neighbor ranks.
 
+        // MPI shared-memory environment.
+        // Ranks in 'shm_comm' are on the same node as this one.
+        MPI_Comm shm_comm=0;
+        int num_shm_ranks=1, my_shm_rank=0; // index in 'shm_comm'.
+        MPIBufs::Neighbors my_shm_neighbors; // neighbor ranks in 'shm_comm'.
+        MPI_Win shm_win=0;                   // window containing '_data_buf'.
+
         // Actual MPI buffers.
         // MPI buffers are tagged by their grid names.
         std::map<std::string, MPIBufs> mpiBufs;
@@ -288,6 +371,11 @@ namespace yask {
             int *p = (int *)my_neighbors;
             for (int i = 0; i < MPIBufs::neighborhood_size; i++)
                 p[i] = MPI_PROC_NULL;
+
+            // Same for my_shm_neighbors.
+            p = (int *)my_shm_neighbors;
+            for (int i = 0; i < MPIBufs::neighborhood_size; i++)
+                p[i] = MPI_PROC_NULL;
         }
 
         // Destructor.
@@ -326,10 +414,28 @@ namespace yask {
         // Called from allocAll(), so it doesn't normally need to be called from user code.
         virtual void allocData();
 
+        // Whether halos are read directly from ranks on the same node.
+        virtual bool is_shm_enabled() const {
+            return _opts->use_shm && num_shm_ranks > 1;
+        }
+
+        // Point the views of the neighbors' grids to their storage.
+        // Called from allocData(), so it doesn't normally need to be called from user code.
+        virtual void setupShmGrids();
+
         // Allocate grids, params, MPI bufs, etc.
         // Initialize some other data structures.
         // Print lots of stats.
         virtual void allocAll();
+
+        // Free grid, param, and MPI memory and MPI bufs, so
+        // allocAll() can be called again.
+        virtual void freeAll();
+
+        // Measure the throughput of each rank over a few steps, adjust
+        // rank-domain sizes to balance the load, and reallocate.
+        // Does nothing unless 'balance_steps' is set.
+        virtual void balanceRanks();
         
         // Get total memory allocation.
         virtual size_t get_num_bytes() {
@@ -433,6 +539,13 @@ namespace yask {
         // Exchange halo data needed by eq-group 'eg' at the given time.
         virtual void exchange_halos(idx_t start_dt, idx_t stop_dt, EqGroupBase& eg);
 
+        // Reset halo-exchange stats.
+        virtual void clearHaloStats();
+
+        // Print halo-exchange stats as min/avg/max across ranks.
+        // Must be called on all ranks.
+        virtual void printHaloStats(std::ostream& os);
+
         // Mark grids that have been written to by eq-group 'eg'.
         virtual void mark_grids_dirty(EqGroupBase& eg);
         
@@ -505,6 +618,11 @@ namespace yask {
         // Set the bounding-box vars for this eq group in this rank.
         virtual void find_bounding_box();
 
+        // Evaluate any expressions that have the same value in every
+        // cluster, e.g., products of parameters.
+        // Must be called after parameters are set and before calc_cluster().
+        virtual void init_invariants() { }
+
         // Determine whether indices are in [sub-]domain.
         virtual bool
         is_in_valid_domain(idx_t t, ARG_W(idx_t w) idx_t x, idx_t y, idx_t z) =0;
@@ -513,6 +631,12 @@ namespace yask {
         virtual void
         calc_scalar(idx_t t, ARG_W(idx_t w) idx_t x, idx_t y, idx_t z) =0;
 
+        // Calculate scalar results at time t for z from begin_z to end_z-1
+        // where valid. Used only for validation w/the 'ref_rows' option.
+        virtual void
+        calc_ref_row(idx_t t, ARG_W(idx_t w) idx_t x, idx_t y,
+                     idx_t begin_z, idx_t end_z) =0;
+
         // Calculate results within a block.
         virtual void
         calc_block(idx_t bt,
@@ -536,6 +660,18 @@ namespace yask {
                                    idx_t begin_sbxv, idx_t begin_sbyv, idx_t begin_sbzv,
                                    idx_t end_sbtv, ARG_W(idx_t end_sbwv)
                                    idx_t end_sbxv, idx_t end_sbyv, idx_t end_sbzv) =0;
+
+        // Calculate one sub-block of results from begin to end-1 on each
+        // spatial dimension using whole clusters, but only update the
+        // elements that are in the sub-block and in the valid domain.
+        // In the 't' dimension, evaluation is at 'sbt' only.
+        // Used when the sub-block isn't a 'simple' domain.
+        virtual void
+        calc_sub_block_of_masked_clusters(idx_t sbt,
+                                          ARG_W(idx_t begin_sbw)
+                                          idx_t begin_sbx, idx_t begin_sby, idx_t begin_sbz,
+                                          ARG_W(idx_t end_sbw)
+                                          idx_t end_sbx, idx_t end_sby, idx_t end_sbz) =0;
     };
 
 } // yask namespace.
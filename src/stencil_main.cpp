@@ -166,7 +166,7 @@ struct AppSettings : public StencilSettings {
 };
 
 // Parse command-line args, run kernel, run validation if requested.
-int main(int argc, char** argv)
+int yask_main(int argc, char** argv)
 {
     // Parse cmd-line options.
     AppSettings opts;
@@ -185,6 +185,9 @@ int main(int argc, char** argv)
     // Alloc memory, create lists of grids, etc.
     context.allocAll();
 
+    // Adjust rank-domain sizes and realloc if requested.
+    context.balanceRanks();
+
     // Exit if nothing to do.
     if (opts.num_trials < 1) {
         cerr << "Exiting because no trials are specified." << endl;
@@ -230,6 +233,7 @@ int main(int argc, char** argv)
     os << endl << divLine <<
         "Running " << opts.num_trials << " performance trial(s) of " <<
         opts.dt << " time step(s) each...\n";
+    context.clearHaloStats();
     for (idx_t tr = 0; tr < opts.num_trials; tr++) {
         os << divLine;
 
@@ -290,6 +294,9 @@ int main(int argc, char** argv)
         " point-updates/sec is based on grid-point-updates as described above.\n" <<
         " est-FLOPS is based on est-FP-ops as described above.\n" <<
         endl;
+
+    // Halo-exchange stats from all trials.
+    context.printHaloStats(os);
     
     if (opts.validate) {
         context.global_barrier();
@@ -347,3 +354,13 @@ int main(int argc, char** argv)
     
     return 0;
 }
+
+int main(int argc, char** argv)
+{
+#ifdef USE_MPI_EMU
+    // Run yask_main() on each emulated rank.
+    return MPI_Emu_run(yask_main, argc, argv);
+#else
+    return yask_main(argc, argv);
+#endif
+}
@@ -95,6 +95,176 @@ namespace yask {
         return os.str();
     }
 
+    // Rotate the 'nbits'-bit value 'v' left by 'r' bits.
+    static inline idx_t rotlBits(idx_t v, int r, int nbits) {
+        r %= nbits;
+        idx_t mask = (idx_t(1) << nbits) - 1;
+        return ((v << r) | (v >> (nbits - r))) & mask;
+    }
+
+    // Number of trailing 1 bits in 'v'.
+    static inline int trailingOnes(idx_t v) {
+        int n = 0;
+        while (v & 1) {
+            v >>= 1;
+            n++;
+        }
+        return n;
+    }
+
+    // Common code for mortonIndices() and hilbertIndices().  Descends
+    // through the sub-cubes of the enclosing power-of-2 cube, visiting the
+    // children of each in curve order and counting the points inside
+    // 'sizes' to find the child containing 'i'.  The Hilbert child order
+    // and orientation use the entry-point and direction transforms from
+    // C. Hamilton, "Compact Hilbert Indices," Dalhousie Univ. TR CS-2006-07.
+    static void curveIndices(idx_t i, int ndims, const idx_t* sizes, idx_t* indices,
+                             bool hilbert) {
+
+        // Dims of size > 1, with the last one in bit 0 of child codes
+        // so that the path moves first in the inner dim.
+        vector<int> adims;
+        idx_t maxSize = 1;
+        for (int j = 0; j < ndims; j++) {
+            indices[j] = 0;
+            if (sizes[j] > 1) {
+                adims.insert(adims.begin(), j);
+                maxSize = max(maxSize, sizes[j]);
+            }
+        }
+        int m = adims.size();
+        if (m == 0)
+            return;
+        int nlevels = 0;
+        while ((idx_t(1) << nlevels) < maxSize)
+            nlevels++;
+        idx_t nchildren = idx_t(1) << m;
+
+        idx_t entry = 0;        // Hilbert entry point in current cube.
+        int dir = 0;            // Hilbert direction in current cube.
+        for (int level = nlevels - 1; level >= 0; level--) {
+            idx_t half = idx_t(1) << level;
+
+            idx_t c = 0;
+            for (; c < nchildren; c++) {
+
+                // Corner of child 'c' as a bit per dim.
+                idx_t bits = c;
+                if (hilbert)
+                    bits = rotlBits(c ^ (c >> 1), dir + 1, m) ^ entry;
+
+                // Points of this child inside 'sizes'.
+                idx_t npts = 1;
+                for (int k = 0; k < m && npts; k++) {
+                    int j = adims[k];
+                    idx_t lo = indices[j] + ((bits >> k) & 1) * half;
+                    npts *= max(min(lo + half, sizes[j]) - lo, idx_t(0));
+                }
+                if (i < npts) {
+                    for (int k = 0; k < m; k++)
+                        indices[adims[k]] += ((bits >> k) & 1) * half;
+                    break;
+                }
+                i -= npts;
+            }
+            assert(c < nchildren);
+
+            // Orientation of the child.
+            if (hilbert) {
+                idx_t ce = 0;
+                int cd = 0;
+                if (c > 0) {
+                    idx_t c2 = (c - 1) & ~idx_t(1);
+                    ce = c2 ^ (c2 >> 1);
+                    cd = trailingOnes((c & 1) ? c : c - 1) % m;
+                }
+                entry ^= rotlBits(ce, dir + 1, m);
+                dir = (dir + cd + 1) % m;
+            }
+        }
+    }
+    void mortonIndices(idx_t i, int ndims, const idx_t* sizes, idx_t* indices) {
+        curveIndices(i, ndims, sizes, indices, false);
+    }
+    void hilbertIndices(idx_t i, int ndims, const idx_t* sizes, idx_t* indices) {
+        curveIndices(i, ndims, sizes, indices, true);
+    }
+
+    // Number of leaves from bisecting 'n' until no larger than 'leaf'.
+    // Bisecting sizes 's' and 's+1' only makes sizes 's/2' and 's/2+1',
+    // so each level is kept as 2 (size, count) pairs.
+    static idx_t bisectNumLeaves1D(idx_t n, idx_t leaf) {
+        leaf = max(leaf, idx_t(1));
+        idx_t s = n, ns = 1, ns1 = 0; // 'ns' of size 's' and 'ns1' of size 's+1'.
+        idx_t nleaves = 0;
+        while (ns || ns1) {
+            idx_t h = s / 2, nh = 0, nh1 = 0; // counts of sizes 'h' and 'h+1'.
+            if (s <= leaf)
+                nleaves += ns;
+            else if (s % 2) {
+                nh += ns;
+                nh1 += ns;
+            } else
+                nh += 2 * ns;
+            if (s + 1 <= leaf)
+                nleaves += ns1;
+            else if (s % 2)
+                nh1 += 2 * ns1;
+            else {
+                nh += ns1;
+                nh1 += ns1;
+            }
+            s = h;
+            ns = nh;
+            ns1 = nh1;
+        }
+        return nleaves;
+    }
+    
+    // The leaves in each dim are independent of the order of the splits,
+    // so the total is their product.
+    idx_t bisectNumLeaves(int ndims, const idx_t* sizes, const idx_t* leafSizes) {
+        idx_t nleaves = 1;
+        for (int j = 0; j < ndims; j++)
+            nleaves *= bisectNumLeaves1D(sizes[j], leafSizes[j]);
+        return nleaves;
+    }
+
+    void bisectIndices(idx_t i, int ndims, const idx_t* sizes, const idx_t* leafSizes,
+                       idx_t* firsts, idx_t* counts) {
+        vector<idx_t> leafs(ndims);
+        for (int j = 0; j < ndims; j++) {
+            firsts[j] = 0;
+            counts[j] = sizes[j];
+            leafs[j] = max(leafSizes[j], idx_t(1));
+        }
+        while (true) {
+
+            // Find dim to split: largest relative to leaf size.
+            // Ties go to the outer dim.
+            int sj = -1;
+            for (int j = 0; j < ndims; j++) {
+                if (counts[j] > leafs[j] &&
+                    (sj < 0 || counts[j] * leafs[sj] > counts[sj] * leafs[j]))
+                    sj = j;
+            }
+            if (sj < 0)
+                break;
+
+            // Descend into the half containing leaf 'i'.
+            idx_t nlo = counts[sj] / 2;
+            idx_t n = counts[sj];
+            counts[sj] = nlo;
+            idx_t nleavesLo = bisectNumLeaves(ndims, counts, leafs.data());
+            if (i < nleavesLo)
+                continue;
+            i -= nleavesLo;
+            firsts[sj] += nlo;
+            counts[sj] = n - nlo;
+        }
+        assert(i == 0);
+    }
+
     // Round up val to a multiple of mult.
     // Print a message if rounding is done.
     idx_t roundUp(ostream& os, idx_t val, idx_t mult, const string& name)
@@ -36,6 +36,7 @@ IN THE SOFTWARE.
 #include <math.h>
 #include <time.h>
 #include <limits.h>
+#include <float.h>
 
 #include <stdexcept>
 #include <map>
@@ -70,13 +71,16 @@ IN THE SOFTWARE.
 #define VTUNE_RESUME ((void)0)
 #endif
 
-// MPI or stubs.
-#ifdef USE_MPI
+// MPI, MPI emulator, or stubs.
+#if defined(USE_MPI_EMU)
+#include "mpi_emu.hpp"
+#elif defined(USE_MPI)
 #include "mpi.h"
 #else
 #define MPI_PROC_NULL (-1)
 #define MPI_Barrier(comm) ((void)0)
 #define MPI_Comm int
+#define MPI_Win int
 #define MPI_Finalize() ((void)0)
 #endif
 
@@ -123,6 +127,24 @@ namespace yask {
     void assertEqualityOverRanks(idx_t rank_val, MPI_Comm comm,
                                  const std::string& descr);
     
+    // Set 'indices' to the point at position 'i' along a Z-order (Morton) or
+    // Hilbert curve through the 'ndims'-D space of size 'sizes'.  Sizes
+    // need not be powers of 2: the curve through the enclosing power-of-2
+    // space is followed, skipping points outside 'sizes', so each 'i' in
+    // [0, product of sizes) maps to a unique point.  Dims of size 1 are
+    // ignored, so the path is the same as in the fewer dims.
+    extern void mortonIndices(idx_t i, int ndims, const idx_t* sizes, idx_t* indices);
+    extern void hilbertIndices(idx_t i, int ndims, const idx_t* sizes, idx_t* indices);
+
+    // Recursively bisect an 'ndims'-D space of size 'sizes', always
+    // splitting the dim that is largest relative to 'leafSizes', until
+    // each leaf is no larger than 'leafSizes'.  bisectNumLeaves() returns
+    // the number of leaves, and bisectIndices() sets the first indices and
+    // sizes of leaf 'i', numbered in depth-first order.
+    extern idx_t bisectNumLeaves(int ndims, const idx_t* sizes, const idx_t* leafSizes);
+    extern void bisectIndices(idx_t i, int ndims, const idx_t* sizes, const idx_t* leafSizes,
+                              idx_t* firsts, idx_t* counts);
+
     // Round up val to a multiple of mult.
     // Print a message if rounding is done.
     extern idx_t roundUp(std::ostream& os,